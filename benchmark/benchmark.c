@@ -0,0 +1,342 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Microbenchmarks for the hot paths of the runtime itself, so
+ * regressions in the overhead of the framework are caught before
+ * they distort measurements of the code under test.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "code_renderer.h"
+#include "efitest/efitest.h"
+#include "efitest/efitest_init.h"
+#include "efitest/efitest_utils.h"
+#include "shim.h"
+
+#define DEFAULT_SAMPLE_COUNT 30
+#define DEFAULT_SAMPLE_TIME 2000000// The minimum duration of a single sample in nanoseconds
+#define MAX_SAMPLE_COUNT 1000
+#define MAX_ITERATION_COUNT (1ULL << 32)
+#define SITE_COUNT 64         // The number of distinct assertion sites failed per group
+#define ERROR_BATCH_SIZE 1024 // The number of errors recorded before the list is cleared
+#define LONG_EXPRESSION                                                                                                \
+    "compute_checksum(buffer, sizeof(buffer) / sizeof(*buffer)) == ((expected_checksum ^ 0xFFFFFFFFu) & mask) && "     \
+    "strcmp(device->name, \"virtio-blk\") == 0 && device->block_size * device->block_count >= MIN_SIZE && "        \
+    "(device->flags & (DEVICE_FLAG_READ_ONLY | DEVICE_FLAG_REMOVABLE)) == 0 && device->queue_count > 1"
+
+typedef void (*BenchmarkFunction)(UINT64 iterations);
+
+typedef struct _Benchmark {
+    const char* name;
+    BenchmarkFunction function;
+} Benchmark;
+
+typedef struct _Statistics {
+    double min;   // All values are in nanoseconds per iteration
+    double max;
+    double mean;
+    double median;
+    double stddev;// Sample standard deviation
+    double mad;   // Median absolute deviation, robust against outliers caused by the host
+    double p90;
+} Statistics;
+
+// NOLINTBEGIN
+static EFITestContext g_context = {
+        .test_name = "benchmark",
+        .file_path = __FILE__,
+        .file_name = "benchmark.c",
+        .group_name = "benchmark",
+};
+static double g_samples[MAX_SAMPLE_COUNT];
+static double g_deviations[MAX_SAMPLE_COUNT];
+// NOLINTEND
+
+// The benchmark doesn't contain any tests, these are usually generated by the discoverer
+
+void efitest_run_tests(EFITestContext* context) {
+}
+
+const EFITestGroup* efitest_get_groups(UINTN* count) {
+    *count = 0;
+    return NULL;
+}
+
+const EFITestBaseline* efitest_get_baselines(UINTN* count) {
+    *count = 0;
+    return NULL;
+}
+
+UINTN efitest_get_shard_count() {
+    return 0;
+}
+
+BOOLEAN efitest_is_resident_runner() {
+    return FALSE;
+}
+
+// Benchmarks
+
+static void benchmark_assert_pass(UINT64 iterations) {
+    for(UINT64 index = 0; index < iterations; ++index) {
+        efitest_assert(index != UINT64_MAX, &g_context, __LINE__, "index != UINT64_MAX");
+    }
+}
+
+static void benchmark_assert_fail_repeated(UINT64 iterations) {
+    efitest_errors_clear();
+    for(UINT64 index = 0; index < iterations; ++index) {
+        efitest_assert(FALSE, &g_context, __LINE__, "index == UINT64_MAX");
+    }
+    efitest_errors_clear();
+}
+
+static void benchmark_assert_fail_sites(UINT64 iterations) {
+    for(UINT64 index = 0; index < iterations; ++index) {
+        if(index % SITE_COUNT == 0) {
+            efitest_errors_clear();
+        }
+        efitest_assert(FALSE, &g_context, index % SITE_COUNT, "index == UINT64_MAX");
+    }
+    efitest_errors_clear();
+}
+
+// The list keeps its capacity when it is cleared, so this only measures appending
+static void benchmark_errors_add(UINT64 iterations) {
+    const EFITestError error = {
+            .context = g_context,
+            .expression = "index == UINT64_MAX",
+            .line_number = __LINE__,
+            .hit_count = 1,
+            .last_context = g_context,
+    };
+    for(UINT64 index = 0; index < iterations; ++index) {
+        if(efitest_errors_get_count() == ERROR_BATCH_SIZE) {
+            efitest_errors_clear();
+        }
+        efitest_errors_add(&error);
+    }
+    efitest_errors_clear();
+}
+
+// Frees the list after every batch, so every batch grows it from scratch
+static void benchmark_errors_growth(UINT64 iterations) {
+    const EFITestError error = {
+            .context = g_context,
+            .expression = "index == UINT64_MAX",
+            .line_number = __LINE__,
+            .hit_count = 1,
+            .last_context = g_context,
+    };
+    efitest_errors_free();
+    for(UINT64 index = 0; index < iterations; ++index) {
+        if(efitest_errors_get_count() == ERROR_BATCH_SIZE) {
+            efitest_errors_free();
+        }
+        efitest_errors_add(&error);
+    }
+    efitest_errors_free();
+}
+
+static void benchmark_uuid_generate(UINT64 iterations) {
+    EFITestUUID uuid;
+    for(UINT64 index = 0; index < iterations; ++index) {
+        efitest_uuid_generate(&uuid);
+    }
+}
+
+static void benchmark_logf(UINT64 iterations) {
+    for(UINT64 index = 0; index < iterations; ++index) {
+        efitest_logf(L"Iteration " ETEST_FMT_UINT64 L" of %a\n", index, g_context.test_name);
+    }
+}
+
+static void benchmark_loglnfa(UINT64 iterations) {
+    for(UINT64 index = 0; index < iterations; ++index) {
+        efitest_loglnfa("Iteration " ETEST_FMT_UINT64 " of %a", index, g_context.test_name);
+    }
+}
+
+static void benchmark_loga(UINT64 iterations) {
+    for(UINT64 index = 0; index < iterations; ++index) {
+        efitest_loga("A log message without any format arguments\n");
+    }
+}
+
+static void benchmark_render_code(UINT64 iterations) {
+    for(UINT64 index = 0; index < iterations; ++index) {
+        render_code(LONG_EXPRESSION, 1234);
+    }
+}
+
+// NOLINTBEGIN
+static const Benchmark g_benchmarks[] = {
+        {"assert_pass", benchmark_assert_pass},
+        {"assert_fail_repeated", benchmark_assert_fail_repeated},
+        {"assert_fail_sites", benchmark_assert_fail_sites},
+        {"errors_add", benchmark_errors_add},
+        {"errors_growth", benchmark_errors_growth},
+        {"uuid_generate", benchmark_uuid_generate},
+        {"logf", benchmark_logf},
+        {"loglnfa", benchmark_loglnfa},
+        {"loga", benchmark_loga},
+        {"render_code", benchmark_render_code},
+};
+// NOLINTEND
+
+// Measurement
+
+static inline UINT64 get_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((UINT64) time.tv_sec * 1000000000ULL) + (UINT64) time.tv_nsec;
+}
+
+static UINT64 measure(const Benchmark* benchmark, UINT64 iterations) {
+    const UINT64 start_time = get_time();
+    benchmark->function(iterations);
+    return get_time() - start_time;
+}
+
+/*
+ * Double the number of iterations until a single sample takes long
+ * enough for the clock resolution not to matter, which also warms up
+ * the caches and the allocator.
+ */
+static UINT64 calibrate(const Benchmark* benchmark, UINT64 sample_time) {
+    UINT64 iterations = 1;
+    while(measure(benchmark, iterations) < sample_time && iterations < MAX_ITERATION_COUNT) {
+        iterations <<= 1;
+    }
+    return iterations;
+}
+
+static int compare_doubles(const void* value1, const void* value2) {
+    const double lhs = *(const double*) value1;
+    const double rhs = *(const double*) value2;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static double get_percentile(const double* sorted_values, UINTN count, UINTN percent) {
+    return sorted_values[((count - 1) * percent + 50) / 100];
+}
+
+static Statistics compute_statistics(double* samples, UINTN count) {
+    qsort(samples, count, sizeof(double), compare_doubles);
+    Statistics statistics = {
+            .min = samples[0],
+            .max = samples[count - 1],
+            .median = get_percentile(samples, count, 50),
+            .p90 = get_percentile(samples, count, 90),
+    };
+
+    double sum = 0.0;
+    for(UINTN index = 0; index < count; ++index) {
+        sum += samples[index];
+    }
+    statistics.mean = sum / (double) count;
+
+    double squared_sum = 0.0;
+    for(UINTN index = 0; index < count; ++index) {
+        const double deviation = samples[index] - statistics.mean;
+        squared_sum += deviation * deviation;
+        g_deviations[index] = fabs(samples[index] - statistics.median);
+    }
+    statistics.stddev = count > 1 ? sqrt(squared_sum / (double) (count - 1)) : 0.0;
+    qsort(g_deviations, count, sizeof(double), compare_doubles);
+    statistics.mad = get_percentile(g_deviations, count, 50);
+    return statistics;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: efitest-benchmark [--filter=<substring>] [--samples=<count>] "
+                    "[--sample-time=<ns>] [--output=<path>]\n");
+}
+
+int main(int num_args, char** args) {
+    const char* filter = NULL;
+    const char* output_path = NULL;
+    UINTN sample_count = DEFAULT_SAMPLE_COUNT;
+    UINT64 sample_time = DEFAULT_SAMPLE_TIME;
+    for(int index = 1; index < num_args; ++index) {
+        const char* arg = args[index];
+        if(strncmp(arg, "--filter=", 9) == 0) {
+            filter = arg + 9;
+        }
+        else if(strncmp(arg, "--samples=", 10) == 0) {
+            sample_count = strtoull(arg + 10, NULL, 10);
+        }
+        else if(strncmp(arg, "--sample-time=", 14) == 0) {
+            sample_time = strtoull(arg + 14, NULL, 10);
+        }
+        else if(strncmp(arg, "--output=", 9) == 0) {
+            output_path = arg + 9;
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+    if(sample_count < 1 || sample_count > MAX_SAMPLE_COUNT) {
+        fprintf(stderr, "The sample count has to be between 1 and %d\n", MAX_SAMPLE_COUNT);
+        return 1;
+    }
+
+    FILE* output = output_path == NULL ? stdout : fopen(output_path, "w");
+    if(output == NULL) {
+        fprintf(stderr, "Could not open %s\n", output_path);
+        return 1;
+    }
+
+    shim_init();
+    capture_init();
+
+    fprintf(output, "{\n  \"unit\": \"ns\",\n  \"samples\": %lu,\n  \"benchmarks\": [", (unsigned long) sample_count);
+    BOOLEAN is_first = TRUE;
+    for(UINTN index = 0; index < arraylen(g_benchmarks); ++index) {
+        const Benchmark* benchmark = &(g_benchmarks[index]);
+        if(filter != NULL && strstr(benchmark->name, filter) == NULL) {
+            continue;
+        }
+
+        const UINT64 iterations = calibrate(benchmark, sample_time);
+        for(UINTN sample = 0; sample < sample_count; ++sample) {
+            g_samples[sample] = (double) measure(benchmark, iterations) / (double) iterations;
+        }
+        const Statistics statistics = compute_statistics(g_samples, sample_count);
+
+        fprintf(output,
+                "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, "
+                "\"max\": %.3f, \"p90\": %.3f, \"stddev\": %.3f, \"mad\": %.3f}",
+                is_first ? "" : ",", benchmark->name, (unsigned long long) iterations, statistics.min,
+                statistics.median, statistics.mean, statistics.max, statistics.p90, statistics.stddev,
+                statistics.mad);
+        fprintf(stderr, "%-24s %12.2f ns/op (MAD %.2f, min %.2f, %llu iterations)\n", benchmark->name,
+                statistics.median, statistics.mad, statistics.min, (unsigned long long) iterations);
+        is_first = FALSE;
+    }
+    fprintf(output, "\n  ]\n}\n");
+
+    if(output != stdout) {
+        fclose(output);
+    }
+    capture_free();
+    return 0;
+}
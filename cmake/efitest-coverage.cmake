@@ -0,0 +1,45 @@
+# Merges the coverage dumps written by one or more (sharded) runs of a
+# test image into .gcda files next to the object files and generates a
+# report from them if gcovr is available.
+#
+# Expects COVERAGE_TOOL, GCOV_TOOL, GCOV, DUMP_DIR, OBJECT_DIR, SOURCE_DIR and REPORT_DIR to be defined.
+
+file(GLOB dump_files "${DUMP_DIR}/*.bin")
+if (NOT dump_files)
+    message(FATAL_ERROR "No coverage dumps found in ${DUMP_DIR}, copy efitest-coverage.bin from the ESP of every run there")
+endif ()
+
+# Counters of objects which are no longer part of the image would show up in the report otherwise
+file(GLOB_RECURSE stale_files "${OBJECT_DIR}/*.gcda")
+if (stale_files)
+    file(REMOVE ${stale_files})
+endif ()
+
+string(REPLACE ";" "," dump_flags "${dump_files}")
+execute_process(COMMAND ${COVERAGE_TOOL}
+        -o "${DUMP_DIR}/merge"
+        -g ${GCOV_TOOL}
+        -f ${dump_flags}
+        RESULT_VARIABLE exit_code)
+if (NOT ${exit_code} EQUAL 0)
+    message(FATAL_ERROR "Could not merge coverage dumps in ${DUMP_DIR}")
+endif ()
+
+find_program(GCOVR gcovr)
+if (NOT GCOVR)
+    message(STATUS "Merged coverage data into ${OBJECT_DIR}, install gcovr to generate a report")
+    return()
+endif ()
+
+file(MAKE_DIRECTORY ${REPORT_DIR})
+execute_process(COMMAND ${GCOVR}
+        --root ${SOURCE_DIR}
+        --object-directory ${OBJECT_DIR}
+        --gcov-executable ${GCOV}
+        --html-details "${REPORT_DIR}/index.html"
+        --txt-summary
+        RESULT_VARIABLE exit_code)
+if (NOT ${exit_code} EQUAL 0)
+    message(FATAL_ERROR "Could not generate coverage report")
+endif ()
+message(STATUS "Coverage report written to ${REPORT_DIR}/index.html")
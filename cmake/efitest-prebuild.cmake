@@ -24,7 +24,7 @@ endif ()
 message(STATUS "Building EFITEST discoverer..")
 execute_process(COMMAND ${CMAKE_COMMAND}
         --build "${efitest_build_dir}"
-        --target efitest-discoverer
+        --target efitest-discoverer efitest-coverage
         -- -j ${NUM_THREADS}
         RESULT_VARIABLE exit_code
         ERROR_VARIABLE process_error
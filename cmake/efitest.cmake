@@ -1,28 +1,253 @@
 include_guard()
 
+set(EFITEST_CMAKE_DIR "${CMAKE_CURRENT_LIST_DIR}")
+set(EFITEST_COVERAGE_DIR "${CMAKE_BINARY_DIR}/efitest-coverage" CACHE PATH
+        "Directory to collect coverage dumps in, one subdirectory per test target")
+set(EFITEST_FUZZ_C_COMPILER "clang" CACHE STRING "The host C compiler fuzzers are built with, has to support libFuzzer")
+set(EFITEST_FUZZ_CXX_COMPILER "clang++" CACHE STRING "The host C++ compiler fuzzers are built with")
+set(EFITEST_FUZZ_SANITIZERS "address,undefined" CACHE STRING "The sanitizers fuzzers are built with")
+if (EFITEST_COVERAGE)
+    # The host tools have to match the compiler version which produced the counters
+    get_filename_component(efitest_compiler_dir ${CMAKE_C_COMPILER} DIRECTORY)
+    string(REGEX MATCH "^[0-9]+" efitest_compiler_major "${CMAKE_C_COMPILER_VERSION}")
+    find_program(EFITEST_GCOV_TOOL NAMES "gcov-tool-${efitest_compiler_major}" gcov-tool HINTS ${efitest_compiler_dir})
+    find_program(EFITEST_GCOV NAMES "gcov-${efitest_compiler_major}" gcov HINTS ${efitest_compiler_dir})
+    if (NOT EFITEST_GCOV_TOOL)
+        message(FATAL_ERROR "EFITEST_COVERAGE requires gcov-tool to merge coverage dumps")
+    endif ()
+endif ()
+
+# efitest_instrument_coverage(<target>)
+#
+# Instruments the sources of the given target, for example the firmware code
+# under test, so its counters are included in the coverage dump of the test image.
+# Only arc counters are collected, which keeps the overhead low enough for nightly runs.
+macro(efitest_instrument_coverage target)
+    target_compile_options(${target} PRIVATE --coverage -fprofile-info-section=efitest_gcov_info)
+endmacro()
+
+# efitest_add_tests(<target> <access> <directories...>
+#                   [UNITY_BATCH_SIZE <size>]
+#                   [PRECOMPILE_HEADERS]
+#                   [SHARDS <count> [DURATIONS <results file>]]
+#                   [BASELINES <baselines file>]
+#                   [MODULES]
+#                   [FUZZERS [FUZZ_SOURCES <sources...>] [FUZZ_INCLUDE_DIRECTORIES <directories...>]])
+#
+# UNITY_BATCH_SIZE merges up to <size> test sources into a single translation
+# unit to cut down on header parsing, static symbols which collide between
+# merged sources are renamed automatically. Sources containing ETEST_NO_UNITY
+# are always compiled on their own.
+# PRECOMPILE_HEADERS precompiles the EFITEST runtime headers for all test sources.
+# SHARDS plans the distribution of tests across <count> shards which is used
+# when running with --shard=<index>/<count>. DURATIONS points to a results file
+# written by a previous run with --results, tests are then assigned longest
+# first so all shards take about the same time.
+# BASELINES points to a baselines file written with --update-baselines, tests
+# which take longer than their baseline plus its tolerance fail as [SLOWER].
+# MODULES additionally builds every test source into a module <target>-<group>
+# and a <target>-runner image which stays resident and loads the modules from
+# \EFI\efitest on any volume. The <target>-modules target collects the modules
+# in <target>-modules/EFI/efitest, which can be shared with the machine.
+# FUZZERS adds a <target>-fuzzers target which builds a libFuzzer executable
+# <target name>-<test> for every ETEST_DEFINE_FUZZ test on the host, with the
+# sanitizers in EFITEST_FUZZ_SANITIZERS. The runtime runs on a shim of the
+# firmware services, FUZZ_SOURCES and FUZZ_INCLUDE_DIRECTORIES provide host
+# builds of the code under test. The test image always replays the corpus
+# in corpus/<test> next to the test source instead.
+# Every test target also gets a <target>-watch target which keeps regenerating
+# the sources of changed tests until it is interrupted.
 macro(efitest_add_tests target access)
-    # Search for source files to transform/copy
-    foreach (directory IN ITEMS ${ARGN})
-        file(GLOB_RECURSE source_files "${directory}/*.c*")
-        list(APPEND all_source_files ${source_files})
+    cmake_parse_arguments(efitest_args "PRECOMPILE_HEADERS;MODULES;FUZZERS" "UNITY_BATCH_SIZE;SHARDS;DURATIONS;BASELINES"
+            "FUZZ_SOURCES;FUZZ_INCLUDE_DIRECTORIES" ${ARGN})
+    if (NOT efitest_args_UNITY_BATCH_SIZE)
+        set(efitest_args_UNITY_BATCH_SIZE 0)
+    endif ()
+    if (NOT efitest_args_SHARDS)
+        set(efitest_args_SHARDS 0)
+    endif ()
+    set(duration_flags "")
+    if (efitest_args_DURATIONS)
+        set(duration_flags -d ${efitest_args_DURATIONS})
+        # Re-plan the shards whenever the results file is updated
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${efitest_args_DURATIONS})
+    endif ()
+    set(baseline_flags "")
+    if (efitest_args_BASELINES)
+        set(baseline_flags -b ${efitest_args_BASELINES})
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${efitest_args_BASELINES})
+    endif ()
+    set(modules_dir "${EFITEST_BINARY_DIR}/efitest-generated/${target}-modules")
+    set(module_flags "")
+    if (efitest_args_MODULES)
+        set(module_flags -m ${modules_dir})
+    endif ()
+    set(fuzzers_dir "${EFITEST_BINARY_DIR}/efitest-generated/${target}-fuzzers")
+    set(fuzzer_flags "")
+    if (efitest_args_FUZZERS)
+        set(fuzzer_flags -z ${fuzzers_dir})
+    endif ()
+    # Search for source files to transform/copy, the discoverer walks the directories itself
+    # so the list of files never has to fit onto a single command line. Corpus files of fuzz
+    # tests are embedded into the generated sources, so they are inputs of the discovery too.
+    set(all_source_files "")
+    set(all_corpus_files "")
+    foreach (directory IN ITEMS ${efitest_args_UNPARSED_ARGUMENTS})
+        # Matched relative to the test directory, so a parent directory called corpus doesn't exclude everything
+        file(GLOB_RECURSE directory_files RELATIVE "${directory}" "${directory}/*")
+        list(TRANSFORM directory_files PREPEND "/")
+        set(corpus_files ${directory_files})
+        list(FILTER corpus_files INCLUDE REGEX "/corpus/")
+        list(TRANSFORM corpus_files PREPEND "${directory}")
+        list(APPEND all_corpus_files ${corpus_files})
+        list(FILTER directory_files EXCLUDE REGEX "/corpus/")
+        list(FILTER directory_files INCLUDE REGEX "\\.c[^/]*$")
+        list(TRANSFORM directory_files PREPEND "${directory}")
+        list(APPEND all_source_files ${directory_files})
     endforeach ()
-    string(REPLACE ";" "," file_flags "${all_source_files}")
-    # Set up directories
-    set(generated_dir "${EFITEST_BINARY_DIR}/efitest-generated")
+    string(SHA256 source_files_hash "${all_source_files};${all_corpus_files}")
+    # Set up directories, stale files are removed by the discoverer so every target needs its own
+    set(generated_dir "${EFITEST_BINARY_DIR}/efitest-generated/${target}")
     if (NOT EXISTS ${generated_dir})
         file(MAKE_DIRECTORY ${generated_dir})
     endif ()
-    # Discover the tests while configuring
-    execute_process(COMMAND "${EFITEST_BINARY_DIR}/efitest-prebuild/efitest-discoverer"
+    # The response file lives next to the generated directory since the discoverer would remove it as stale
+    set(inputs_file "${EFITEST_BINARY_DIR}/efitest-generated/${target}.rsp")
+    string(REPLACE ";" "\n" inputs "${efitest_args_UNPARSED_ARGUMENTS}")
+    file(CONFIGURE OUTPUT ${inputs_file} CONTENT "${inputs}\n" @ONLY) # Only touches the file when it changes
+    # Discover the tests while configuring, unless neither the arguments, the set of sources nor any input changed
+    # since the stamp was written. The stamp is refreshed by the discoverer when running the <target>-watch target.
+    set(discoverer "${EFITEST_BINARY_DIR}/efitest-prebuild/efitest-discoverer")
+    set(discoverer_args
             -o ${generated_dir}
-            -f ${file_flags}
-            WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR})
-    # Define a dummy target for IDE integration
-    add_library("${target}-dummy" STATIC ${all_source_files})
+            -f @${inputs_file}
+            -u ${efitest_args_UNITY_BATCH_SIZE}
+            -s ${efitest_args_SHARDS}
+            ${duration_flags}
+            ${baseline_flags}
+            ${module_flags}
+            ${fuzzer_flags})
+    set(stamp_file "${generated_dir}/discovery.stamp")
+    set(needs_discovery TRUE)
+    if (EXISTS ${stamp_file})
+        file(READ ${stamp_file} stamp_args)
+        if ("${stamp_args}" STREQUAL "${discoverer_args};${source_files_hash}")
+            set(needs_discovery FALSE)
+            set(discovery_inputs ${discoverer} ${all_source_files} ${all_corpus_files} ${efitest_args_DURATIONS}
+                    ${efitest_args_BASELINES})
+            foreach (input IN ITEMS ${discovery_inputs})
+                if (${input} IS_NEWER_THAN ${stamp_file})
+                    set(needs_discovery TRUE)
+                    break()
+                endif ()
+            endforeach ()
+        endif ()
+    endif ()
+    if (needs_discovery)
+        execute_process(COMMAND ${discoverer} ${discoverer_args}
+                WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
+                RESULT_VARIABLE discovery_result)
+        if (discovery_result EQUAL 0)
+            file(WRITE ${stamp_file} "${discoverer_args};${source_files_hash}")
+        endif ()
+    endif ()
+    # Regenerate the sources of changed tests while editing, without reconfiguring
+    add_custom_target("${target}-watch"
+            COMMAND ${discoverer} ${discoverer_args} --watch
+            WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR}
+            USES_TERMINAL
+            COMMENT "Watching the tests of ${target} for changes")
+    # Define a dummy target for IDE integration, it only provides compile commands
+    # for the original sources and is never built as part of the default target
+    add_library("${target}-dummy" OBJECT EXCLUDE_FROM_ALL ${all_source_files})
     target_link_libraries("${target}-dummy" PRIVATE efitest)
     # Define actual test executable
     cmx_add_efi_executable(${target} ${access} ${generated_dir})
     target_link_libraries(${target} PRIVATE efitest)
+    set_target_properties(${target} PROPERTIES EFITEST_MANIFEST "${generated_dir}/manifest.json")
+    if (efitest_args_PRECOMPILE_HEADERS)
+        target_precompile_headers(${target} PRIVATE <efitest/efitest.h>)
+    endif ()
+    # Instrument the tests and merge the dumps copied into the coverage directory on the host
+    if (EFITEST_COVERAGE)
+        efitest_instrument_coverage(${target})
+        add_custom_target("${target}-coverage"
+                COMMAND ${CMAKE_COMMAND}
+                -DCOVERAGE_TOOL=${EFITEST_BINARY_DIR}/efitest-prebuild/efitest-coverage
+                -DGCOV_TOOL=${EFITEST_GCOV_TOOL}
+                -DGCOV=${EFITEST_GCOV}
+                -DDUMP_DIR=${EFITEST_COVERAGE_DIR}/${target}
+                -DOBJECT_DIR=${CMAKE_CURRENT_BINARY_DIR}
+                -DSOURCE_DIR=${CMAKE_SOURCE_DIR}
+                -DREPORT_DIR=${CMAKE_CURRENT_BINARY_DIR}/${target}-coverage
+                -P "${EFITEST_CMAKE_DIR}/efitest-coverage.cmake"
+                COMMENT "Merging coverage data of ${target}")
+    endif ()
+    # Build every group into a module of its own and the resident runner loading them
+    set(module_targets "")
+    if (efitest_args_MODULES)
+        set(module_copy_dir "${CMAKE_CURRENT_BINARY_DIR}/${target}-modules/EFI/efitest")
+        set(module_copy_commands "")
+        file(GLOB group_dirs LIST_DIRECTORIES true "${modules_dir}/groups/*")
+        foreach (group_dir IN ITEMS ${group_dirs})
+            get_filename_component(group_name ${group_dir} NAME)
+            set(module_target "${target}-${group_name}")
+            cmx_add_efi_executable(${module_target} ${access} ${group_dir})
+            target_link_libraries(${module_target} PRIVATE efitest)
+            if (EFITEST_COVERAGE)
+                efitest_instrument_coverage(${module_target})
+            endif ()
+            list(APPEND module_targets ${module_target})
+            list(APPEND module_copy_commands COMMAND ${CMAKE_COMMAND} -E copy_if_different
+                    "$<TARGET_FILE_DIR:${module_target}>/${module_target}.efi" ${module_copy_dir})
+        endforeach ()
+        add_custom_target("${target}-modules"
+                COMMAND ${CMAKE_COMMAND} -E make_directory ${module_copy_dir}
+                ${module_copy_commands}
+                COMMENT "Collecting the test modules of ${target}")
+        if (module_targets)
+            add_dependencies("${target}-modules" ${module_targets})
+        endif ()
+        cmx_add_efi_executable("${target}-runner" ${access} "${modules_dir}/runner")
+        target_link_libraries("${target}-runner" PRIVATE efitest)
+        cmx_add_esp_image("${target}-runner-esp"
+                BOOT_FILE "${target}-runner.efi"
+                IMAGE_NAME "${target}-runner")
+        add_dependencies("${target}-runner-esp" "${target}-runner")
+    endif ()
+    set_target_properties(${target} PROPERTIES EFITEST_MODULE_TARGETS "${module_targets}")
+    # Build the fuzzers for the host by a nested CMake process, just like the discoverer
+    if (efitest_args_FUZZERS)
+        set(fuzz_sources "")
+        foreach (fuzz_source IN ITEMS ${efitest_args_FUZZ_SOURCES})
+            get_filename_component(fuzz_source ${fuzz_source} ABSOLUTE)
+            list(APPEND fuzz_sources ${fuzz_source})
+        endforeach ()
+        set(fuzz_include_directories "")
+        foreach (fuzz_include_directory IN ITEMS ${efitest_args_FUZZ_INCLUDE_DIRECTORIES})
+            get_filename_component(fuzz_include_directory ${fuzz_include_directory} ABSOLUTE)
+            list(APPEND fuzz_include_directories ${fuzz_include_directory})
+        endforeach ()
+        # Lists are passed through an initial cache, since they can't be passed on the command line
+        set(fuzz_cache_file "${EFITEST_BINARY_DIR}/efitest-generated/${target}-fuzzers.cmake")
+        file(CONFIGURE OUTPUT ${fuzz_cache_file} CONTENT [[
+set(FUZZERS_DIR "@fuzzers_dir@" CACHE PATH "" FORCE)
+set(FUZZ_SOURCES "@fuzz_sources@" CACHE STRING "" FORCE)
+set(FUZZ_INCLUDE_DIRECTORIES "@fuzz_include_directories@" CACHE STRING "" FORCE)
+set(FUZZ_SANITIZERS "@EFITEST_FUZZ_SANITIZERS@" CACHE STRING "" FORCE)
+]] @ONLY)
+        set(fuzz_build_dir "${CMAKE_CURRENT_BINARY_DIR}/${target}-fuzzers")
+        add_custom_target("${target}-fuzzers"
+                COMMAND ${CMAKE_COMMAND} -E env CC=${EFITEST_FUZZ_C_COMPILER} CXX=${EFITEST_FUZZ_CXX_COMPILER}
+                ${CMAKE_COMMAND}
+                -C ${fuzz_cache_file}
+                -S "${EFITEST_CMAKE_DIR}/../fuzz"
+                -B ${fuzz_build_dir}
+                -DCMAKE_BUILD_TYPE=RelWithDebInfo
+                COMMAND ${CMAKE_COMMAND} --build ${fuzz_build_dir}
+                USES_TERMINAL
+                COMMENT "Building the fuzzers of ${target} for the host")
+    endif ()
     # Define image targets for the test executable
     cmx_add_esp_image("${target}-esp"
             BOOT_FILE "${target}.efi"
@@ -35,22 +260,28 @@ macro(efitest_add_tests target access)
     add_dependencies("${target}-iso" "${target}-esp")
 endmacro()
 
+# Applies the given target command to the test target, its IDE dummy and its modules
+macro(efitest_apply_to_targets command target access)
+    cmake_language(CALL ${command} ${target} ${access} ${ARGN})
+    cmake_language(CALL ${command} "${target}-dummy" ${access} ${ARGN})
+    get_target_property(efitest_module_targets ${target} EFITEST_MODULE_TARGETS)
+    foreach (efitest_module_target IN ITEMS ${efitest_module_targets})
+        cmake_language(CALL ${command} ${efitest_module_target} ${access} ${ARGN})
+    endforeach ()
+endmacro()
+
 macro(efitest_include_directories target access)
-    target_include_directories(${target} ${access} ${ARGN})
-    target_include_directories("${target}-dummy" ${access} ${ARGN})
+    efitest_apply_to_targets(target_include_directories ${target} ${access} ${ARGN})
 endmacro()
 
 macro(efitest_link_libraries target access)
-    target_link_libraries(${target} ${access} ${ARGN})
-    target_link_libraries("${target}-dummy" ${access} ${ARGN})
+    efitest_apply_to_targets(target_link_libraries ${target} ${access} ${ARGN})
 endmacro()
 
 macro(efitest_compile_options target access)
-    target_compile_options(${target} ${access} ${ARGN})
-    target_compile_options("${target}-dummy" ${access} ${ARGN})
+    efitest_apply_to_targets(target_compile_options ${target} ${access} ${ARGN})
 endmacro()
 
 macro(efitest_compile_definitions target access)
-    target_compile_definitions(${target} ${access} ${ARGN})
-    target_compile_definitions("${target}-dummy" ${access} ${ARGN})
+    efitest_apply_to_targets(target_compile_definitions ${target} ${access} ${ARGN})
 endmacro()
\ No newline at end of file
@@ -0,0 +1,175 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Host-side counterpart of the EFITEST coverage runtime. Splits the
+ * coverage dumps written by one or more (sharded) runs of a test image
+ * into .gcda files, merges them using gcov-tool and places the result
+ * next to the object files so regular gcov based tooling can be used.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cxxopts.hpp"
+#include "fmt/format.h"
+
+static constexpr uint32_t RECORD_MAGIC = 0x56434645;// Has to match COVERAGE_RECORD_MAGIC of the runtime
+
+struct Record {
+    std::filesystem::path path;// The absolute path of the .gcda file on the build machine
+    std::string data;          // The contents of the .gcda file
+};
+
+template<typename... ARGS>
+inline auto log(fmt::format_string<ARGS...> fmt, ARGS&&... args) noexcept -> void {
+    fmt::println("-- {}", fmt::format(fmt, std::forward<ARGS>(args)...));
+}
+
+inline auto read_uint32(const std::string& source, size_t& offset) -> uint32_t {
+    if(offset + sizeof(uint32_t) > source.size()) {
+        throw std::runtime_error {"Unexpected end of coverage dump"};
+    }
+    const auto* bytes = reinterpret_cast<const uint8_t*>(source.data() + offset);
+    offset += sizeof(uint32_t);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+inline auto read_string(const std::string& source, size_t& offset, size_t length) -> std::string {
+    if(offset + length > source.size()) {
+        throw std::runtime_error {"Unexpected end of coverage dump"};
+    }
+    auto result = source.substr(offset, length);
+    offset += length;
+    return result;
+}
+
+auto read_dump(const std::filesystem::path& path) -> std::vector<Record> {
+    std::ifstream stream {path, std::ios::binary};
+    const std::string source {std::istreambuf_iterator<char> {stream}, std::istreambuf_iterator<char> {}};
+    std::vector<Record> records {};
+    size_t offset = 0;
+    while(offset < source.size()) {
+        if(read_uint32(source, offset) != RECORD_MAGIC) {
+            throw std::runtime_error {fmt::format("Corrupted record at offset {} in {}", offset, path.string())};
+        }
+        const auto path_length = read_uint32(source, offset);
+        auto record_path = read_string(source, offset, path_length);
+        const auto data_length = read_uint32(source, offset);
+        records.push_back({std::move(record_path), read_string(source, offset, data_length)});
+    }
+    return records;
+}
+
+/*
+ * gcov-tool merges directory trees by relative path, so the
+ * absolute paths are recreated below the given directory.
+ */
+inline auto compute_tree_path(const std::filesystem::path& root, const std::filesystem::path& path) noexcept
+        -> std::filesystem::path {
+    return root / path.relative_path();
+}
+
+auto write_tree(const std::filesystem::path& root, const std::vector<Record>& records) -> void {
+    for(const auto& record : records) {
+        const auto path = compute_tree_path(root, record.path);
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream stream {path, std::ios::binary};
+        stream << record.data;
+    }
+}
+
+/*
+ * gcov-tool only merges two profiles at a time, so dumps are
+ * accumulated pairwise before copying the final .gcda files
+ * to the paths they were recorded with.
+ */
+auto merge_dumps(const std::filesystem::path& out_path, const std::string& gcov_tool,
+                 const std::vector<std::string>& files) -> size_t {
+    std::filesystem::remove_all(out_path);
+
+    std::vector<Record> merged_records {};
+    std::filesystem::path merged_path {};
+    for(size_t index = 0; index < files.size(); ++index) {
+        const auto records = read_dump(files[index]);
+        const auto dump_path = out_path / fmt::format("dump_{}", index);
+        write_tree(dump_path, records);
+        log("Read {} objects from {}", records.size(), files[index]);
+        if(index == 0) {
+            merged_records = records;
+            merged_path = dump_path;
+            continue;
+        }
+
+        const auto next_path = out_path / fmt::format("merged_{}", index);
+        const auto command = fmt::format("\"{}\" merge -o \"{}\" \"{}\" \"{}\"", gcov_tool, next_path.string(),
+                                         merged_path.string(), dump_path.string());
+        if(std::system(command.c_str()) != 0) {
+            throw std::runtime_error {fmt::format("gcov-tool failed to merge {}", files[index])};
+        }
+        merged_path = next_path;
+        for(const auto& record : records) {
+            if(std::ranges::find(merged_records, record.path, &Record::path) == merged_records.end()) {
+                merged_records.push_back(record);
+            }
+        }
+    }
+
+    for(const auto& record : merged_records) {
+        const auto source_path = compute_tree_path(merged_path, record.path);
+        std::filesystem::create_directories(record.path.parent_path());
+        std::filesystem::copy_file(source_path, record.path, std::filesystem::copy_options::overwrite_existing);
+    }
+    return merged_records.size();
+}
+
+auto main(int num_args, char** args) -> int {
+    cxxopts::Options option_specs {"EFITEST Coverage", "Merges coverage dumps of EFITEST test images"};
+    // clang-format off
+    option_specs.add_options()
+            ("h,help", "Display a list of commands")
+            ("o,out", "Specifies the path of a scratch directory to merge dumps in",
+                cxxopts::value<std::string>())
+            ("g,gcov-tool", "Specifies the gcov-tool executable matching the compiler of the test image",
+                cxxopts::value<std::string>()->default_value("gcov-tool"))
+            ("f,files", "Specifies the coverage dumps to merge",
+                cxxopts::value<std::vector<std::string>>());
+    // clang-format on
+    option_specs.parse_positional({"out", "files"});
+
+    try {
+        const auto options = option_specs.parse(num_args, args);
+        if(options.count("help") > 0) {
+            log("{}", option_specs.help());
+            return 0;
+        }
+
+        const auto& files = options["files"].as<std::vector<std::string>>();
+        const auto num_files = merge_dumps(options["out"].as<std::string>(), options["gcov-tool"].as<std::string>(),
+                                           files);
+        log("Merged {} dumps into {} .gcda files", files.size(), num_files);
+    }
+    catch(const std::exception& error) {
+        log("Could not merge coverage dumps: {}", error.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -21,32 +21,100 @@
  * @since 24/09/2023
  */
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include "cxxopts.hpp"
 #include "fmt/format.h"
+#include "inputs.hpp"
+#include "json.hpp"
+#include "watch.hpp"
+
+enum class TestKind : uint8_t {
+    REGULAR,
+    PARAMETERIZED,
+    ASYNC,
+    FUZZ
+};
 
 struct Test {
     std::string name;
     size_t line_number = 0;
+    TestKind kind = TestKind::REGULAR;
+    std::string table {};            // The parameter table expression
+    std::vector<std::string> tags {};// Additional macro arguments used to categorize tests
+    uint64_t id = 0;                 // Stable ID derived from the relative source path and test name
+    size_t shard = 0;                // The shard the test was assigned to by the shard plan
+    std::filesystem::path corpus_dir {};         // The directory the inputs of a fuzz test are read from
+    std::vector<std::filesystem::path> corpus {};// The inputs a fuzz test is replayed with, sorted by name
 };
 
 struct Target {
     std::filesystem::path source_path;
-    std::filesystem::path header_path {};
+    std::string relative_path {};// Relative to the working directory, resolving it is expensive on large trees
+    std::string name {};      // Unique identifier derived from the relative source path, used for files and symbols
+    std::string group_name {};// The file name without extension, unless another source shares it
+    std::string source {};// Kept in memory so watch mode only has to re-read changed sources
     std::vector<Test> tests {};
+    std::vector<std::string> static_symbols {};// File-scope static symbols which may collide in unity builds
+    bool is_unity_excluded = false;
+};
+
+struct SourceToken {
+    std::string value;
+    size_t depth = 0;         // The brace nesting depth the token appears at
+    bool is_directive = false;// Whether the token is part of a preprocessor line
+};
+
+struct Baseline {
+    uint64_t case_id = 0; // The ID of the test case, equal to the test ID for regular tests
+    uint64_t duration = 0;// The expected duration in nanoseconds
+    size_t tolerance = 0; // The tolerated slowdown in percent, 0 to use the runtime default
+};
+
+struct Config {
+    size_t unity_batch_size = 0;                           // The number of sources per unity TU, 0 disables them
+    size_t shard_count = 0;                                // The number of shards to plan for, 0 disables the plan
+    std::optional<std::filesystem::path> durations_path {};// A results file to balance the shard plan with
+    std::optional<std::filesystem::path> baselines_path {};// A baselines file to compare test durations against
+    std::optional<std::filesystem::path> modules_path {};  // A directory to generate loadable test modules into
+    std::optional<std::filesystem::path> fuzzers_path {};  // A directory to generate host fuzzer sources into
 };
 
 using namespace std::string_literals;
 
 static inline const std::string MACRO = "ETEST_DEFINE_TEST";
+static inline const std::string PARAM_MACRO = "ETEST_DEFINE_PARAM_TEST";
+static inline const std::string ASYNC_MACRO = "ETEST_DEFINE_ASYNC_TEST";
+static inline const std::string FUZZ_MACRO = "ETEST_DEFINE_FUZZ";
+static inline const std::string NO_UNITY_MACRO = "ETEST_NO_UNITY";
 static inline const std::string INIT_FILE_NAME = "init.c";
+static inline const std::string MANIFEST_FILE_NAME = "manifest.json";
+static inline const std::string STAMP_FILE_NAME = "discovery.stamp";
+static inline const std::string MODULE_GROUPS_DIR_NAME = "groups";
+static inline const std::string MODULE_RUNNER_DIR_NAME = "runner";
+static inline const std::string UNITY_SOURCE_EXTENSION = ".inl";
+static constexpr size_t MAX_NAME_LENGTH = 96;// Keeps generated file names well below common file system limits
+static constexpr size_t MAX_CORPUS_SIZE = 1024 * 1024;// Larger corpora bloat the image and slow down every build
+static inline const std::string GENERATED_HEADER = "// ====================================\n"
+                                                   "// GENERATED BY EFITEST - DO NOT MODIFY\n"
+                                                   "// ====================================\n\n";
 
 template<typename... ARGS>
 inline auto log(fmt::format_string<ARGS...> fmt, ARGS&&... args) noexcept -> void {
@@ -63,12 +131,32 @@ inline auto read_file(const std::filesystem::path& path) noexcept -> std::string
     return source;
 }
 
-inline auto write_file(const std::filesystem::path& path) noexcept -> std::ofstream {
-    std::ofstream stream {path};
-    stream << "// ====================================\n";
-    stream << "// GENERATED BY EFITEST - DO NOT MODIFY\n";
-    stream << "// ====================================\n\n";
-    return stream;
+/*
+ * Files are only rewritten when their contents change, so
+ * re-running the discoverer doesn't invalidate unchanged
+ * translation units of an incremental build. The last written
+ * contents are remembered, so watch mode doesn't have to read
+ * back every generated file on each change.
+ */
+inline auto write_file(const std::filesystem::path& path, const std::string& source) noexcept -> void {
+    static std::map<std::filesystem::path, std::string> written_sources {};
+    auto written_source = written_sources.find(path);
+    if(written_source != written_sources.end() && written_source->second == source &&
+       std::filesystem::exists(path)) {
+        return;
+    }
+    if(written_source == written_sources.end() && std::filesystem::exists(path)) {
+        std::ifstream in_stream {path, std::ios::binary};
+        std::stringstream buffer {};
+        buffer << in_stream.rdbuf();
+        if(buffer.str() == source) {
+            written_sources[path] = source;
+            return;
+        }
+    }
+    std::ofstream stream {path, std::ios::binary};
+    stream << source;
+    written_sources[path] = source;
 }
 
 inline auto strip_extension(std::string& file_name) noexcept -> void {
@@ -84,16 +172,57 @@ inline auto strip_extension(std::string& file_name) noexcept -> void {
 }
 
 auto compute_function_name(const Target& target, const Test& test) noexcept -> std::string {
-    auto prefix = target.source_path.filename().string();
-    strip_extension(prefix);
-    return fmt::format("__{}_{}", prefix, test.name);
+    return fmt::format("__{}_{}", target.name, test.name);
 }
 
-auto compute_header_path(const std::filesystem::path& out_dir, Target& target) noexcept -> void {
-    auto header_name = target.source_path.filename().string();
-    strip_extension(header_name);
-    header_name += ".h";
-    target.header_path = out_dir / header_name;
+auto compute_table_name(const Target& target) noexcept -> std::string {
+    return fmt::format("__{}_tests", target.name);
+}
+
+auto compute_corpus_name(const Target& target, const Test& test) noexcept -> std::string {
+    return fmt::format("__{}_{}_corpus", target.name, test.name);
+}
+
+inline auto compute_header_name(const Target& target) noexcept -> std::string {
+    return target.name + ".h";
+}
+
+inline auto compute_relative_path(const std::filesystem::path& path) noexcept -> std::string {
+    std::error_code error {};
+    const auto relative_path = std::filesystem::relative(path, error);
+    return (error || relative_path.empty() ? path : relative_path).generic_string();
+}
+
+// FNV-1a, so hashes stay the same across machines and standard libraries
+inline auto compute_hash(std::string_view value) noexcept -> uint64_t {
+    uint64_t hash = 0xCBF29CE484222325;
+    for(const auto current_char : value) {
+        hash ^= static_cast<uint8_t>(current_char);
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+/*
+ * Hashes the relative source path and the test name, so IDs
+ * stay the same across machines and unrelated source changes.
+ */
+auto compute_test_id(std::string_view relative_path, const Test& test) noexcept -> uint64_t {
+    return compute_hash(fmt::format("{}::{}", relative_path, test.name));
+}
+
+inline auto escape_string(std::string_view value) noexcept -> std::string {
+    std::string result {};
+    for(const auto current_char : value) {
+        switch(current_char) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\t': result += "\\t"; break;
+            default: result += current_char; break;
+        }
+    }
+    return result;
 }
 
 template<typename I, typename F>
@@ -106,8 +235,53 @@ inline auto consume_until(I& current, I& end, F&& predicate) -> void {
     }
 }
 
-auto discover_tests(const std::filesystem::path& path) noexcept -> std::vector<Test> {// NOLINT
-    auto source = read_file(path);
+inline auto trim(std::string_view value) noexcept -> std::string {
+    constexpr std::string_view whitespace = " \t\r\n";
+    const auto begin = value.find_first_not_of(whitespace);
+    if(begin == std::string_view::npos) {
+        return {};
+    }
+    const auto end = value.find_last_not_of(whitespace);
+    return std::string {value.substr(begin, (end - begin) + 1)};
+}
+
+/*
+ * Parses the parenthesized argument list of a macro invocation,
+ * starting at the opening parenthesis. Nested parentheses, brackets
+ * and braces are skipped so table expressions like tables[1] or
+ * casts within arguments are kept intact.
+ */
+template<typename I>
+inline auto parse_macro_arguments(I& current, I& end) -> std::vector<std::string> {
+    consume_until(current, end, [](auto x) { return x != '('; });// NOLINT
+    ++current;
+
+    std::vector<std::string> arguments {};
+    auto argument_begin = current;
+    size_t depth = 0;
+    while(current != end) {
+        const auto current_char = *current;
+        if(current_char == '(' || current_char == '[' || current_char == '{') {
+            ++depth;
+        }
+        else if(current_char == ')' || current_char == ']' || current_char == '}') {
+            if(depth == 0) {
+                arguments.push_back(trim({argument_begin, current}));
+                return arguments;
+            }
+            --depth;
+        }
+        else if(current_char == ',' && depth == 0) {
+            arguments.push_back(trim({argument_begin, current}));
+            argument_begin = std::next(current);
+        }
+        ++current;
+    }
+    throw std::runtime_error {"Unexpected EOF"};
+}
+
+auto discover_tests(const std::filesystem::path& path, const std::string& source) noexcept
+        -> std::vector<Test> {// NOLINT
     std::vector<Test> tests {};
     auto current = source.begin();
     auto end = source.end();
@@ -149,144 +323,1043 @@ auto discover_tests(const std::filesystem::path& path) noexcept -> std::vector<T
         }
 
         const std::string_view view {current, end};
-        if(view.starts_with(MACRO)) {
-            current += static_cast<ptrdiff_t>(MACRO.size());
+        const auto is_param_test = view.starts_with(PARAM_MACRO);
+        const auto is_async_test = view.starts_with(ASYNC_MACRO);
+        const auto is_fuzz_test = view.starts_with(FUZZ_MACRO);
+        if(is_param_test || is_async_test || is_fuzz_test || view.starts_with(MACRO)) {
+            const auto& macro = is_param_test   ? PARAM_MACRO
+                                : is_async_test ? ASYNC_MACRO
+                                : is_fuzz_test  ? FUZZ_MACRO
+                                                : MACRO;
+            current += static_cast<ptrdiff_t>(macro.size());
+            const auto line_number = std::count(source.begin(), current, '\n') + 1;
+            std::vector<std::string> arguments {};
+            try {
+                arguments = parse_macro_arguments(current, end);
+            }
+            catch(const std::exception& error) {// Usually a definition which is still being typed
+                log("Skipping unterminated test definition in {}:{}: {}", path.string(), line_number, error.what());
+                return tests;
+            }
 
-            // clang-format off
-            consume_until(current, end, [](auto x) { return x != '('; }); // NOLINT
-            ++current;
-            consume_until(current, end, [](auto x) { return x == ' '; }); // NOLINT
-            const auto name_begin = current;
-            consume_until(current, end, [](auto x) { return x == ' ' || x != ')'; }); // NOLINT
-            // clang-format on
+            if(arguments.empty() || arguments.front().empty()) {
+                log("Skipping malformed test definition in {}:{}", path.string(), line_number);
+                ++current;
+                continue;
+            }
 
-            const auto line_number = std::count(source.begin(), name_begin, '\n') + 1;
-            std::string name {name_begin, current};
-            log("Found test '{}' in {}", name, path.string());
-            tests.emplace_back(std::move(name), line_number);
+            Test test {std::move(arguments.front()), static_cast<size_t>(line_number)};
+            auto first_tag = std::next(arguments.begin());
+            if(is_param_test) {
+                if(arguments.size() < 2 || arguments[1].empty()) {
+                    log("Skipping parameterized test '{}' without table in {}", test.name, path.string());
+                    ++current;
+                    continue;
+                }
+                test.kind = TestKind::PARAMETERIZED;
+                test.table = std::move(arguments[1]);
+                ++first_tag;
+                log("Found parameterized test '{}' over '{}' in {}", test.name, test.table, path.string());
+            }
+            else if(is_async_test) {
+                test.kind = TestKind::ASYNC;
+                log("Found asynchronous test '{}' in {}", test.name, path.string());
+            }
+            else if(is_fuzz_test) {
+                if(arguments.size() < 3 || arguments[1].empty() || arguments[2].empty()) {
+                    log("Skipping fuzz test '{}' without data and size parameters in {}", test.name, path.string());
+                    ++current;
+                    continue;
+                }
+                test.kind = TestKind::FUZZ;
+                first_tag += 2;
+                log("Found fuzz test '{}' in {}", test.name, path.string());
+            }
+            else {
+                log("Found test '{}' in {}", test.name, path.string());
+            }
+            std::copy_if(first_tag, arguments.end(), std::back_inserter(test.tags),
+                         [](const auto& tag) { return !tag.empty(); });
+            tests.push_back(std::move(test));
         }
 
         ++current;
     }
 
-    for(auto& test : tests) {
-        auto& name = test.name;
-        while(name.contains('\n') || name.contains('\t')) {
-            current = name.begin();
-            end = name.end();
-            while(current != end) {
-                const auto current_char = *current;
-                if(current_char == '\n' || current_char == '\t') {
-                    name.erase(current);
-                    break;
-                }
+    return tests;
+}
+
+inline auto is_identifier_char(char value) noexcept -> bool {
+    return std::isalnum(static_cast<unsigned char>(value)) != 0 || value == '_';
+}
+
+inline auto is_cxx_source(const std::filesystem::path& path) noexcept -> bool {
+    return path.extension() != ".c";
+}
+
+/*
+ * Derives the name of a target from its path relative to the working
+ * directory, so sources sharing a file name in different directories
+ * don't collide on generated files and symbols. Overly long names keep
+ * their tail and are suffixed with a hash of the whole path instead.
+ */
+auto compute_target_name(const std::string& relative_path) noexcept -> std::string {
+    auto name = std::filesystem::path {relative_path}.replace_extension().generic_string();
+    std::ranges::replace_if(name, [](auto x) { return !is_identifier_char(x); }, '_');
+    if(name.size() > MAX_NAME_LENGTH) {
+        const auto hash = fmt::format("_{:016x}", compute_hash(relative_path));
+        name = name.substr(name.size() - (MAX_NAME_LENGTH - hash.size())) + hash;
+    }
+    if(name.empty() || std::isdigit(static_cast<unsigned char>(name.front())) != 0) {
+        name.insert(0, 1, '_');
+    }
+    return name;
+}
+
+/*
+ * Splits the given source into identifiers and the punctuation the
+ * unity heuristics care about, skipping comments and literals.
+ * Identifiers on preprocessor lines are kept but flagged.
+ */
+auto tokenize_source(const std::string& source) noexcept -> std::vector<SourceToken> {// NOLINT
+    std::vector<SourceToken> tokens {};
+    size_t depth = 0;
+    auto current = source.begin();
+    const auto end = source.end();
+    auto is_line_start = true;
+    auto is_directive = false;
+
+    while(current != end) {
+        const auto current_char = *current;
+        const auto next = std::next(current);
+        if(current_char == '/' && next != end && *next == '/') {
+            current = std::find(current, end, '\n');
+            continue;
+        }
+        if(current_char == '/' && next != end && *next == '*') {
+            const auto comment_end = std::string_view {next, end}.find("*/");
+            current = comment_end == std::string_view::npos ? end : next + static_cast<ptrdiff_t>(comment_end + 2);
+            continue;
+        }
+        if(current_char == '#' && is_line_start) {// Lasts until the first line without a continuation
+            is_directive = true;
+        }
+        if(current_char == '"' || current_char == '\'') {
+            ++current;
+            while(current != end && *current != current_char) {
+                current += *current == '\\' && std::next(current) != end ? 2 : 1;
+            }
+            if(current != end) {
                 ++current;
             }
+            is_line_start = false;
+            continue;
+        }
+        if(current_char == '\n') {
+            is_directive = is_directive && current != source.begin() && *std::prev(current) == '\\';
+            is_line_start = true;
+            ++current;
+            continue;
+        }
+        if(current_char != ' ' && current_char != '\t' && current_char != '\r') {
+            is_line_start = false;
+        }
+        if(is_identifier_char(current_char)) {
+            const auto token_begin = current;
+            while(current != end && is_identifier_char(*current)) {
+                ++current;
+            }
+            tokens.push_back({{token_begin, current}, depth, is_directive});
+            continue;
         }
+        if(is_directive) {
+            ++current;
+            continue;
+        }
+        if(current_char == '{') {
+            ++depth;
+        }
+        else if(current_char == '}' && depth > 0) {
+            --depth;
+        }
+        if(current_char == '(' || current_char == ')' || current_char == '=' || current_char == ';'
+           || current_char == '[' || current_char == '{' || current_char == ',') {
+            tokens.push_back({std::string(1, current_char), depth, false});
+        }
+        ++current;
     }
-
-    return tests;
+    return tokens;
 }
 
-auto generate_target_header(const Target& target) noexcept -> void {
-    const auto& path = target.header_path;
-    if(std::filesystem::exists(path)) {
-        std::filesystem::remove(path);
+/*
+ * Heuristically collects the names of all file-scope static
+ * functions and variables declared in the given source, so
+ * they can be renamed when multiple sources share one unity TU.
+ */
+auto discover_static_symbols(const std::vector<SourceToken>& source_tokens) noexcept// NOLINT
+        -> std::vector<std::string> {
+    std::vector<std::string> tokens {};
+    std::vector<size_t> depths {};
+    for(const auto& token : source_tokens) {
+        if(!token.is_directive) {
+            tokens.push_back(token.value);
+            depths.push_back(token.depth);
+        }
     }
 
+    std::vector<std::string> symbols {};
+    const auto num_tokens = tokens.size();
+    for(size_t index = 0; index < num_tokens; ++index) {
+        if(tokens[index] != "static" || depths[index] != 0) {
+            continue;
+        }
+        std::string symbol {};
+        for(++index; index < num_tokens; ++index) {
+            const auto& token = tokens[index];
+            if(token == "__attribute__" || token == "__declspec" || token == "alignas" || token == "_Alignas") {
+                size_t paren_depth = 0;// Skip the balanced argument list of the attribute
+                while(index + 1 < num_tokens) {
+                    const auto& next_token = tokens[++index];
+                    paren_depth += next_token == "(" ? 1 : 0;
+                    paren_depth -= next_token == ")" && paren_depth > 0 ? 1 : 0;
+                    if(paren_depth == 0) {
+                        break;
+                    }
+                }
+                continue;
+            }
+            if(!is_identifier_char(token.front())) {
+                break;
+            }
+            symbol = token;
+        }
+        if(!symbol.empty() && std::isdigit(static_cast<unsigned char>(symbol.front())) == 0) {
+            symbols.push_back(std::move(symbol));
+        }
+    }
+    return symbols;
+}
+
+auto generate_target_header(const Target& target) noexcept -> std::string {
     std::string source = "#pragma once\n\n";
     source += "#include <efitest/efitest.h>\n\n";
 
     const auto& tests = target.tests;
+    if(!tests.empty()) {
+        source += "ETEST_API_BEGIN\n";
+        source += fmt::format("extern const EFITestDescriptor {}[{}];\n", compute_table_name(target), tests.size());
+        source += "ETEST_API_END\n";
+    }
+    return source;
+}
+
+inline auto read_binary_file(const std::filesystem::path& path) noexcept -> std::string {
+    std::ifstream stream {path, std::ios::binary};
+    return {std::istreambuf_iterator<char> {stream}, std::istreambuf_iterator<char> {}};
+}
+
+/*
+ * Embeds the corpus of a fuzz test into the image, so it can be
+ * replayed on the target without access to the host file system.
+ * Empty inputs don't get an array of their own.
+ */
+auto generate_corpus(const Target& target, const Test& test) noexcept -> std::string {
+    constexpr std::string_view digits = "0123456789ABCDEF";
+    constexpr size_t bytes_per_line = 16;
+    const auto corpus_name = compute_corpus_name(target, test);
+    std::string source {};
+    std::string inputs {};
+    size_t corpus_size = 0;
+    for(size_t index = 0; index < test.corpus.size(); ++index) {
+        const auto data = read_binary_file(test.corpus[index]);
+        corpus_size += data.size();
+        if(data.empty()) {
+            inputs += "\t{NULL, 0},\n";
+            continue;
+        }
+        source += fmt::format("static const UINT8 {}_{}[{}] = {{", corpus_name, index, data.size());
+        for(size_t offset = 0; offset < data.size(); ++offset) {
+            const auto value = static_cast<uint8_t>(data[offset]);
+            source += offset % bytes_per_line == 0 ? "\n\t0x" : " 0x";
+            source += digits[value >> 4];
+            source += digits[value & 0xF];
+            source += ',';
+        }
+        source += "\n};\n\n";
+        inputs += fmt::format("\t{{{0}_{1}, sizeof({0}_{1})}},\n", corpus_name, index);
+    }
+    if(corpus_size > MAX_CORPUS_SIZE) {
+        log("Corpus {} of fuzz test '{}' embeds {} bytes in {} files, consider minimizing it with -merge=1",
+            test.corpus_dir.generic_string(), test.name, corpus_size, test.corpus.size());
+    }
+    source += fmt::format("static const EFITestFuzzInput {}[{}] = {{\n", corpus_name, test.corpus.size());
+    source += inputs;
+    source += "};\n\n";
+    return source;
+}
+
+auto generate_target_source(const Target& target) noexcept -> std::string {
+    const auto& tests = target.tests;
+    const auto num_tests = tests.size();
+
+    auto source = target.source + '\n';
+    source += "// ========== BEGIN INJECTED CODE ==========\n\n";
+    source += fmt::format("#include \"{}\"\n\n", compute_header_name(target));
+
+    for(const auto& test : tests) {
+        if(test.kind == TestKind::FUZZ && !test.corpus.empty()) {
+            source += generate_corpus(target, test);
+        }
+    }
+
     for(const auto& test : tests) {
-        source += fmt::format("void {}(EFITestContext* context);\n", compute_function_name(target, test));
+        const auto& test_name = test.name;
+        // Trampolines only bounce the call, all bookkeeping happens in the runtime
+        source += fmt::format("static void {}(EFITestContext* context) {{\n", compute_function_name(target, test));
+        if(test.kind == TestKind::PARAMETERIZED) {
+            source += fmt::format("\t{}(context, &({})[context->param_index]);\n", test_name, test.table);
+        }
+        else if(test.kind == TestKind::FUZZ && !test.corpus.empty()) {
+            source += fmt::format("\tconst EFITestFuzzInput* input = &({})[context->param_index];\n",
+                                  compute_corpus_name(target, test));
+            source += fmt::format("\t{}(context, input->data, input->size);\n", test_name);
+        }
+        else if(test.kind == TestKind::FUZZ) {
+            source += fmt::format("\t{}(context, NULL, 0);\n", test_name);// Without a corpus only the empty input
+        }
+        else {
+            source += fmt::format("\t{}(context);\n", test_name);
+        }
+        source += "}\n\n";
+    }
+
+    if(num_tests == 0) {
+        return source;
     }
 
-    write_file(path) << source;
+    // The descriptor table lives next to the tests so table sizes can be taken at compile time
+    source += fmt::format("const EFITestDescriptor {}[{}] = {{\n", compute_table_name(target), num_tests);
+    for(const auto& test : tests) {
+        auto param_count = "0"s;
+        if(test.kind == TestKind::PARAMETERIZED) {
+            param_count = fmt::format("sizeof({0}) / sizeof(*({0}))", test.table);
+        }
+        else if(test.kind == TestKind::FUZZ) {
+            param_count = std::to_string(test.corpus.size());
+        }
+        std::string tags {};
+        for(const auto& tag : test.tags) {
+            // Tags end up in a C string literal, so they are escaped just like in the manifest
+            tags += tags.empty() ? escape_string(tag) : fmt::format(",{}", escape_string(tag));
+        }
+        source += fmt::format("\t{{\"{}\", {}, {}, {}, 0x{:016X}ULL, \"{}\", {}, {}}},\n", test.name,
+                              compute_function_name(target, test), test.line_number, param_count, test.id, tags,
+                              test.shard, test.kind == TestKind::ASYNC ? "TRUE" : "FALSE");
+    }
+    source += "};\n";
+    return source;
 }
 
-auto inject_trampolines(const std::filesystem::path& out_dir, const std::vector<Target>& targets) noexcept -> void {
+auto compute_unity_source_name(const Target& target) noexcept -> std::string {
+    return target.name + UNITY_SOURCE_EXTENSION;
+}
+
+/*
+ * Static symbols defined by more than one source of a batch are
+ * renamed per source using a define/undef pair around its include,
+ * so sources can be merged without touching their code.
+ */
+auto generate_unity_source(const std::vector<const Target*>& batch) noexcept -> std::string {
+    std::map<std::string, size_t> symbol_counts {};
+    for(const auto* target : batch) {
+        std::set<std::string> symbols {target->static_symbols.begin(), target->static_symbols.end()};
+        for(const auto& test : target->tests) {
+            symbols.insert(test.name);
+        }
+        for(const auto& symbol : symbols) {
+            ++symbol_counts[symbol];
+        }
+    }
+
+    // Include the runtime first so no renaming define can leak into it
+    std::string source = "#include <efitest/efitest.h>\n\n";
+    for(const auto* target : batch) {
+        std::set<std::string> renamed_symbols {};
+        for(const auto& symbol : target->static_symbols) {
+            if(symbol_counts[symbol] > 1) {
+                renamed_symbols.insert(symbol);
+            }
+        }
+        for(const auto& test : target->tests) {
+            if(symbol_counts[test.name] > 1) {
+                renamed_symbols.insert(test.name);
+            }
+        }
+
+        for(const auto& symbol : renamed_symbols) {
+            source += fmt::format("#define {} __unity_{}_{}\n", symbol, target->name, symbol);
+        }
+        source += fmt::format("#include \"{}\"\n", compute_unity_source_name(*target));
+        for(const auto& symbol : renamed_symbols) {
+            source += fmt::format("#undef {}\n", symbol);
+        }
+        source += '\n';
+    }
+    return source;
+}
+
+auto generate_init_source(const std::vector<Target>& targets, const std::vector<Baseline>& baselines,
+                          const Config& config, bool is_resident_runner = false) noexcept -> std::string {
+    std::string includes = "#include <efitest/efitest_init.h>\n";
+    std::string groups {};
+    size_t num_groups = 0;
     for(const auto& target : targets) {
-        const auto& source_path = target.source_path;
         const auto& tests = target.tests;
-        const auto num_tests = tests.size();
+        includes += fmt::format("#include \"{}\"\n", compute_header_name(target));
+        if(tests.empty()) {
+            continue;
+        }
+
+        // Emit static per-target group information
+        const auto& source_path = target.source_path;
+        groups += fmt::format("\t{{\"{}\", \"{}\", \"{}\", {}, {}}},\n", escape_string(target.group_name),
+                              source_path.filename().string(), source_path.string(), compute_table_name(target),
+                              tests.size());
+        ++num_groups;
+    }
+
+    auto source = includes + '\n';
+    source += "UINTN efitest_get_shard_count() {\n";
+    source += fmt::format("\treturn {};\n", config.shard_count);
+    source += "}\n\n";
+    source += "BOOLEAN efitest_is_resident_runner() {\n";
+    source += fmt::format("\treturn {};\n", is_resident_runner ? "TRUE" : "FALSE");
+    source += "}\n\n";
+
+    // Baselines are sorted by case ID so the runtime can use a binary search
+    if(baselines.empty()) {
+        source += "const EFITestBaseline* efitest_get_baselines(UINTN* count) {\n";
+        source += "\t*count = 0;\n";
+        source += "\treturn NULL;\n";
+        source += "}\n\n";
+    }
+    else {
+        source += fmt::format("static const EFITestBaseline g_baselines[{}] = {{\n", baselines.size());
+        for(const auto& baseline : baselines) {
+            source += fmt::format("\t{{0x{:016X}ULL, {}ULL, {}}},\n", baseline.case_id, baseline.duration,
+                                  baseline.tolerance);
+        }
+        source += "};\n\n";
+        source += "const EFITestBaseline* efitest_get_baselines(UINTN* count) {\n";
+        source += fmt::format("\t*count = {};\n", baselines.size());
+        source += "\treturn g_baselines;\n";
+        source += "}\n\n";
+    }
+
+    if(num_groups == 0) {
+        source += "const EFITestGroup* efitest_get_groups(UINTN* count) {\n";
+        source += "\t*count = 0;\n";
+        source += "\treturn NULL;\n";
+        source += "}\n\n";
+        source += "void efitest_run_tests(EFITestContext* context) {\n}";
+        return source;
+    }
+
+    source += fmt::format("static const EFITestGroup g_groups[{}] = {{\n", num_groups);
+    source += groups;
+    source += "};\n\n";
+    source += "const EFITestGroup* efitest_get_groups(UINTN* count) {\n";
+    source += fmt::format("\t*count = {};\n", num_groups);
+    source += "\treturn g_groups;\n";
+    source += "}\n\n";
+    source += "void efitest_run_tests(EFITestContext* context) {\n";
+    source += fmt::format("\tfor(UINTN index = 0; index < {}; ++index) {{\n", num_groups);
+    source += "\t\tefitest_run_group(context, &g_groups[index]);\n";
+    source += "\t}\n";
+    source += '}';
+    return source;
+}
 
-        const auto out_path = out_dir / source_path.filename();
-        auto stream = write_file(out_path);
-        stream << read_file(source_path) << '\n';
-        stream << "// ========== BEGIN INJECTED CODE ==========\n\n";
-        stream << fmt::format("#include \"{}\"\n\n", target.header_path.filename().string());
+inline auto get_kind_name(TestKind kind) noexcept -> std::string_view {
+    switch(kind) {
+        case TestKind::PARAMETERIZED:
+            return "parameterized";
+        case TestKind::ASYNC:
+            return "async";
+        case TestKind::FUZZ:
+            return "fuzz";
+        default:
+            return "regular";
+    }
+}
 
-        for(size_t index = 0; index < num_tests; ++index) {
-            const auto& test = tests[index];
-            const auto& test_name = test.name;
-            auto function = fmt::format("void {}(EFITestContext* context) {{\n", compute_function_name(target, test));
+/*
+ * Machine-readable list of all discovered tests, so
+ * schedulers and IDEs can enumerate tests without
+ * building or booting the test image.
+ */
+auto generate_manifest(const std::vector<Target>& targets, const Config& config) noexcept -> std::string {
+    std::string groups {};
+    for(const auto& target : targets) {
+        if(target.tests.empty()) {
+            continue;
+        }
+        const auto file_path = escape_string(target.relative_path);
 
-            // Update context when trampoline is called
-            function += fmt::format("\tcontext->test_name = \"{}\";\n", test_name);
-            function += fmt::format("\tcontext->line_number = {};\n", test.line_number);
-            function += fmt::format("\tcontext->group_index = {};\n", index);
-            function += "\tcontext->failed = FALSE;\n";// Reset passed state
+        std::string tests {};
+        for(const auto& test : target.tests) {
+            std::string tags {};
+            for(const auto& tag : test.tags) {
+                tags += fmt::format("{}\"{}\"", tags.empty() ? "" : ", ", escape_string(tag));
+            }
+            tests += fmt::format("{}        {{\"id\": \"{:016x}\", \"name\": \"{}\", \"file\": \"{}\", \"line\": {}, "
+                                 "\"kind\": \"{}\", \"table\": \"{}\", \"corpus\": \"{}\", \"tags\": [{}], "
+                                 "\"shard\": {}}}",
+                                 tests.empty() ? "" : ",\n", test.id, escape_string(test.name), file_path,
+                                 test.line_number, get_kind_name(test.kind), escape_string(test.table),
+                                 escape_string(test.corpus_dir.generic_string()), tags, test.shard);
+        }
+        groups += fmt::format("{}    {{\"name\": \"{}\", \"file\": \"{}\", \"tests\": [\n{}\n    ]}}",
+                              groups.empty() ? "" : ",\n", escape_string(target.group_name), file_path, tests);
+    }
+    return fmt::format("{{\n  \"version\": 1,\n  \"shards\": {},\n  \"groups\": [\n{}\n  ]\n}}\n",
+                       config.shard_count, groups);
+}
 
-            // Add pre- and post-test hooks before and after bouncing the call
-            function += "\tefitest_on_pre_run_test(context);\n";
-            function += fmt::format("\t{}(context);\n", test_name);
-            function += "\tefitest_on_post_run_test(context);\n";
+inline auto parse_id(const json::Value* value) noexcept -> std::optional<uint64_t> {
+    if(value == nullptr || !value->is_string()) {
+        return std::nullopt;
+    }
+    const auto& string = value->as_string();
+    uint64_t result = 0;
+    const auto [end, error] = std::from_chars(string.data(), string.data() + string.size(), result, 16);
+    if(error != std::errc {}) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+/*
+ * Reads the durations of all test cases from a results file written
+ * by the runtime via --results, summing up the cases of parameterized
+ * tests since the shard plan works on whole tests.
+ */
+auto load_durations(const std::filesystem::path& path) -> std::map<uint64_t, uint64_t> {
+    const auto document = json::parse(read_file(path));
+    const auto* tests = document.find("tests");
+    if(tests == nullptr || !tests->is_array()) {
+        throw std::runtime_error {"Results file doesn't contain a list of tests"};
+    }
 
-            function += "}\n";
-            stream << function << '\n';
+    std::map<uint64_t, uint64_t> durations {};
+    for(const auto& test : tests->as_array()) {
+        const auto id = parse_id(test.find("id"));
+        const auto* duration = test.find("duration_ns");
+        if(!id || duration == nullptr || !duration->is_number()) {
+            continue;
         }
+        durations[*id] += static_cast<uint64_t>(duration->as_number());
     }
+    return durations;
 }
 
-auto generate_init_source(const std::filesystem::path& path, const std::vector<Target>& targets) noexcept -> void {
-    if(std::filesystem::exists(path)) {
-        std::filesystem::remove(path);
+/*
+ * Reads the baselines written by the runtime via --update-baselines,
+ * dropping those of tests which no longer exist.
+ */
+auto load_baselines(const std::filesystem::path& path, const std::vector<Target>& targets) -> std::vector<Baseline> {
+    const auto document = json::parse(read_file(path));
+    const auto* entries = document.find("baselines");
+    if(entries == nullptr || !entries->is_array()) {
+        throw std::runtime_error {"Baselines file doesn't contain a list of baselines"};
     }
 
-    std::vector<std::string> includes {};
-    std::string function = "void efitest_run_tests(EFITestContext* context) {\n";
+    std::set<uint64_t> test_ids {};
     for(const auto& target : targets) {
-        const auto& tests = target.tests;
-        includes.push_back(fmt::format("#include \"{}\"", target.header_path.filename().string()));
+        for(const auto& test : target.tests) {
+            test_ids.insert(test.id);
+        }
+    }
 
-        // Update per-target context information
-        const auto& source_path = target.source_path;
-        const auto file_name = source_path.filename().string();
-        auto stripped_file_name = file_name;
-        strip_extension(stripped_file_name);
-        function += fmt::format("\tcontext->file_path = \"{}\";\n", source_path.string());
-        function += fmt::format("\tcontext->file_name = \"{}\";\n", file_name);
-        function += fmt::format("\tcontext->group_name = \"{}\";\n", stripped_file_name);
-        function += fmt::format("\tcontext->group_size = {};\n", tests.size());
+    std::map<uint64_t, Baseline> baselines {};
+    for(const auto& entry : entries->as_array()) {
+        const auto id = parse_id(entry.find("id"));
+        const auto case_id = parse_id(entry.find("case_id"));
+        const auto* duration = entry.find("duration_ns");
+        if(!id || !case_id || !test_ids.contains(*id) || duration == nullptr || !duration->is_number()) {
+            continue;
+        }
+        const auto* tolerance = entry.find("tolerance");
+        baselines[*case_id] = {*case_id, static_cast<uint64_t>(duration->as_number()),
+                               tolerance != nullptr && tolerance->is_number()
+                                       ? static_cast<size_t>(tolerance->as_number())
+                                       : 0};
+    }
+
+    std::vector<Baseline> result {};
+    for(const auto& [case_id, baseline] : baselines) {
+        result.push_back(baseline);
+    }
+    return result;
+}
 
-        function += "\tefitest_on_pre_run_group(context);\n";
-        for(const auto& test : tests) {
-            function += fmt::format("\t{}(context);\n", compute_function_name(target, test));
+/*
+ * Assigns every test to one of the configured shards, longest test first
+ * to the shard with the least total duration so far. Tests without a known
+ * duration are assumed to take as long as the average known test.
+ */
+auto plan_shards(std::vector<Target>& targets, const std::map<uint64_t, uint64_t>& durations,
+                 const Config& config) noexcept -> void {
+    uint64_t total_known_duration = 0;
+    for(const auto& [id, duration] : durations) {
+        total_known_duration += duration;
+    }
+    const uint64_t default_duration =
+            durations.empty() ? 1 : std::max<uint64_t>(total_known_duration / durations.size(), 1);
+
+    std::vector<std::pair<uint64_t, Test*>> tests {};
+    size_t num_unknown_tests = 0;
+    for(auto& target : targets) {
+        for(auto& test : target.tests) {
+            const auto duration = durations.find(test.id);
+            if(duration == durations.end()) {
+                ++num_unknown_tests;
+            }
+            tests.emplace_back(duration == durations.end() ? default_duration : duration->second, &test);
         }
-        function += "\tefitest_on_post_run_group(context);\n";
     }
-    function += '}';
+    // Ties are broken by ID so the plan doesn't depend on the order of the input files
+    std::ranges::sort(tests, [](const auto& lhs, const auto& rhs) {
+        return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second->id < rhs.second->id;
+    });
+
+    std::vector<uint64_t> shard_durations(config.shard_count, 0);
+    for(const auto& [duration, test] : tests) {
+        const auto shard = std::ranges::min_element(shard_durations);
+        test->shard = static_cast<size_t>(std::distance(shard_durations.begin(), shard));
+        *shard += duration;
+    }
+
+    const auto longest_shard = *std::ranges::max_element(shard_durations);
+    const auto total_duration = total_known_duration + (num_unknown_tests * default_duration);
+    log("Planned {} shards, longest shard takes {}ms out of {}ms ({} tests without known duration)",
+        config.shard_count, longest_shard / 1000000, total_duration / 1000000, num_unknown_tests);
+}
 
-    auto stream = write_file(path);
-    for(const auto& include : includes) {
-        stream << include << '\n';
+/*
+ * Removes files left over by previous runs, for example after
+ * a test source was deleted or unity builds were toggled,
+ * since the whole output directory is compiled.
+ */
+auto remove_stale_files(const std::filesystem::path& out_dir, const std::set<std::filesystem::path>& files) noexcept
+        -> void {
+    std::error_code error {};
+    for(const auto& entry : std::filesystem::directory_iterator {out_dir, error}) {
+        if(entry.is_regular_file() && !files.contains(entry.path())) {
+            log("Removing stale file {}", entry.path().string());
+            std::filesystem::remove(entry.path(), error);
+        }
     }
-    stream << '\n';
-    stream << function;
 }
 
-auto process_sources(const std::filesystem::path& out_dir, const std::vector<Target>& targets) noexcept -> void {
+auto process_sources(const std::filesystem::path& out_dir, const std::vector<Target>& targets,
+                     const std::vector<Baseline>& baselines, const Config& config) noexcept -> void {
     if(!std::filesystem::exists(out_dir)) {
         std::filesystem::create_directories(out_dir);
     }
 
+    // The stamp is written by the build scripts to skip discovery when nothing changed
+    std::set<std::filesystem::path> files {out_dir / STAMP_FILE_NAME};
+    const auto emit = [&](const std::filesystem::path& path, const std::string& content) {
+        write_file(path, GENERATED_HEADER + content);
+        files.insert(path);
+    };
+
+    write_file(out_dir / MANIFEST_FILE_NAME, generate_manifest(targets, config));
+    files.insert(out_dir / MANIFEST_FILE_NAME);
+
+    for(const auto& target : targets) {
+        emit(out_dir / compute_header_name(target), generate_target_header(target));
+    }
+    emit(out_dir / INIT_FILE_NAME, generate_init_source(targets, baselines, config));
+
+    // Batch C and C++ sources separately, excluded sources are compiled on their own
+    std::array<std::vector<const Target*>, 2> batches {};
+    std::array<size_t, 2> num_batches {};
+    const auto flush_batch = [&](size_t language) {
+        auto& batch = batches[language];
+        if(batch.empty()) {
+            return;
+        }
+        const auto* extension = language == 0 ? ".c" : ".cpp";
+        emit(out_dir / fmt::format("unity_{}{}", num_batches[language]++, extension), generate_unity_source(batch));
+        batch.clear();
+    };
+
+    for(const auto& target : targets) {
+        const auto language = is_cxx_source(target.source_path) ? 1 : 0;
+        if(config.unity_batch_size == 0 || target.is_unity_excluded) {
+            emit(out_dir / (target.name + target.source_path.extension().string()), generate_target_source(target));
+            continue;
+        }
+        emit(out_dir / compute_unity_source_name(target), generate_target_source(target));
+        batches[language].push_back(&target);
+        if(batches[language].size() >= config.unity_batch_size) {
+            flush_batch(language);
+        }
+    }
+    flush_batch(0);
+    flush_batch(1);
+
+    remove_stale_files(out_dir, files);
+}
+
+/*
+ * Emits one directory per group which is built into a loadable module of
+ * its own, and one for the resident runner loading them. Modules never use
+ * unity sources, so a change only rebuilds the module of the changed group.
+ */
+auto process_modules(const std::filesystem::path& modules_dir, const std::vector<Target>& targets,
+                     const std::vector<Baseline>& baselines, const Config& config) noexcept -> void {
+    std::error_code error {};
+    const auto groups_dir = modules_dir / MODULE_GROUPS_DIR_NAME;
+    std::filesystem::create_directories(groups_dir, error);
+
+    std::set<std::filesystem::path> group_dirs {};
     for(const auto& target : targets) {
-        generate_target_header(target);
+        if(target.tests.empty()) {
+            continue;
+        }
+        const auto group_dir = groups_dir / target.name;
+        std::filesystem::create_directories(group_dir, error);
+        group_dirs.insert(group_dir);
+
+        const std::vector<std::pair<std::filesystem::path, std::string>> files {
+                {group_dir / compute_header_name(target), generate_target_header(target)},
+                {group_dir / (target.name + target.source_path.extension().string()), generate_target_source(target)},
+                {group_dir / INIT_FILE_NAME, generate_init_source({target}, baselines, config)},
+        };
+        std::set<std::filesystem::path> paths {};
+        for(const auto& [path, content] : files) {
+            write_file(path, GENERATED_HEADER + content);
+            paths.insert(path);
+        }
+        remove_stale_files(group_dir, paths);
+    }
+
+    for(const auto& entry : std::filesystem::directory_iterator {groups_dir, error}) {
+        if(entry.is_directory() && !group_dirs.contains(entry.path())) {
+            log("Removing stale module {}", entry.path().filename().string());
+            std::filesystem::remove_all(entry.path(), error);
+        }
+    }
+
+    const auto runner_dir = modules_dir / MODULE_RUNNER_DIR_NAME;
+    std::filesystem::create_directories(runner_dir, error);
+    write_file(runner_dir / INIT_FILE_NAME, GENERATED_HEADER + generate_init_source({}, {}, config, true));
+    remove_stale_files(runner_dir, {runner_dir / INIT_FILE_NAME});
+}
+
+/*
+ * Emits one source per fuzz test which is built for the host. Just like
+ * the sources built for the target it contains the original source, so
+ * line numbers of assertions match, and calls the test through the runtime
+ * from the libFuzzer entry point.
+ */
+auto generate_fuzzer_source(const Target& target, const Test& test) noexcept -> std::string {
+    const auto source_path = std::filesystem::absolute(target.source_path).generic_string();
+    auto source = target.source + '\n';
+    source += "// ========== BEGIN INJECTED CODE ==========\n\n";
+    source += "#include \"fuzz.h\"\n\n";
+    const auto function_name = compute_function_name(target, test);
+    source += fmt::format("static void {}(EFITestContext* context, const UINT8* data, UINTN size) {{\n",
+                          function_name);
+    source += fmt::format("\t{}(context, data, size);\n", test.name);
+    source += "}\n\n";
+    source += fmt::format("static const EFITestFuzzTarget g_fuzz_target = {{\"{}\", \"{}\", \"{}\", \"{}\", {}, "
+                          "0x{:016X}ULL, {}}};\n\n",
+                          test.name, escape_string(target.group_name), target.source_path.filename().string(),
+                          escape_string(source_path), test.line_number, test.id, function_name);
+    source += "ETEST_API_BEGIN\n";
+    source += "int LLVMFuzzerTestOneInput(const UINT8* data, UINTN size) {\n";
+    source += "\treturn efitest_fuzz_run(&g_fuzz_target, data, size);\n";
+    source += "}\n";
+    source += "ETEST_API_END\n";
+    return source;
+}
+
+auto process_fuzzers(const std::filesystem::path& fuzzers_dir, const std::vector<Target>& targets) noexcept
+        -> void {
+    std::error_code error {};
+    std::filesystem::create_directories(fuzzers_dir, error);
+
+    std::set<std::filesystem::path> files {};
+    for(const auto& target : targets) {
+        for(const auto& test : target.tests) {
+            if(test.kind != TestKind::FUZZ) {
+                continue;
+            }
+            const auto extension = target.source_path.extension().string();
+            const auto path = fuzzers_dir / fmt::format("{}-{}{}", target.name, test.name, extension);
+            write_file(path, GENERATED_HEADER + generate_fuzzer_source(target, test));
+            files.insert(path);
+        }
+    }
+    remove_stale_files(fuzzers_dir, files);
+}
+
+/*
+ * The corpus of a fuzz test lives in corpus/<test name> next to its
+ * source, which is also where the host fuzzer is pointed at.
+ */
+auto discover_corpus(const std::filesystem::path& corpus_dir) noexcept -> std::vector<std::filesystem::path> {
+    std::vector<std::filesystem::path> corpus {};
+    std::error_code error {};
+    for(const auto& entry : std::filesystem::directory_iterator {corpus_dir, error}) {
+        if(entry.is_regular_file(error)) {
+            corpus.push_back(entry.path());
+        }
+    }
+    std::sort(corpus.begin(), corpus.end());
+    return corpus;
+}
+
+auto discover_target(const std::filesystem::path& file, const Config& config) noexcept -> Target {
+    Target target {file, compute_relative_path(file)};
+    target.name = compute_target_name(target.relative_path);
+    target.source = read_file(file);
+    target.tests = discover_tests(file, target.source);
+    for(auto& test : target.tests) {
+        test.id = compute_test_id(target.relative_path, test);
+        if(test.kind == TestKind::FUZZ) {
+            const auto source_dir = std::filesystem::path {target.relative_path}.parent_path();
+            const auto corpus_dir = source_dir / inputs::CORPUS_DIR_NAME / test.name;
+            test.corpus_dir = corpus_dir;
+            test.corpus = discover_corpus(corpus_dir);
+        }
+    }
+    if(config.unity_batch_size > 0) {
+        const auto tokens = tokenize_source(target.source);
+        target.static_symbols = discover_static_symbols(tokens);
+        target.is_unity_excluded = std::ranges::any_of(tokens, [](const auto& x) { return x.value == NO_UNITY_MACRO; });
+    }
+    return target;
+}
+
+/*
+ * Reading and scanning the sources dominates on large trees,
+ * so files are handed out to one worker per hardware thread.
+ */
+auto discover_targets(const std::vector<std::filesystem::path>& files, const Config& config) noexcept
+        -> std::map<std::filesystem::path, Target> {
+    std::map<std::filesystem::path, Target> index {};
+    std::mutex mutex {};
+    std::atomic_size_t next_file {0};
+    const auto work = [&] {
+        for(auto file_index = next_file++; file_index < files.size(); file_index = next_file++) {
+            const auto& file = files[file_index];
+            if(!std::filesystem::exists(file)) {
+                log("File {} does not exist, skipping", file.string());
+                continue;
+            }
+            auto target = discover_target(file, config);
+            const std::scoped_lock lock {mutex};
+            index.insert_or_assign(watch::normalize(file), std::move(target));
+        }
+    };
+
+    const auto num_workers = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1U), files.size());
+    std::vector<std::jthread> workers {};
+    for(size_t worker_index = 0; worker_index < num_workers; ++worker_index) {
+        workers.emplace_back(work);
+    }
+    workers.clear();// Joins all workers
+    return index;
+}
+
+/*
+ * Returns the discovered targets in the order the files were
+ * passed in, so the generated tables don't depend on the order
+ * in which files were (re-)discovered. Names which still collide
+ * after sanitizing the paths get a hash of their path appended,
+ * and groups are only named by their path when file names collide.
+ */
+auto collect_targets(const std::vector<std::filesystem::path>& files,
+                     const std::map<std::filesystem::path, Target>& index) noexcept -> std::vector<Target> {
+    std::vector<Target> targets {};
+    std::set<std::filesystem::path> visited_files {};
+    std::map<std::string, size_t> name_counts {};
+    std::map<std::string, size_t> group_name_counts {};
+    for(const auto& file : files) {
+        const auto path = watch::normalize(file);
+        const auto target = index.find(path);
+        if(target != index.end() && visited_files.insert(path).second) {
+            auto& collected_target = targets.emplace_back(target->second);
+            collected_target.group_name = collected_target.source_path.filename().string();
+            strip_extension(collected_target.group_name);
+            ++name_counts[collected_target.name];
+            ++group_name_counts[collected_target.group_name];
+        }
+    }
+
+    for(auto& target : targets) {
+        if(name_counts[target.name] > 1) {
+            target.name += fmt::format("_{:08x}", compute_hash(target.relative_path) & 0xFFFFFFFF);
+        }
+        if(group_name_counts[target.group_name] > 1) {
+            target.group_name = std::filesystem::path {target.relative_path}.replace_extension().generic_string();
+        }
+    }
+    return targets;
+}
+
+auto generate_sources(const std::filesystem::path& out_dir, std::vector<Target>& targets,
+                      const Config& config) noexcept -> void {
+    if(config.shard_count > 0) {
+        std::map<uint64_t, uint64_t> durations {};
+        if(config.durations_path) {
+            const auto& durations_path = *config.durations_path;
+            if(!std::filesystem::exists(durations_path)) {
+                log("Results file {} does not exist, planning shards without durations", durations_path.string());
+            }
+            else {
+                try {
+                    durations = load_durations(durations_path);
+                }
+                catch(const std::exception& error) {
+                    log("Could not read durations from {}: {}", durations_path.string(), error.what());
+                }
+            }
+        }
+        plan_shards(targets, durations, config);
+    }
+
+    std::vector<Baseline> baselines {};
+    if(config.baselines_path) {
+        const auto& baselines_path = *config.baselines_path;
+        if(!std::filesystem::exists(baselines_path)) {
+            log("Baselines file {} does not exist, skipping", baselines_path.string());
+        }
+        else {
+            try {
+                baselines = load_baselines(baselines_path, targets);
+                log("Loaded {} baselines from {}", baselines.size(), baselines_path.string());
+            }
+            catch(const std::exception& error) {
+                log("Could not read baselines from {}: {}", baselines_path.string(), error.what());
+            }
+        }
+    }
+
+    process_sources(out_dir, targets, baselines, config);
+    if(config.modules_path) {
+        process_modules(*config.modules_path, targets, baselines, config);
+    }
+    if(config.fuzzers_path) {
+        process_fuzzers(*config.fuzzers_path, targets);
+    }
+}
+
+/*
+ * Sources and directories which aren't known yet, and removed directories
+ * containing known sources, are only picked up by walking the inputs again.
+ */
+auto needs_rescan(const std::set<std::filesystem::path>& changed_files,
+                  const std::map<std::filesystem::path, Target>& index) noexcept -> bool {
+    for(const auto& path : changed_files) {
+        if(index.contains(path)) {
+            continue;
+        }
+        std::error_code error {};
+        if(inputs::is_source_file(path) || std::filesystem::is_directory(path, error)) {
+            return true;
+        }
+        const auto child = index.lower_bound(path);// Entries below a directory sort right after it
+        if(child != index.end() && child->first.native().starts_with((path / "").native())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Keeps the discovered targets in memory and only re-discovers the sources
+ * which changed. Unchanged generated files are never touched, and the stamp
+ * is refreshed so the next configure run knows it can skip discovery.
+ * The input directories are expanded again when sources appear below them,
+ * so new sources are ordered just like after restarting.
+ */
+[[noreturn]] auto watch_sources(const std::vector<std::string>& values, std::vector<std::filesystem::path> files,
+                                const std::vector<std::filesystem::path>& directories,
+                                const std::filesystem::path& out_dir, std::map<std::filesystem::path, Target>& index,
+                                const Config& config) -> void {
+    auto watched_files = files;
+    if(config.durations_path) {
+        watched_files.push_back(*config.durations_path);
+    }
+    if(config.baselines_path) {
+        watched_files.push_back(*config.baselines_path);
     }
+    watch::Watcher watcher {watched_files, directories};
+    log("Watching {} files and {} directories for changes", watched_files.size(), directories.size());
 
-    generate_init_source(out_dir / INIT_FILE_NAME, targets);
-    inject_trampolines(out_dir, targets);
+    while(true) {
+        const auto changed_files = watcher.wait();
+        const auto start_time = std::chrono::system_clock::now();
+
+        if(needs_rescan(changed_files, index)) {
+            try {
+                files = inputs::expand(values);
+            }
+            catch(const std::exception& error) {
+                log("Could not read inputs: {}", error.what());
+            }
+            std::set<std::filesystem::path> known_files {};
+            for(const auto& file : files) {
+                known_files.insert(watch::normalize(file));
+            }
+            std::erase_if(index, [&](const auto& entry) {
+                if(known_files.contains(entry.first)) {
+                    return false;
+                }
+                log("Source {} was removed", entry.second.relative_path);
+                return true;
+            });
+        }
+
+        size_t num_changed_sources = 0;
+        for(const auto& file : files) {
+            const auto path = watch::normalize(file);
+            const auto is_new = !index.contains(path);
+            if(!is_new && !changed_files.contains(path)) {
+                continue;
+            }
+            if(!std::filesystem::exists(file)) {
+                if(index.erase(path) > 0) {
+                    log("Source {} was removed", file.string());
+                }
+                continue;
+            }
+            if(is_new) {
+                log("Found new source {}", file.string());
+            }
+            index.insert_or_assign(path, discover_target(file, config));
+            ++num_changed_sources;
+        }
+
+        auto targets = collect_targets(files, index);
+        generate_sources(out_dir, targets, config);
+
+        std::error_code error {};
+        const auto stamp_path = out_dir / STAMP_FILE_NAME;
+        if(std::filesystem::exists(stamp_path, error)) {
+            std::filesystem::last_write_time(stamp_path, std::filesystem::file_time_type::clock::now(), error);
+        }
+
+        const auto end_time = std::chrono::system_clock::now();
+        const auto time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+        log("Regenerated sources for {} changed files in {}ms", num_changed_sources, time);
+    }
 }
 
 auto main(int num_args, char** args) -> int {
@@ -297,8 +1370,21 @@ auto main(int num_args, char** args) -> int {
             ("v,version", "Display version information")
             ("o,out", "Specifies the path of the directory to generate sources into",
                 cxxopts::value<std::string>())
-            ("f,files", "Specifies the path to a file to scan for tests",
-                cxxopts::value<std::vector<std::string>>());
+            ("f,files", "Specifies a file or directory to scan for tests, or an @file listing one per line",
+                cxxopts::value<std::vector<std::string>>())
+            ("u,unity", "Merge up to the given number of sources into one translation unit, 0 to disable",
+                cxxopts::value<size_t>()->default_value("0"))
+            ("s,shards", "Plan the distribution of tests across the given number of shards, 0 to disable",
+                cxxopts::value<size_t>()->default_value("0"))
+            ("d,durations", "Specifies the path to a results file of a previous run to balance shards with",
+                cxxopts::value<std::string>())
+            ("b,baselines", "Specifies the path to a baselines file to compare test durations against",
+                cxxopts::value<std::string>())
+            ("m,modules", "Also generate a loadable module per group and a resident runner into the given directory",
+                cxxopts::value<std::string>())
+            ("z,fuzzers", "Also generate a libFuzzer entry point per fuzz test for the host into the given directory",
+                cxxopts::value<std::string>())
+            ("w,watch", "Keep running and regenerate sources whenever one of the given files changes");
     // clang-format on
     option_specs.parse_positional({"out", "files"});
 
@@ -315,29 +1401,38 @@ auto main(int num_args, char** args) -> int {
             return 0;
         }
 
-        const auto& file_strings = options["files"].as<std::vector<std::string>>();
+        const auto values = options["files"].as<std::vector<std::string>>();
         std::vector<std::filesystem::path> files {};
-        for(const auto& file_string : file_strings) {
-            files.emplace_back(file_string);
+        std::vector<std::filesystem::path> directories {};
+        try {
+            files = inputs::expand(values, directories);
+        }
+        catch(const std::exception& error) {
+            log("Could not read inputs: {}", error.what());
+            return 1;
         }
 
         const std::filesystem::path out_path {options["out"].as<std::string>()};
-        std::vector<Target> targets {};
+        Config config {};
+        config.unity_batch_size = options["unity"].as<size_t>();
+        config.shard_count = options["shards"].as<size_t>();
+        if(options.count("durations") > 0) {
+            config.durations_path = options["durations"].as<std::string>();
+        }
+        if(options.count("baselines") > 0) {
+            config.baselines_path = options["baselines"].as<std::string>();
+        }
+        if(options.count("modules") > 0) {
+            config.modules_path = options["modules"].as<std::string>();
+        }
+        if(options.count("fuzzers") > 0) {
+            config.fuzzers_path = options["fuzzers"].as<std::string>();
+        }
 
         const auto start_time = std::chrono::system_clock::now();
 
-        for(const auto& file : files) {
-            if(!std::filesystem::exists(file)) {
-                log("File {} does not exist, skipping", file.string());
-                continue;
-            }
-
-            Target target {file};
-            compute_header_path(out_path, target);
-            target.tests = discover_tests(file);
-
-            targets.push_back(std::move(target));
-        }
+        auto index = discover_targets(files, config);
+        auto targets = collect_targets(files, index);
 
         const auto end_time = std::chrono::system_clock::now();
         const auto time = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
@@ -346,9 +1441,19 @@ auto main(int num_args, char** args) -> int {
         for(const auto& target : targets) {
             num_tests += target.tests.size();
         }
-        log("Discovered {} tests in {}ms", num_tests, time);
+        log("Discovered {} tests in {} files in {}ms", num_tests, files.size(), time);
+
+        generate_sources(out_path, targets, config);
 
-        process_sources(out_path, targets);
+        if(options.count("watch") > 0) {
+            try {
+                watch_sources(values, files, directories, out_path, index, config);
+            }
+            catch(const std::exception& error) {
+                log("Could not watch sources: {}", error.what());
+                return 1;
+            }
+        }
     }
     catch(...) {
         log("Could not parse arguments, try -h to get help");
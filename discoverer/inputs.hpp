@@ -0,0 +1,194 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Expands the inputs passed to the discoverer into a list of
+ * source files, reading response files and walking directories
+ * in parallel, so large trees don't have to be passed on the
+ * command line file by file.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace inputs {
+    static constexpr char RESPONSE_FILE_PREFIX = '@';
+    static constexpr std::string_view CORPUS_DIR_NAME = "corpus";// Holds fuzz inputs, even if they look like sources
+
+    // Mirrors the *.c* pattern the build scripts used to glob for
+    inline auto is_source_file(const std::filesystem::path& path) noexcept -> bool {
+        return path.extension().string().starts_with(".c");
+    }
+
+    /*
+     * Walks all given directories at once, with every worker taking the next
+     * pending directory and queueing the directories it finds, until none are
+     * left and no worker is busy. Symlinked directories aren't followed, like
+     * with GLOB_RECURSE. Returns the sorted source files below each directory.
+     */
+    inline auto walk(const std::vector<std::filesystem::path>& directories)
+            -> std::vector<std::vector<std::filesystem::path>> {
+        std::mutex mutex {};
+        std::condition_variable condition {};
+        std::vector<std::pair<size_t, std::filesystem::path>> pending_directories {};
+        std::vector<std::vector<std::filesystem::path>> files(directories.size());
+        size_t num_busy_workers = 0;
+        for(size_t index = 0; index < directories.size(); ++index) {
+            pending_directories.emplace_back(index, directories[index]);
+        }
+
+        const auto work = [&] {
+            std::vector<std::filesystem::path> found_files {};
+            std::vector<std::filesystem::path> found_directories {};
+            std::unique_lock lock {mutex};
+            while(true) {
+                condition.wait(lock, [&] { return !pending_directories.empty() || num_busy_workers == 0; });
+                if(pending_directories.empty()) {
+                    return;
+                }
+                const auto [root_index, directory] = std::move(pending_directories.back());
+                pending_directories.pop_back();
+                ++num_busy_workers;
+                lock.unlock();
+
+                std::error_code error {};
+                const auto options = std::filesystem::directory_options::skip_permission_denied;
+                const std::filesystem::directory_iterator end {};
+                for(std::filesystem::directory_iterator entry {directory, options, error}; !error && entry != end;
+                    entry.increment(error)) {
+                    std::error_code entry_error {};// Broken entries are skipped instead of ending the walk
+                    if(entry->is_directory(entry_error) && !entry->is_symlink(entry_error)) {
+                        if(entry->path().filename() != CORPUS_DIR_NAME) {
+                            found_directories.push_back(entry->path());
+                        }
+                    }
+                    else if(entry->is_regular_file(entry_error) && is_source_file(entry->path())) {
+                        found_files.push_back(entry->path());
+                    }
+                }
+
+                lock.lock();
+                --num_busy_workers;
+                auto& root_files = files[root_index];
+                std::ranges::move(found_files, std::back_inserter(root_files));
+                for(auto& found_directory : found_directories) {
+                    pending_directories.emplace_back(root_index, std::move(found_directory));
+                }
+                found_files.clear();
+                found_directories.clear();
+                condition.notify_all();
+            }
+        };
+
+        {
+            const auto num_workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+            std::vector<std::jthread> workers {};
+            for(size_t index = 0; index < num_workers; ++index) {
+                workers.emplace_back(work);
+            }
+        }
+        for(auto& root_files : files) {
+            std::ranges::sort(root_files);
+        }
+        return files;
+    }
+
+    /*
+     * Response files list one input per line, empty lines and
+     * lines starting with # are ignored. They may reference
+     * other response files, each of which is only read once.
+     */
+    inline auto read_response_file(const std::filesystem::path& path, std::set<std::filesystem::path>& visited_files,
+                                   std::vector<std::filesystem::path>& entries) -> void {
+        if(!visited_files.insert(std::filesystem::absolute(path).lexically_normal()).second) {
+            return;
+        }
+        std::ifstream stream {path};
+        if(!stream) {
+            throw std::runtime_error {"Could not read response file " + path.string()};
+        }
+        std::string line {};
+        while(std::getline(stream, line)) {
+            const auto begin = line.find_first_not_of(" \t");
+            const auto end = line.find_last_not_of(" \t\r");
+            if(begin == std::string::npos || line[begin] == '#') {
+                continue;
+            }
+            const auto entry = line.substr(begin, (end - begin) + 1);
+            if(entry.front() == RESPONSE_FILE_PREFIX) {
+                read_response_file(entry.substr(1), visited_files, entries);
+                continue;
+            }
+            entries.emplace_back(entry);
+        }
+    }
+
+    /*
+     * Turns files, directories and @response files into a flat list of
+     * files, keeping the order in which they were passed in. Files which
+     * don't exist are kept, so the caller can report them. The directories
+     * which were walked are appended to the given list.
+     */
+    inline auto expand(const std::vector<std::string>& values, std::vector<std::filesystem::path>& directories)
+            -> std::vector<std::filesystem::path> {
+        std::vector<std::filesystem::path> entries {};
+        std::set<std::filesystem::path> visited_files {};
+        for(const auto& value : values) {
+            if(!value.empty() && value.front() == RESPONSE_FILE_PREFIX) {
+                read_response_file(value.substr(1), visited_files, entries);
+                continue;
+            }
+            entries.emplace_back(value);
+        }
+
+        std::vector<std::filesystem::path> walked_directories {};
+        for(const auto& entry : entries) {
+            std::error_code error {};
+            if(std::filesystem::is_directory(entry, error)) {
+                walked_directories.push_back(entry);
+            }
+        }
+        auto directory_files = walk(walked_directories);
+        std::ranges::copy(walked_directories, std::back_inserter(directories));
+
+        std::vector<std::filesystem::path> files {};
+        size_t directory_index = 0;
+        for(auto& entry : entries) {
+            std::error_code error {};
+            if(!std::filesystem::is_directory(entry, error)) {
+                files.push_back(std::move(entry));
+                continue;
+            }
+            std::ranges::move(directory_files[directory_index++], std::back_inserter(files));
+        }
+        return files;
+    }
+
+    inline auto expand(const std::vector<std::string>& values) -> std::vector<std::filesystem::path> {
+        std::vector<std::filesystem::path> directories {};
+        return expand(values, directories);
+    }
+}// namespace inputs
@@ -0,0 +1,204 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * A minimal JSON reader, just enough to ingest the
+ * results files written by the EFITEST runtime.
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace json {
+    struct Value;
+
+    using Array = std::vector<Value>;
+    using Object = std::map<std::string, Value, std::less<>>;
+
+    struct Value {
+        std::variant<std::nullptr_t, bool, double, std::string, Array, Object> data {nullptr};
+
+        [[nodiscard]] auto is_object() const noexcept -> bool {
+            return std::holds_alternative<Object>(data);
+        }
+
+        [[nodiscard]] auto is_array() const noexcept -> bool {
+            return std::holds_alternative<Array>(data);
+        }
+
+        [[nodiscard]] auto is_string() const noexcept -> bool {
+            return std::holds_alternative<std::string>(data);
+        }
+
+        [[nodiscard]] auto is_number() const noexcept -> bool {
+            return std::holds_alternative<double>(data);
+        }
+
+        [[nodiscard]] auto as_object() const -> const Object& {
+            return std::get<Object>(data);
+        }
+
+        [[nodiscard]] auto as_array() const -> const Array& {
+            return std::get<Array>(data);
+        }
+
+        [[nodiscard]] auto as_string() const -> const std::string& {
+            return std::get<std::string>(data);
+        }
+
+        [[nodiscard]] auto as_number() const -> double {
+            return std::get<double>(data);
+        }
+
+        /*
+         * Look up a member of an object, returns nullptr if this
+         * is not an object or if there is no such member.
+         */
+        [[nodiscard]] auto find(std::string_view key) const noexcept -> const Value* {
+            if(!is_object()) {
+                return nullptr;
+            }
+            const auto& object = as_object();
+            const auto result = object.find(key);
+            return result == object.end() ? nullptr : &result->second;
+        }
+    };
+
+    class Parser final {
+        std::string_view _source;
+        size_t _position = 0;
+
+        auto skip_whitespace() noexcept -> void {
+            while(_position < _source.size() && std::string_view {" \t\r\n"}.contains(_source[_position])) {
+                ++_position;
+            }
+        }
+
+        auto expect(char value) -> void {
+            skip_whitespace();
+            if(_position >= _source.size() || _source[_position] != value) {
+                throw std::runtime_error {std::string {"Expected '"} + value + "' in JSON input"};
+            }
+            ++_position;
+        }
+
+        auto peek() noexcept -> char {
+            skip_whitespace();
+            return _position < _source.size() ? _source[_position] : '\0';
+        }
+
+        auto parse_string() -> std::string {
+            expect('"');
+            std::string result {};
+            while(_position < _source.size() && _source[_position] != '"') {
+                auto current = _source[_position++];
+                if(current == '\\' && _position < _source.size()) {
+                    current = _source[_position++];
+                    switch(current) {
+                        case 'n': current = '\n'; break;
+                        case 't': current = '\t'; break;
+                        case 'r': current = '\r'; break;
+                        case 'u':// Non-ASCII escapes are never written by EFITEST, keep them verbatim
+                            result += "\\u";
+                            continue;
+                        default: break;
+                    }
+                }
+                result += current;
+            }
+            expect('"');
+            return result;
+        }
+
+        auto parse_value() -> Value {// NOLINT
+            const auto current = peek();
+            if(current == '{') {
+                ++_position;
+                Object object {};
+                if(peek() == '}') {
+                    ++_position;
+                    return {std::move(object)};
+                }
+                do {
+                    auto key = parse_string();
+                    expect(':');
+                    object.emplace(std::move(key), parse_value());
+                } while(peek() == ',' && ++_position);
+                expect('}');
+                return {std::move(object)};
+            }
+            if(current == '[') {
+                ++_position;
+                Array array {};
+                if(peek() == ']') {
+                    ++_position;
+                    return {std::move(array)};
+                }
+                do {
+                    array.push_back(parse_value());
+                } while(peek() == ',' && ++_position);
+                expect(']');
+                return {std::move(array)};
+            }
+            if(current == '"') {
+                return {parse_string()};
+            }
+            if(_source.substr(_position).starts_with("true")) {
+                _position += 4;
+                return {true};
+            }
+            if(_source.substr(_position).starts_with("false")) {
+                _position += 5;
+                return {false};
+            }
+            if(_source.substr(_position).starts_with("null")) {
+                _position += 4;
+                return {nullptr};
+            }
+            const std::string number {_source.substr(_position, 64)};
+            char* end = nullptr;
+            const auto value = std::strtod(number.c_str(), &end);
+            if(end == number.c_str()) {
+                throw std::runtime_error {"Unexpected character in JSON input"};
+            }
+            _position += static_cast<size_t>(end - number.c_str());
+            return {value};
+        }
+
+        public:
+        explicit Parser(std::string_view source) noexcept :
+                _source {source} {
+        }
+
+        [[nodiscard]] auto parse() -> Value {
+            auto value = parse_value();
+            skip_whitespace();
+            if(_position != _source.size()) {
+                throw std::runtime_error {"Trailing characters in JSON input"};
+            }
+            return value;
+        }
+    };
+
+    inline auto parse(std::string_view source) -> Value {
+        return Parser {source}.parse();
+    }
+}// namespace json
@@ -0,0 +1,241 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Waits for changes to a set of files and to everything below a set
+ * of directories, using inotify on the directories on Linux and
+ * polling modification times everywhere else.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace watch {
+    using namespace std::chrono_literals;
+
+    static constexpr auto DEBOUNCE_TIME = 50ms;// Editors usually touch a file more than once when saving
+    static constexpr auto POLL_INTERVAL = 500ms;
+
+    inline auto normalize(const std::filesystem::path& path) noexcept -> std::filesystem::path {
+        std::error_code error {};
+        const auto absolute_path = std::filesystem::absolute(path, error);
+        return (error ? path : absolute_path).lexically_normal();
+    }
+
+    class Watcher final {
+        std::set<std::filesystem::path> _files;
+        std::vector<std::filesystem::path> _trees;// Directories in which every file and subdirectory is watched
+#ifdef __linux__
+        struct Directory {
+            std::filesystem::path path;
+            bool is_tree = false;// Reports all entries instead of only the watched files
+        };
+
+        int _descriptor = -1;
+        std::map<int, Directory> _directories;// Maps watch descriptors to directories
+
+        auto add_directory(const std::filesystem::path& path, bool is_tree) noexcept -> void {
+            const auto mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM;
+            const auto watch_descriptor = inotify_add_watch(_descriptor, path.c_str(), mask);
+            if(watch_descriptor >= 0) {
+                auto& directory = _directories[watch_descriptor];
+                directory.path = path;// Directories moved within a tree keep their descriptor
+                directory.is_tree = directory.is_tree || is_tree;
+            }
+        }
+
+        /*
+         * Symlinked directories aren't followed, like when walking the inputs.
+         * Directories which are moved into a tree may already contain files,
+         * those are reported as changed so the caller picks them up.
+         */
+        auto add_tree(const std::filesystem::path& root, std::set<std::filesystem::path>* changed) noexcept -> void {
+            add_directory(root, true);
+            std::error_code error {};
+            const auto options = std::filesystem::directory_options::skip_permission_denied;
+            const std::filesystem::recursive_directory_iterator end {};
+            for(std::filesystem::recursive_directory_iterator entry {root, options, error}; !error && entry != end;
+                entry.increment(error)) {
+                std::error_code entry_error {};
+                if(entry->is_directory(entry_error) && !entry->is_symlink(entry_error)) {
+                    add_directory(entry->path(), true);
+                }
+                else if(changed != nullptr) {
+                    changed->insert(entry->path());
+                }
+            }
+        }
+
+        /*
+         * Read all pending events, returns false if the timeout elapsed without any.
+         * Files are usually replaced instead of being written in place when saving,
+         * so the directories are watched instead of the files themselves.
+         */
+        auto read_events(std::set<std::filesystem::path>& changed, int timeout) -> bool {
+            pollfd poll_descriptor {_descriptor, POLLIN, 0};
+            if(poll(&poll_descriptor, 1, timeout) <= 0) {
+                return false;
+            }
+            alignas(inotify_event) char buffer[4096];
+            const auto length = read(_descriptor, buffer, sizeof(buffer));
+            if(length <= 0) {
+                return false;
+            }
+            for(ssize_t offset = 0; offset < length;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);// NOLINT
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                if((event->mask & IN_IGNORED) != 0) {// The directory was removed
+                    _directories.erase(event->wd);
+                    continue;
+                }
+                const auto directory = _directories.find(event->wd);
+                if(event->len == 0 || directory == _directories.end()) {
+                    continue;
+                }
+                auto path = directory->second.path / event->name;
+                if(directory->second.is_tree) {
+                    if((event->mask & IN_ISDIR) != 0 && (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+                        add_tree(path, &changed);
+                    }
+                    changed.insert(std::move(path));
+                }
+                else if(_files.contains(path)) {
+                    changed.insert(std::move(path));
+                }
+            }
+            return true;
+        }
+#else
+        std::map<std::filesystem::path, std::filesystem::file_time_type> _times;
+
+        auto get_time(const std::filesystem::path& path) const noexcept -> std::filesystem::file_time_type {
+            std::error_code error {};
+            const auto time = std::filesystem::last_write_time(path, error);
+            return error ? std::filesystem::file_time_type {} : time;
+        }
+
+        /*
+         * Files appearing below the watched directories are only found by walking
+         * them again, they are recorded and reported as changed when they do.
+         */
+        auto scan_trees(std::set<std::filesystem::path>* changed) noexcept -> void {
+            for(const auto& root : _trees) {
+                std::error_code error {};
+                const auto options = std::filesystem::directory_options::skip_permission_denied;
+                const std::filesystem::recursive_directory_iterator end {};
+                for(std::filesystem::recursive_directory_iterator entry {root, options, error};
+                    !error && entry != end; entry.increment(error)) {
+                    std::error_code entry_error {};
+                    if(!entry->is_regular_file(entry_error) || _times.contains(entry->path())) {
+                        continue;
+                    }
+                    _times[entry->path()] = get_time(entry->path());
+                    if(changed != nullptr) {
+                        changed->insert(entry->path());
+                    }
+                }
+            }
+        }
+#endif
+
+        public:
+        /*
+         * The given files are watched on their own, while everything below the
+         * given directories is watched including files and directories which
+         * are created later on.
+         */
+        Watcher(const std::vector<std::filesystem::path>& files, const std::vector<std::filesystem::path>& trees) {
+            for(const auto& file : files) {
+                _files.insert(normalize(file));
+            }
+            for(const auto& tree : trees) {
+                _trees.push_back(normalize(tree));
+            }
+#ifdef __linux__
+            _descriptor = inotify_init1(IN_CLOEXEC);
+            if(_descriptor < 0) {
+                throw std::runtime_error {"Could not initialize inotify"};
+            }
+            for(const auto& tree : _trees) {
+                add_tree(tree, nullptr);
+            }
+            std::set<std::filesystem::path> directories {};
+            for(const auto& file : _files) {
+                directories.insert(file.parent_path());
+            }
+            for(const auto& directory : directories) {
+                add_directory(directory, false);
+            }
+#else
+            for(const auto& file : _files) {
+                _times[file] = get_time(file);
+            }
+            scan_trees(nullptr);
+#endif
+        }
+
+        ~Watcher() noexcept {
+#ifdef __linux__
+            if(_descriptor >= 0) {
+                close(_descriptor);
+            }
+#endif
+        }
+
+        Watcher(const Watcher&) = delete;
+        auto operator=(const Watcher&) -> Watcher& = delete;
+
+        /*
+         * Blocks until at least one of the watched files changed and returns
+         * all files which changed until things settled down. Below the watched
+         * directories, created, removed and renamed entries are returned too.
+         */
+        [[nodiscard]] auto wait() -> std::set<std::filesystem::path> {
+            std::set<std::filesystem::path> changed {};
+#ifdef __linux__
+            while(changed.empty()) {
+                read_events(changed, -1);
+            }
+            const auto timeout = static_cast<int>(DEBOUNCE_TIME.count());
+            while(read_events(changed, timeout)) {
+            }
+#else
+            while(changed.empty()) {
+                std::this_thread::sleep_for(POLL_INTERVAL);
+                for(auto& [file, time] : _times) {
+                    const auto current_time = get_time(file);
+                    if(current_time != time) {
+                        time = current_time;
+                        changed.insert(file);
+                    }
+                }
+                scan_trees(&changed);
+            }
+#endif
+            return changed;
+        }
+    };
+}// namespace watch
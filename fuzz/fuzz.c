@@ -0,0 +1,78 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fuzz.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "efitest/efitest_init.h"
+#include "shim.h"
+
+// NOLINTBEGIN
+static BOOLEAN g_is_initialized = FALSE;
+// NOLINTEND
+
+// Fuzz tests are called directly by the fuzzer, these are usually generated by the discoverer
+
+void efitest_run_tests(EFITestContext* context) {
+}
+
+const EFITestGroup* efitest_get_groups(UINTN* count) {
+    *count = 0;
+    return NULL;
+}
+
+const EFITestBaseline* efitest_get_baselines(UINTN* count) {
+    *count = 0;
+    return NULL;
+}
+
+UINTN efitest_get_shard_count() {
+    return 0;
+}
+
+BOOLEAN efitest_is_resident_runner() {
+    return FALSE;
+}
+
+static void report_errors(const EFITestFuzzTarget* target) {
+    const EFITestError* errors = efitest_errors_get();
+    const UINTN count = efitest_errors_get_count();
+    for(UINTN index = 0; index < count; ++index) {
+        const EFITestError* error = &(errors[index]);
+        fprintf(stderr, "%s:%lu: %s.%s failed: %s\n", target->file_path, (unsigned long) error->line_number,
+                target->group_name, target->name, error->expression);
+    }
+}
+
+int efitest_fuzz_run(const EFITestFuzzTarget* target, const UINT8* data, UINTN size) {
+    if(!g_is_initialized) {
+        shim_init();
+        g_is_initialized = TRUE;
+    }
+    EFITestContext context = {
+            .test_name = target->name,
+            .file_path = target->file_path,
+            .file_name = target->file_name,
+            .group_name = target->group_name,
+            .group_size = 1,
+            .line_number = target->line_number,
+            .test_id = target->id,
+    };
+    target->function(&context, data, size);
+    if(!context.failed) {
+        return 0;
+    }
+    report_errors(target);
+    abort();
+}
@@ -0,0 +1,46 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/**
+ * Runs fuzz tests on the host, called by the libFuzzer entry points
+ * generated by the discoverer. Failed assertions are reported and
+ * abort the process, so the fuzzer keeps the input as a crash.
+ */
+
+#pragma once
+
+#include <efitest/efitest.h>
+
+ETEST_API_BEGIN
+
+typedef void (*EFITestFuzzFunction)(EFITestContext* context, const UINT8* data, UINTN size);
+
+typedef struct _EFITestFuzzTarget {
+    const char* name;            // The name of the fuzz test
+    const char* group_name;      // The name of the group the test is part of
+    const char* file_name;       // The name of the file the test is defined in
+    const char* file_path;       // The absolute path to the source file the test is defined in
+    UINTN line_number;           // The line number where the test is defined
+    UINT64 id;                   // The stable ID of the test
+    EFITestFuzzFunction function;// The generated trampoline which calls the test
+} EFITestFuzzTarget;
+
+/**
+ * Run the given fuzz test with a single input.
+ * @param target The fuzz test to run.
+ * @param data The input generated by the fuzzer.
+ * @param size The size of the input in bytes.
+ * @return Always 0, failed assertions abort the process.
+ */
+int efitest_fuzz_run(const EFITestFuzzTarget* target, const UINT8* data, UINTN size);
+
+ETEST_API_END
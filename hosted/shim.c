@@ -0,0 +1,344 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shim.h"
+#include <efilib.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NOLINTBEGIN
+EFI_SYSTEM_TABLE* ST = NULL;
+EFI_BOOT_SERVICES* BS = NULL;
+EFI_RUNTIME_SERVICES* RT = NULL;
+EFI_GUID LoadedImageProtocol = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+EFI_GUID SerialIoProtocol = EFI_SERIAL_IO_PROTOCOL_GUID;
+EFI_GUID BlockIoProtocol = EFI_BLOCK_IO_PROTOCOL_GUID;
+EFI_GUID DevicePathProtocol = EFI_DEVICE_PATH_PROTOCOL_GUID;
+EFI_GUID FileSystemProtocol = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+static UINTN g_output_count = 0;
+static CHAR16 g_print_buffer[4096];// Print formats into this before writing to the console
+// NOLINTEND
+
+// Console
+
+static EFI_STATUS EFIAPI output_string(SIMPLE_TEXT_OUTPUT_INTERFACE* this, CHAR16* string) {
+    g_output_count += StrLen(string);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI set_attribute(SIMPLE_TEXT_OUTPUT_INTERFACE* this, UINTN attribute) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI clear_screen(SIMPLE_TEXT_OUTPUT_INTERFACE* this) {
+    return EFI_SUCCESS;
+}
+
+// Boot services
+
+static EFI_STATUS EFIAPI allocate_pool(EFI_MEMORY_TYPE type, UINTN size, VOID** address) {
+    *address = malloc(size);
+    return *address == NULL ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI free_pool(VOID* address) {
+    free(address);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI get_memory_map(UINTN* size, EFI_MEMORY_DESCRIPTOR* map, UINTN* key, UINTN* descriptor_size,
+                                        UINT32* descriptor_version) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI stall(UINTN microseconds) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI handle_protocol(EFI_HANDLE handle, EFI_GUID* protocol, VOID** interface) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI locate_protocol(EFI_GUID* protocol, VOID* registration, VOID** interface) {
+    return EFI_NOT_FOUND;
+}
+
+// Runtime services
+
+static EFI_STATUS EFIAPI get_variable(CHAR16* name, EFI_GUID* vendor, UINT32* attributes, UINTN* size, VOID* data) {
+    return EFI_NOT_FOUND;
+}
+
+static EFI_STATUS EFIAPI set_variable(CHAR16* name, EFI_GUID* vendor, UINT32 attributes, UINTN size, VOID* data) {
+    return EFI_UNSUPPORTED;
+}
+
+// NOLINTBEGIN
+static SIMPLE_TEXT_OUTPUT_INTERFACE g_conout = {
+        .OutputString = output_string,
+        .SetAttribute = set_attribute,
+        .ClearScreen = clear_screen,
+};
+static EFI_BOOT_SERVICES g_boot_services = {
+        .AllocatePool = allocate_pool,
+        .FreePool = free_pool,
+        .GetMemoryMap = get_memory_map,
+        .Stall = stall,
+        .HandleProtocol = handle_protocol,
+        .LocateProtocol = locate_protocol,
+};
+static EFI_RUNTIME_SERVICES g_runtime_services = {
+        .GetVariable = get_variable,
+        .SetVariable = set_variable,
+};
+static EFI_SYSTEM_TABLE g_system_table = {
+        .ConOut = &g_conout,
+        .BootServices = &g_boot_services,
+        .RuntimeServices = &g_runtime_services,
+};
+// NOLINTEND
+
+void shim_init() {
+    ST = &g_system_table;
+    BS = &g_boot_services;
+    RT = &g_runtime_services;
+}
+
+UINTN shim_get_output_count() {
+    return g_output_count;
+}
+
+// Library
+
+VOID InitializeLib(EFI_HANDLE image, EFI_SYSTEM_TABLE* system_table) {
+    shim_init();
+}
+
+VOID InitializeUnicodeSupport(CHAR8* language_code) {
+}
+
+EFI_FILE_HANDLE LibOpenRoot(EFI_HANDLE device) {
+    return NULL;
+}
+
+EFI_DEVICE_PATH* FileDevicePath(EFI_HANDLE device, CHAR16* file_name) {
+    return NULL;
+}
+
+VOID CopyMem(VOID* destination, CONST VOID* source, UINTN size) {
+    memmove(destination, source, size);
+}
+
+VOID SetMem(VOID* buffer, UINTN size, UINT8 value) {
+    memset(buffer, value, size);
+}
+
+INTN CompareMem(CONST VOID* address1, CONST VOID* address2, UINTN size) {
+    return memcmp(address1, address2, size);
+}
+
+UINTN StrLen(CONST CHAR16* string) {
+    UINTN length = 0;
+    while(string[length] != L'\0') {
+        ++length;
+    }
+    return length;
+}
+
+INTN StrCmp(CONST CHAR16* string1, CONST CHAR16* string2) {
+    while(*string1 != L'\0' && *string1 == *string2) {
+        ++string1;
+        ++string2;
+    }
+    return (INTN) *string1 - (INTN) *string2;
+}
+
+VOID StrCpy(CHAR16* destination, CONST CHAR16* source) {
+    while(*source != L'\0') {
+        *destination++ = *source++;
+    }
+    *destination = L'\0';
+}
+
+UINTN strlena(CONST CHAR8* string) {
+    return strlen((const char*) string);
+}
+
+INTN strcmpa(CONST CHAR8* string1, CONST CHAR8* string2) {
+    return strcmp((const char*) string1, (const char*) string2);
+}
+
+// Formatting
+
+typedef struct _Output {
+    CHAR16* buffer;
+    UINTN capacity;// In characters, including the terminator
+    UINTN length;
+} Output;
+
+static inline void put_char(Output* output, CHAR16 value) {
+    if(output->length + 1 < output->capacity) {
+        output->buffer[output->length] = value;
+    }
+    ++output->length;
+}
+
+static void put_padded(Output* output, const CHAR16* digits, UINTN length, UINTN width, BOOLEAN left_align,
+                       CHAR16 padding) {
+    const UINTN pad_length = width > length ? width - length : 0;
+    for(UINTN index = 0; !left_align && index < pad_length; ++index) {
+        put_char(output, padding);
+    }
+    for(UINTN index = 0; index < length; ++index) {
+        put_char(output, digits[index]);
+    }
+    for(UINTN index = 0; left_align && index < pad_length; ++index) {
+        put_char(output, L' ');
+    }
+}
+
+static void put_number(Output* output, UINT64 value, BOOLEAN is_negative, UINTN base, BOOLEAN is_upper,
+                       UINTN width, BOOLEAN left_align, CHAR16 padding) {
+    const char* digit_chars = is_upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    CHAR16 digits[24];
+    UINTN length = 0;
+    do {
+        digits[length++] = (CHAR16) digit_chars[value % base];
+        value /= base;
+    } while(value != 0);
+    if(is_negative) {
+        digits[length++] = L'-';
+    }
+    for(UINTN index = 0; index < length / 2; ++index) {
+        const CHAR16 digit = digits[index];
+        digits[index] = digits[length - index - 1];
+        digits[length - index - 1] = digit;
+    }
+    put_padded(output, digits, length, width, left_align, padding);
+}
+
+/*
+ * Supports the subset of the GNU-EFI format syntax used by the runtime:
+ * flags '-' and '0', a width, the 'l' length modifier and the
+ * conversions a, s, c, d, i, u, x, X, r and %.
+ */
+static UINTN format(Output* output, CONST CHAR16* format, va_list args) {// NOLINT
+    for(const CHAR16* current = format; *current != L'\0'; ++current) {
+        if(*current != L'%') {
+            put_char(output, *current);
+            continue;
+        }
+        ++current;
+        BOOLEAN left_align = FALSE;
+        CHAR16 padding = L' ';
+        for(; *current == L'-' || *current == L'0'; ++current) {
+            if(*current == L'-') {
+                left_align = TRUE;
+            }
+            else {
+                padding = L'0';
+            }
+        }
+        UINTN width = 0;
+        for(; *current >= L'0' && *current <= L'9'; ++current) {
+            width = (width * 10) + (*current - L'0');
+        }
+        BOOLEAN is_long = FALSE;
+        for(; *current == L'l'; ++current) {
+            is_long = TRUE;
+        }
+
+        switch(*current) {
+            case L'a': {
+                const char* string = va_arg(args, const char*);
+                const UINTN length = strlen(string);
+                const UINTN pad_length = width > length ? width - length : 0;
+                for(UINTN index = 0; !left_align && index < pad_length; ++index) {
+                    put_char(output, L' ');
+                }
+                for(UINTN index = 0; index < length; ++index) {
+                    put_char(output, (CHAR16) string[index]);
+                }
+                for(UINTN index = 0; left_align && index < pad_length; ++index) {
+                    put_char(output, L' ');
+                }
+                break;
+            }
+            case L's': {
+                const CHAR16* string = va_arg(args, const CHAR16*);
+                put_padded(output, string, StrLen(string), width, left_align, L' ');
+                break;
+            }
+            case L'c': {
+                const CHAR16 value = (CHAR16) va_arg(args, int);
+                put_padded(output, &value, 1, width, left_align, L' ');
+                break;
+            }
+            case L'd':
+            case L'i': {
+                const INT64 value = is_long ? va_arg(args, INT64) : va_arg(args, INT32);
+                const UINT64 magnitude = value < 0 ? (UINT64) 0 - (UINT64) value : (UINT64) value;
+                put_number(output, magnitude, value < 0, 10, FALSE, width, left_align, padding);
+                break;
+            }
+            case L'u': {
+                const UINT64 value = is_long ? va_arg(args, UINT64) : va_arg(args, UINT32);
+                put_number(output, value, FALSE, 10, FALSE, width, left_align, padding);
+                break;
+            }
+            case L'x':
+            case L'X': {
+                const UINT64 value = is_long ? va_arg(args, UINT64) : va_arg(args, UINT32);
+                put_number(output, value, FALSE, 16, *current == L'X', width, left_align, padding);
+                break;
+            }
+            case L'r': {
+                const EFI_STATUS status = va_arg(args, EFI_STATUS);
+                put_number(output, status, FALSE, 16, TRUE, width, left_align, padding);
+                break;
+            }
+            case L'\0':
+                --current;
+                break;
+            default:
+                put_char(output, *current);
+                break;
+        }
+    }
+    if(output->capacity > 0) {
+        output->buffer[output->length < output->capacity ? output->length : output->capacity - 1] = L'\0';
+    }
+    return output->length;
+}
+
+UINTN VSPrint(CHAR16* string, UINTN size, CONST CHAR16* fmt, va_list args) {
+    Output output = {string, size / sizeof(CHAR16), 0};
+    return format(&output, fmt, args);
+}
+
+UINTN SPrint(CHAR16* string, UINTN size, CONST CHAR16* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const UINTN length = VSPrint(string, size, fmt, args);
+    va_end(args);
+    return length;
+}
+
+UINTN Print(CONST CHAR16* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    const UINTN length = VSPrint(g_print_buffer, sizeof(g_print_buffer), fmt, args);
+    va_end(args);
+    uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, g_print_buffer);
+    return length;
+}
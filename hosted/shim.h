@@ -0,0 +1,33 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Host implementations of the GNU-EFI library functions and the firmware
+ * services used by the runtime, so it can be benchmarked and fuzzed as a
+ * regular process. Console output is counted and discarded.
+ */
+
+#pragma once
+
+#include <efi.h>
+
+/**
+ * Install the shimmed system table, must be called before
+ * any runtime function.
+ */
+void shim_init();
+
+/**
+ * @return The number of characters written to the console so far.
+ */
+UINTN shim_get_output_count();
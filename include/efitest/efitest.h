@@ -24,31 +24,201 @@ typedef struct _EFITestUUID {
     UINT32 data[4];// 128 bits for a v4 UUID
 } EFITestUUID;
 
+typedef struct _EFITestMemoryStats {
+    UINTN allocated_bytes; // The number of bytes allocated through the EFITEST allocator
+    UINTN freed_bytes;     // The number of bytes freed through the EFITEST allocator
+    UINTN peak_bytes;      // The highest number of bytes alive at the same time
+    UINTN allocation_count;// The number of allocations made
+    UINTN free_count;      // The number of allocations freed
+} EFITestMemoryStats;
+
 typedef struct _EFITestContext {
-    const char* test_name; // The name of the current test being run
-    const char* file_path; // The absolute path to the source file the test is defined in
-    const char* file_name; // The name of the file the test is defined in
-    const char* group_name;// The name of the test group the current test is part of
-    UINTN group_size;      // The total number of tests within the current group
-    UINTN group_index;     // The index of the current test within the current group
-    UINTN line_number;     // The line number where the function is defined
-    BOOLEAN failed;        // Determines if the test has failed
+    const char* test_name;    // The name of the current test being run
+    const char* file_path;    // The absolute path to the source file the test is defined in
+    const char* file_name;    // The name of the file the test is defined in
+    const char* group_name;   // The name of the test group the current test is part of
+    UINTN group_size;         // The total number of tests within the current group
+    UINTN group_index;        // The index of the current test within the current group
+    UINTN line_number;        // The line number where the function is defined
+    UINT64 test_id;           // The stable ID of the current test
+    UINTN param_index;        // The index of the current case within the parameter table
+    UINTN param_count;        // The number of cases in the parameter table, 0 for regular tests
+    UINTN resume_point;       // The line an asynchronous test continues at, 0 when it starts
+    UINT64 duration;          // The time it took to run the last test in nanoseconds
+    EFITestMemoryStats memory;// Allocator statistics of the last test
+    BOOLEAN failed;           // Determines if the test has failed
+    BOOLEAN slower;           // Determines if the test has failed by being slower than its baseline
 } EFITestContext;
 
+typedef void (*EFITestFunction)(EFITestContext* context);
+
+typedef struct _EFITestDescriptor {
+    const char* name;        // The name of the test
+    EFITestFunction function;// The generated trampoline which calls the test
+    UINTN line_number;       // The line number where the test is defined
+    UINTN param_count;       // The number of cases in the parameter table, 0 for regular tests
+    UINT64 id;               // Stable ID derived from the relative source path and the test name
+    const char* tags;        // Comma separated list of tags the test was defined with
+    UINTN shard;             // The shard assigned by the shard plan of the discoverer
+    BOOLEAN is_async;        // Determines if the test waits for events while other tests keep running
+} EFITestDescriptor;
+
+typedef struct _EFITestGroup {
+    const char* name;              // The name of the test group
+    const char* file_name;         // The name of the file the group is defined in
+    const char* file_path;         // The absolute path to the source file the group is defined in
+    const EFITestDescriptor* tests;// The generated descriptor table of all tests in the group
+    UINTN test_count;              // The number of entries in the descriptor table
+} EFITestGroup;
+
+typedef struct _EFITestBaseline {
+    UINT64 case_id; // The ID of the test case the baseline belongs to
+    UINT64 duration;// The expected duration of the test case in nanoseconds
+    UINTN tolerance;// The tolerated slowdown in percent, 0 to use the default
+} EFITestBaseline;
+
 typedef struct _EFITestError {
-    EFITestUUID uuid;      // UUID for comparing errors
-    EFITestContext context;// Context captured in the moment of the error
-    const char* expression;// The code snippet which caused the error
-    UINTN line_number;     // The line number the assertion failed on
+    EFITestUUID uuid;           // UUID for comparing errors
+    EFITestContext context;     // Context captured in the moment of the first failure
+    const char* expression;     // The code snippet which caused the error
+    UINTN line_number;          // The line number the assertion failed on
+    UINTN hit_count;            // The number of times the assertion failed in the current group
+    EFITestContext last_context;// Context captured in the moment of the last failure
 } EFITestError;
 
+typedef struct _EFITestFuzzInput {
+    const UINT8* data;// The contents of the corpus file, NULL if it is empty
+    UINTN size;       // The size of the corpus file in bytes
+} EFITestFuzzInput;
+
+typedef struct _EFITestCpuStats {
+    UINTN processor_number;// The number of the processor as reported by the MP services
+    UINTN iteration_count; // The number of times the processor called the function
+    UINT64 duration;       // The time from the synchronized start until the processor finished in nanoseconds
+} EFITestCpuStats;
+
+/*
+ * Called on every participating processor by efitest_parallel_for
+ * and efitest_run_on_all_cpus. The context is private to the processor,
+ * so assertions may be used like in tests.
+ */
+typedef void (*EFITestParallelFunction)(EFITestContext* context, UINTN index, void* data);
+
 /*
  * Intrinsic macro recognized by the discoverer, don't change!
  * This macro defines a static function that is guaranteed to
  * be inlined. This is so the compiler can inline its code into
  * the generated trampoline function to prevent symbol pollution.
+ * Any additional arguments are recorded as tags of the test.
+ */
+#define ETEST_DEFINE_TEST(n, ...) ETEST_INLINE static inline void n(EFITestContext* context)
+
+/*
+ * Intrinsic macro recognized by the discoverer, don't change!
+ * Defines a test which is run once for every entry of the given
+ * const array. The discoverer only emits a single trampoline and
+ * descriptor, the runtime iterates the cases and reports each one
+ * individually. The current entry is accessible via ETEST_PARAM.
+ */
+#define ETEST_DEFINE_PARAM_TEST(n, t, ...)                                                                             \
+    ETEST_INLINE static inline void n(EFITestContext* context, const __typeof__(*(t))* param)
+
+/*
+ * Intrinsic macro recognized by the discoverer, don't change!
+ * Defines a test which may wait for EFI events using ETEST_AWAIT_EVENT,
+ * while the runner keeps running the other tests of its group. The body
+ * has to be enclosed in ETEST_ASYNC_BEGIN and ETEST_ASYNC_END. The test
+ * returns whenever it waits and continues after the await once it is
+ * resumed, so local variables don't survive waiting and have to be static.
+ */
+#define ETEST_DEFINE_ASYNC_TEST(n, ...) ETEST_INLINE static inline void n(EFITestContext* context)
+
+/*
+ * Intrinsic macro recognized by the discoverer, don't change!
+ * Defines a test which is called with arbitrary input of the given size.
+ * On the target it is replayed once for every file in corpus/<name> next
+ * to its source, or once with empty input if there is no corpus. On the
+ * host the discoverer also generates a libFuzzer entry point calling it.
+ */
+#define ETEST_DEFINE_FUZZ(n, d, s, ...)                                                                                \
+    ETEST_INLINE static inline void n(EFITestContext* context, const UINT8* d, UINTN s)
+
+// Asynchronous tests
+/**
+ * Begin the body of an asynchronous test.
+ */
+#define ETEST_ASYNC_BEGIN()                                                                                            \
+    switch(context->resume_point) {                                                                                    \
+        case 0:
+
+/**
+ * End the body of an asynchronous test.
+ */
+#define ETEST_ASYNC_END()                                                                                              \
+    default:                                                                                                           \
+        break;                                                                                                         \
+        }
+
+// Shared by the await macros, on_timeout runs after the timeout was reported
+#define ETEST_AWAIT_EVENT_IMPL(e, timeout, message, on_timeout)                                                        \
+    do {                                                                                                               \
+        efitest_async_wait(context, (e), (timeout));                                                                   \
+        context->resume_point = __LINE__;                                                                              \
+        return;                                                                                                        \
+        case __LINE__:                                                                                                 \
+            if(efitest_async_has_timed_out(context)) {                                                                 \
+                efitest_assert(FALSE, context, __LINE__ - 4, message);                                                 \
+                on_timeout                                                                                             \
+            }                                                                                                          \
+    } while(0)
+
+/**
+ * Wait until the given event is signaled, other tests are run in the
+ * meantime. The event is reset once the test continues, like with
+ * WaitForEvent. The test fails and returns when the timeout elapses first.
+ * Every await needs its own line, since the line identifies where to continue.
+ * May only be used between ETEST_ASYNC_BEGIN and ETEST_ASYNC_END.
+ * @param e The event to wait for, which must not be a notify-signal event.
+ * @param timeout The timeout in microseconds, 0 to wait forever.
+ */
+#define ETEST_AWAIT_EVENT(e, timeout)                                                                                  \
+    ETEST_AWAIT_EVENT_IMPL(e, timeout, "ETEST_AWAIT_EVENT(" #e ", " #timeout ") timed out", return;)
+
+/**
+ * Like ETEST_AWAIT_EVENT, but the test continues after the timeout was
+ * reported, so it can release the resources it waited on. Use ETEST_FAILED
+ * to tell whether the wait timed out.
+ * May only be used between ETEST_ASYNC_BEGIN and ETEST_ASYNC_END.
+ * @param e The event to wait for, which must not be a notify-signal event.
+ * @param timeout The timeout in microseconds, 0 to wait forever.
+ */
+#define ETEST_TRY_AWAIT_EVENT(e, timeout)                                                                              \
+    ETEST_AWAIT_EVENT_IMPL(e, timeout, "ETEST_TRY_AWAIT_EVENT(" #e ", " #timeout ") timed out", )
+
+/**
+ * Let the other tests run for at least the given time.
+ * May only be used between ETEST_ASYNC_BEGIN and ETEST_ASYNC_END.
+ * @param us The time to wait in microseconds, 0 to only yield.
  */
-#define ETEST_DEFINE_TEST(n) ETEST_INLINE static inline void n(EFITestContext* context)
+#define ETEST_SLEEP(us) ETEST_AWAIT_EVENT(NULL, us)
+
+// Parallel tests
+/**
+ * Call the given function for every index from 0 to n - 1, spread across
+ * all processors. See efitest_parallel_for for more information.
+ * @param n The number of indices.
+ * @param f The EFITestParallelFunction to call.
+ * @param d A pointer passed to every call of the function.
+ */
+#define ETEST_PARALLEL_FOR(n, f, d) efitest_parallel_for(context, (n), (f), (d))
+
+/**
+ * Call the given function once on every processor.
+ * See efitest_run_on_all_cpus for more information.
+ * @param f The EFITestParallelFunction to call.
+ * @param d A pointer passed to every call of the function.
+ */
+#define ETEST_RUN_ON_ALL_CPUS(f, d) efitest_run_on_all_cpus(context, (f), (d))
 
 // Assertions
 /**
@@ -103,6 +273,29 @@ typedef struct _EFITestError {
  */
 #define ETEST_ASSERT_GE(a, b) ETEST_ASSERT(a >= b)
 
+/**
+ * Assert that the given memory regions are equal. On mismatch,
+ * the first differing offset, the number of differing bytes and
+ * a hex dump around the first difference are logged.
+ * @param a A pointer to the actual memory.
+ * @param b A pointer to the expected memory.
+ * @param size The number of bytes to compare.
+ */
+#define ETEST_ASSERT_MEM_EQ(a, b, size)                                                                                \
+    efitest_assert_mem_eq((a), (b), (size), context, __LINE__ - 4, "ETEST_ASSERT_MEM_EQ(" #a ", " #b ", " #size ")")
+
+/**
+ * Assert that every byte of the given memory region has the given value,
+ * for example after filling a buffer. Mismatches are reported like
+ * with ETEST_ASSERT_MEM_EQ.
+ * @param a A pointer to the memory to check.
+ * @param value The expected value of every byte.
+ * @param size The number of bytes to check.
+ */
+#define ETEST_ASSERT_MEM_FILLED(a, value, size)                                                                        \
+    efitest_assert_mem_filled((a), (value), (size), context, __LINE__ - 4,                                             \
+                              "ETEST_ASSERT_MEM_FILLED(" #a ", " #value ", " #size ")")
+
 /**
  * Expands to the current unit test name.
  * May only be used within a EFITEST test definitions.
@@ -153,10 +346,56 @@ typedef struct _EFITestError {
  */
 #define ETEST_FAILED (context->failed)
 
+/**
+ * Expands to the table entry the current parameterized test is run with.
+ * May only be used within a EFITEST parameterized test definitions.
+ */
+#define ETEST_PARAM (*param)
+
+/**
+ * Expands to the index of the table entry the current
+ * parameterized test is run with.
+ * May only be used within a EFITEST test definitions.
+ */
+#define ETEST_PARAM_INDEX (context->param_index)
+
+#ifdef ETEST_ENABLE_PROFILING
+/**
+ * Record the time until the end of the enclosing scope as a zone
+ * in the profile of the current test. Zones may be nested and are
+ * reported as a call tree after every test or group.
+ * Compiles to nothing unless ETEST_ENABLE_PROFILING is defined.
+ * @param n A string literal naming the zone.
+ */
+#define ETEST_PROFILE_SCOPE(n)                                                                                         \
+    __attribute__((cleanup(efitest_profile_end_scope), unused)) const char* ETEST_CONCAT(__etest_zone_, __LINE__) =    \
+            efitest_profile_begin(n)
+
+/**
+ * Open a zone in the profile of the current test, which
+ * has to be closed again using ETEST_PROFILE_END.
+ * Compiles to nothing unless ETEST_ENABLE_PROFILING is defined.
+ * @param n A string literal naming the zone.
+ */
+#define ETEST_PROFILE_BEGIN(n) efitest_profile_begin(n)
+
+/**
+ * Close the zone most recently opened using ETEST_PROFILE_BEGIN.
+ * Compiles to nothing unless ETEST_ENABLE_PROFILING is defined.
+ */
+#define ETEST_PROFILE_END() efitest_profile_end()
+#else
+#define ETEST_PROFILE_SCOPE(n)
+#define ETEST_PROFILE_BEGIN(n) ((void) 0)
+#define ETEST_PROFILE_END() ((void) 0)
+#endif
+
 #define ETEST_UUID_LENGTH 36
 #define ETEST_SPACER "[------]"
 #define ETEST_SPACER_OK "[--OK--]"
 #define ETEST_SPACER_FAILED "[FAILED]"
+#define ETEST_SPACER_LEAK "[-LEAK-]"
+#define ETEST_SPACER_SLOWER "[SLOWER]"
 
 ETEST_API_BEGIN
 
@@ -231,6 +470,55 @@ void efitest_log(const UINT16* message);
  */
 void efitest_logln(const UINT16* message);
 
+/**
+ * Print a formatted string to the UEFI serial console.
+ * @param format The narrow format of the string to print. GNU-EFU PrintLib spec applies.
+ * @param args A va_list of formatting parameters.
+ */
+void efitest_logfa_v(const char* format, va_list args);
+
+/**
+ * Print a formatted string to the UEFI serial console.
+ * @param format The narrow format of the string to print. GNU-EFU PrintLib spec applies.
+ * @param ... A variable number of formatting parameters (at least 1).
+ */
+void efitest_logfa(const char* format, ...);
+
+/**
+ * Print a formatted string to the UEFI serial console and jump to a new line.
+ * @param format The narrow format of the string to print. GNU-EFU PrintLib spec applies.
+ * @param args A va_list of formatting parameters.
+ */
+void efitest_loglnfa_v(const char* format, va_list args);
+
+/**
+ * Print a formatted string to the UEFI serial console and jump to a new line.
+ * @param format The narrow format of the string to print. GNU-EFU PrintLib spec applies.
+ * @param ... A variable number of formatting parameters (at least 1).
+ */
+void efitest_loglnfa(const char* format, ...);
+
+/**
+ * Print a narrow string to the UEFI serial console.
+ * @param message A null-terminated string to print.
+ */
+void efitest_loga(const char* message);
+
+/**
+ * Print a narrow string to the UEFI serial console and jump to a new line.
+ * @param message A null-terminated string to print.
+ */
+void efitest_loglna(const char* message);
+
+/**
+ * Compute the stable ID of the current test case. This is the ID
+ * of the test itself for regular tests and an ID derived from the
+ * test ID and the parameter index for parameterized tests.
+ * @param context The context of the current test.
+ * @return The stable ID of the current test case.
+ */
+UINT64 efitest_get_case_id(const EFITestContext* context);
+
 /**
  * Set a callback function to be called before running all unit tests.
  * @param callback A pointer to a callback function to be called
@@ -275,7 +563,8 @@ void efitest_set_post_test_callback(EFITestCallback callback);
 
 /**
  * Allocate a new entry in the global error list and copy the given
- * error into the newly created entry.
+ * error into the newly created entry. Failed assertions are aggregated
+ * per assertion site, so every entry may stand for more than one failure.
  * @param error A pointer to an error to be added to the global error list.
  */
 void efitest_errors_add(const EFITestError* error);
@@ -301,6 +590,12 @@ UINTN efitest_errors_get_count();
  */
 void efitest_errors_clear();
 
+/**
+ * Clear the global error list and free its memory, the list
+ * keeps its capacity when it is only cleared.
+ */
+void efitest_errors_free();
+
 /**
  * Compare the given errors using their UUIDs.
  * See efitest_uuid_compare for more information.
@@ -319,11 +614,73 @@ BOOLEAN efitest_errors_compare(const EFITestError* error1, const EFITestError* e
  */
 BOOLEAN efitest_errors_get_index(const EFITestError* error, UINTN* index);
 
+/**
+ * Call the given function for every index from 0 to count - 1, spread
+ * across the bootstrap processor and all enabled application processors.
+ * The processors are released at the same time once all of them are ready
+ * and keep taking the next index until none are left, so they really contend.
+ * Failed assertions are collected per processor and added to the test once
+ * all processors finished. Functions running on application processors must
+ * not log, allocate through the EFITEST allocator or call any boot services.
+ * Without the MP services, every index is run on the bootstrap processor.
+ * @param context The context of the current test.
+ * @param count The number of indices.
+ * @param function The function to call.
+ * @param data A pointer passed to every call of the function.
+ * @return The number of processors which took part.
+ */
+UINTN efitest_parallel_for(EFITestContext* context, UINTN count, EFITestParallelFunction function, void* data);
+
+/**
+ * Call the given function once on every processor, like efitest_parallel_for.
+ * The index passed to the function is unique per processor and ranges from
+ * 0 (the bootstrap processor) to the number of processors which took part.
+ * @param context The context of the current test.
+ * @param function The function to call.
+ * @param data A pointer passed to every call of the function.
+ * @return The number of processors which took part.
+ */
+UINTN efitest_run_on_all_cpus(EFITestContext* context, EFITestParallelFunction function, void* data);
+
+/**
+ * Spin until all processors running the current efitest_run_on_all_cpus
+ * call reached the barrier, which can be used to separate the phases of
+ * a concurrency test. Must not be used with efitest_parallel_for, since
+ * processors may finish their share at different times.
+ */
+void efitest_parallel_barrier();
+
+/**
+ * @return The number of processors which may take part in parallel calls,
+ *  which can be limited via --cpus=<count>.
+ */
+UINTN efitest_get_cpu_count();
+
+/**
+ * @param count A pointer to the number of entries in the returned list.
+ * @return The timing of every processor which took part in the last
+ *  parallel call, indexed like the processors of efitest_run_on_all_cpus.
+ */
+const EFITestCpuStats* efitest_parallel_get_stats(UINTN* count);
+
 /* INTERNAL FUNCTIONS USED BY INJECTED CODE AND MACROS */
 void efitest_assert(BOOLEAN condition, EFITestContext* context, UINTN line_number, const char* expression);
+void efitest_assert_failed(EFITestContext* context, UINTN line_number, const char* expression, UINTN hit_count);
+void efitest_assert_mem_eq(const void* actual, const void* expected, UINTN size, EFITestContext* context,
+                           UINTN line_number, const char* expression);
+void efitest_assert_mem_filled(const void* address, UINT8 value, UINTN size, EFITestContext* context,
+                               UINTN line_number, const char* expression);
 void efitest_on_pre_run_test(EFITestContext* context);
 void efitest_on_post_run_test(EFITestContext* context);
 void efitest_on_pre_run_group(EFITestContext* context);
 void efitest_on_post_run_group(EFITestContext* context);
+void efitest_run_group(EFITestContext* context, const EFITestGroup* group);
+void efitest_async_wait(EFITestContext* context, EFI_EVENT event, UINT64 timeout);
+BOOLEAN efitest_async_has_timed_out(const EFITestContext* context);
+void efitest_memory_on_alloc(UINTN size);
+void efitest_memory_on_free(UINTN size);
+const char* efitest_profile_begin(const char* name);
+void efitest_profile_end();
+void efitest_profile_end_scope(const char** name);
 
 ETEST_API_END
\ No newline at end of file
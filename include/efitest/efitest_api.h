@@ -19,6 +19,8 @@
 #pragma once
 
 #define ETEST_INLINE __attribute__((always_inline))
+#define ETEST_CONCAT_IMPL(a, b) a##b
+#define ETEST_CONCAT(a, b) ETEST_CONCAT_IMPL(a, b)
 
 #ifdef __cplusplus
 #define ETEST_API_BEGIN extern "C" {
@@ -35,6 +37,7 @@
 #define ETEST_FMT_UINTN "%u"
 #define ETEST_FMT_INTN "%d"
 #endif
+#define ETEST_FMT_UINT64 "%lu"
 
 ETEST_API_BEGIN
 
@@ -24,5 +24,9 @@
 ETEST_API_BEGIN
 
 void efitest_run_tests(EFITestContext* context);
+const EFITestGroup* efitest_get_groups(UINTN* count);
+const EFITestBaseline* efitest_get_baselines(UINTN* count);// Sorted by case ID
+UINTN efitest_get_shard_count();// The number of shards planned by the discoverer, 0 if there is no plan
+BOOLEAN efitest_is_resident_runner();// True for the image which loads test modules instead of containing tests
 
 ETEST_API_END
\ No newline at end of file
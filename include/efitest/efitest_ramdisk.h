@@ -0,0 +1,90 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * RAM-backed block devices for storage and filesystem tests.
+ * Disks are registered through EFI_RAM_DISK_PROTOCOL where the firmware
+ * provides it, otherwise EFITEST installs its own EFI_BLOCK_IO_PROTOCOL
+ * and EFI_BLOCK_IO2_PROTOCOL on a new handle. Emulated disks never modify
+ * their image, writes go to copies of the touched chunks, so resetting
+ * them only costs as much as was written since the last reset.
+ */
+
+#pragma once
+
+#include "efitest_api.h"
+
+ETEST_API_BEGIN
+
+#define ETEST_RAMDISK_BLOCK_SIZE 512            // The block size of disks registered through the firmware
+#define ETEST_RAMDISK_RESET_BETWEEN_TESTS 0x1   // Restore the initial contents before every test
+#define ETEST_RAMDISK_READ_ONLY 0x2             // Reject writes with EFI_WRITE_PROTECTED, implies emulation
+#define ETEST_RAMDISK_EMULATED 0x4              // Never use EFI_RAM_DISK_PROTOCOL
+
+typedef struct _EFITestRamDisk EFITestRamDisk;
+
+/**
+ * Create a zero-filled RAM disk and connect the drivers to it.
+ * @param size The size of the disk in bytes, has to be a multiple of the block size.
+ * @param block_size The size of a block in bytes, disks whose block size isn't
+ *  ETEST_RAMDISK_BLOCK_SIZE are always emulated.
+ * @param flags A combination of ETEST_RAMDISK_* flags.
+ * @return The new disk, or NULL if it couldn't be created.
+ */
+EFITestRamDisk* efitest_ramdisk_create(UINT64 size, UINT32 block_size, UINT32 flags);
+
+/**
+ * Create a RAM disk with the contents of the given image and connect the drivers to it,
+ * so a disk containing a FAT image also provides EFI_SIMPLE_FILE_SYSTEM_PROTOCOL.
+ * @param image The initial contents of the disk. Emulated disks keep referencing
+ *  it, so it has to stay valid until the disk is destroyed.
+ * @param size The size of the image in bytes, has to be a multiple of the block size.
+ * @param block_size The size of a block in bytes.
+ * @param flags A combination of ETEST_RAMDISK_* flags.
+ * @return The new disk, or NULL if it couldn't be created.
+ */
+EFITestRamDisk* efitest_ramdisk_create_from_image(const void* image, UINT64 size, UINT32 block_size, UINT32 flags);
+
+/**
+ * Restore the initial contents of the given disk. If anything was written,
+ * the block I/O protocol is reinstalled so drivers drop their cached state.
+ * @param disk The disk to reset.
+ */
+void efitest_ramdisk_reset(EFITestRamDisk* disk);
+
+/**
+ * Disconnect the drivers from the given disk, remove it and free its memory.
+ * @param disk The disk to destroy, may be NULL.
+ */
+void efitest_ramdisk_destroy(EFITestRamDisk* disk);
+
+/**
+ * @param disk The disk to query.
+ * @return The handle the block I/O protocols of the disk are installed on.
+ */
+EFI_HANDLE efitest_ramdisk_get_handle(const EFITestRamDisk* disk);
+
+/**
+ * @param disk The disk to query.
+ * @return The block I/O protocol of the disk.
+ */
+EFI_BLOCK_IO* efitest_ramdisk_get_block_io(const EFITestRamDisk* disk);
+
+/**
+ * @param disk The disk to query.
+ * @return True if EFITEST implements the block I/O protocols of the disk,
+ *  false if it was registered through EFI_RAM_DISK_PROTOCOL.
+ */
+BOOLEAN efitest_ramdisk_is_emulated(const EFITestRamDisk* disk);
+
+ETEST_API_END
@@ -56,8 +56,9 @@ static inline void set_colors(UINTN colors) {
 static inline void* malloc_impl(UINTN size) {
     void* address = NULL;
     RETURN_IF_ERROR(UEFI_CALL(ST->BootServices->AllocatePool, EfiLoaderData, size + sizeof(UINTN), &address), NULL);
-    memset(address, 0, size);
+    memset(address, 0, size + sizeof(UINTN));
     *((UINTN*) address) = size;
+    efitest_memory_on_alloc(size);
     return ((UINT8*) address) + sizeof(UINTN);
 }
 
@@ -65,17 +66,17 @@ static inline void free_impl(void* address) {
     if(address == NULL) {
         return;
     }
+    efitest_memory_on_free(usable_size(address));
     UEFI_CALL(ST->BootServices->FreePool, ((UINT8*) address) - sizeof(UINTN));
 }
 
 static inline void* realloc_impl(void* address, UINTN size) {
+    if(address != NULL && size <= usable_size(address)) {
+        return address;
+    }
     void* new_address = malloc(size);
     if(address != NULL) {
-        const UINTN old_size = usable_size(address);
-        if(size <= old_size) {
-            return address;
-        }
-        memcpy(new_address, address, old_size);
+        memcpy(new_address, address, usable_size(address));
         free(address);
     }
     return new_address;
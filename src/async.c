@@ -0,0 +1,278 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "async.h"
+#include "baselines.h"
+#include "capture.h"
+#include "efitest/efitest_utils.h"
+#include "memory.h"
+#include "options.h"
+#include "profile.h"
+#include "timer.h"
+#include "trace.h"
+
+typedef struct _AsyncTest {
+    EFITestContext context;        // Every waiting test needs its own context
+    const EFITestDescriptor* test; // NULL if the slot is free
+    EFI_EVENT event;               // The event the test waits for, NULL when it only sleeps
+    UINT64 start_time;             // The cycle count the test was started at
+    UINT64 deadline;               // The cycle count at which the wait ends, 0 without a timeout
+    CaptureState capture;          // The output of the test while it waits
+    ProfileState profile;          // The profiling events of the test while it waits
+    BOOLEAN is_waiting;            // Set by efitest_async_wait during a step
+    BOOLEAN has_timed_out;
+} AsyncTest;
+
+// NOLINTBEGIN
+static AsyncTest* g_tests = NULL;
+static EFI_EVENT* g_events = NULL;// Scratch array passed to WaitForEvent, one more than the limit for the timer
+static AsyncTest** g_event_tests = NULL;
+static UINTN g_limit = 0;
+static UINTN g_running_count = 0;
+static AsyncTest* g_current = NULL;// The test whose step is currently running
+static EFI_EVENT g_timer_event = NULL;
+// NOLINTEND
+
+void async_init() {
+    g_limit = options_get_uintn("async-limit", ASYNC_DEFAULT_LIMIT);
+    if(g_limit == 0) {
+        g_limit = 1;
+    }
+    g_tests = malloc(g_limit * sizeof(AsyncTest));
+    g_events = malloc((g_limit + 1) * sizeof(EFI_EVENT));
+    g_event_tests = malloc(g_limit * sizeof(AsyncTest*));
+    if(g_tests == NULL || g_events == NULL || g_event_tests == NULL) {
+        async_free();// Asynchronous tests fail right away instead
+        g_limit = 0;
+        return;
+    }
+    const EFI_STATUS status = UEFI_CALL(ST->BootServices->CreateEvent, EVT_TIMER, 0, NULL, NULL, &g_timer_event);
+    if(EFI_ERROR(status)) {
+        g_timer_event = NULL;// Deadlines are still checked, just not woken up for
+    }
+}
+
+void async_free() {
+    if(g_timer_event != NULL) {
+        UEFI_CALL(ST->BootServices->CloseEvent, g_timer_event);
+        g_timer_event = NULL;
+    }
+    free(g_event_tests);
+    free(g_events);
+    free(g_tests);
+    g_event_tests = NULL;
+    g_events = NULL;
+    g_tests = NULL;
+}
+
+/*
+ * Finish the bookkeeping of a test which returned without waiting,
+ * its duration includes the time spent waiting.
+ */
+static void finish_test(AsyncTest* test) {
+    EFITestContext* context = &(test->context);
+    context->duration = timer_cycles_to_ns(timer_get_cycles() - test->start_time);
+    if(memory_has_leaked(&(context->memory))) {
+        context->failed = TRUE;
+    }
+    baselines_check(context);
+    capture_end_test(context);
+    efitest_on_post_run_test(context);
+    capture_free_state(&(test->capture));
+    profile_free_state(&(test->profile));
+    test->test = NULL;
+    --g_running_count;
+}
+
+/*
+ * Capturing and profiling span all steps of a test, while a test waits
+ * its output and events are moved aside so other tests don't mix with it.
+ */
+static void run_step(AsyncTest* test, BOOLEAN is_first) {
+    EFITestContext* context = &(test->context);
+    trace_begin(TRACE_CATEGORY_TEST, context->test_name, TRACE_NO_INDEX);
+    if(is_first) {
+        efitest_on_pre_run_test(context);
+        test->start_time = timer_get_cycles();
+        capture_begin_test(context);
+        profile_begin_test();
+    }
+    else {
+        capture_resume_test(context, &(test->capture));
+        profile_resume_test(&(test->profile));
+    }
+    memory_begin_step(&(context->memory));
+
+    test->is_waiting = FALSE;
+    g_current = test;
+    test->test->function(context);
+    g_current = NULL;
+
+    memory_end_step(&(context->memory));
+    if(test->is_waiting) {
+        profile_suspend_test(&(test->profile));
+        capture_suspend_test(&(test->capture));
+    }
+    else {
+        profile_end_test();
+        finish_test(test);
+    }
+    trace_end();
+}
+
+static BOOLEAN is_ready(AsyncTest* test, UINT64 now) {
+    if(test->event != NULL && UEFI_CALL(ST->BootServices->CheckEvent, test->event) == EFI_SUCCESS) {
+        return TRUE;
+    }
+    if(test->deadline == 0) {
+        return test->event == NULL;// Tests only yielding are continued right away
+    }
+    if(now < test->deadline) {
+        return FALSE;
+    }
+    test->has_timed_out = test->event != NULL;// Sleeping tests simply continue
+    return TRUE;
+}
+
+static UINTN resume_ready() {
+    UINTN resumed_count = 0;
+    for(UINTN index = 0; index < g_limit; ++index) {
+        AsyncTest* test = &(g_tests[index]);
+        if(test->test != NULL && is_ready(test, timer_get_cycles())) {
+            run_step(test, FALSE);
+            ++resumed_count;
+        }
+    }
+    return resumed_count;
+}
+
+/*
+ * Block until the event of any waiting test is signaled or the nearest
+ * deadline is reached, using the timer event to wake up for deadlines.
+ */
+static void wait_for_any() {
+    UINTN event_count = 0;
+    UINT64 deadline = 0;
+    for(UINTN index = 0; index < g_limit; ++index) {
+        AsyncTest* test = &(g_tests[index]);
+        if(test->test == NULL) {
+            continue;
+        }
+        if(test->event == NULL && test->deadline == 0) {
+            return;// A yielding test can be continued right away
+        }
+        if(test->event != NULL) {
+            g_event_tests[event_count] = test;
+            g_events[event_count++] = test->event;
+        }
+        if(test->deadline != 0 && (deadline == 0 || test->deadline < deadline)) {
+            deadline = test->deadline;
+        }
+    }
+
+    UINTN timer_index = event_count;
+    if(deadline != 0) {
+        const UINT64 now = timer_get_cycles();
+        if(deadline <= now || g_timer_event == NULL) {
+            return;// Polling takes care of elapsed deadlines
+        }
+        const UINT64 delay = ((deadline - now) * 10) / timer_get_cycles_per_us();// In 100ns units
+        UEFI_CALL(ST->BootServices->SetTimer, g_timer_event, TimerRelative, delay > 0 ? delay : 1);
+        g_events[event_count++] = g_timer_event;
+    }
+    if(event_count == 0) {
+        return;
+    }
+
+    UINTN index = 0;
+    const EFI_STATUS status = UEFI_CALL(ST->BootServices->WaitForEvent, event_count, g_events, &index);
+    if(deadline != 0) {
+        UEFI_CALL(ST->BootServices->SetTimer, g_timer_event, TimerCancel, 0);
+    }
+    // WaitForEvent resets the event it returns, so that test has to be continued here
+    if(!EFI_ERROR(status) && index < timer_index) {
+        run_step(g_event_tests[index], FALSE);
+    }
+}
+
+static void drive(UINTN target_count) {
+    while(g_running_count > target_count) {
+        if(resume_ready() == 0) {
+            wait_for_any();
+        }
+    }
+}
+
+void async_start(const EFITestContext* context, const EFITestDescriptor* test) {
+    if(g_limit == 0) {
+        EFITestContext failed_context = *context;
+        efitest_on_pre_run_test(&failed_context);
+        efitest_loglna("Could not allocate the slots for asynchronous tests");
+        failed_context.failed = TRUE;
+        efitest_on_post_run_test(&failed_context);
+        return;
+    }
+    if(g_running_count == g_limit) {
+        drive(g_limit - 1);
+    }
+    AsyncTest* slot = NULL;
+    for(UINTN index = 0; index < g_limit && slot == NULL; ++index) {
+        if(g_tests[index].test == NULL) {
+            slot = &(g_tests[index]);
+        }
+    }
+    SetMem(slot, sizeof(AsyncTest), 0);
+    slot->context = *context;
+    slot->context.resume_point = 0;
+    slot->test = test;
+    ++g_running_count;
+    run_step(slot, TRUE);
+}
+
+void async_poll() {
+    if(g_running_count > 0) {
+        resume_ready();
+    }
+}
+
+void async_finish() {
+    drive(0);
+}
+
+BOOLEAN async_has_waiting_tests() {
+    if(g_running_count == 0) {
+        return FALSE;
+    }
+    for(UINTN index = 0; index < g_limit; ++index) {
+        if(g_tests[index].test != NULL && g_tests[index].is_waiting) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void efitest_async_wait(EFITestContext* context, EFI_EVENT event, UINT64 timeout) {
+    if(g_current == NULL || &(g_current->context) != context) {
+        efitest_loglna("ETEST_AWAIT_EVENT and ETEST_SLEEP may only be used in asynchronous tests");
+        context->failed = TRUE;
+        return;
+    }
+    g_current->event = event;
+    g_current->deadline = timeout > 0 ? timer_get_cycles() + (timeout * timer_get_cycles_per_us()) : 0;
+    g_current->has_timed_out = FALSE;
+    g_current->is_waiting = TRUE;
+}
+
+BOOLEAN efitest_async_has_timed_out(const EFITestContext* context) {
+    return g_current != NULL && g_current->has_timed_out;
+}
@@ -0,0 +1,59 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Runs asynchronous tests interleaved with the other tests of their group.
+ * Tests return from their function whenever they wait for an event and are
+ * called again once it was signaled or their timeout elapsed, so a group
+ * of tests waiting for hardware takes about as long as its longest wait.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define ASYNC_DEFAULT_LIMIT 16// The number of asynchronous tests which may wait at the same time
+
+/**
+ * Allocate the slots for waiting tests, their number
+ * can be changed via --async-limit=<count>.
+ */
+void async_init();
+
+/**
+ * Free the slots and the timer event used for timeouts.
+ */
+void async_free();
+
+/**
+ * Run the given asynchronous test case until it waits for the first time.
+ * Blocks until another test finishes if all slots are in use.
+ * @param context The context prepared for the test case, which is copied.
+ * @param test The descriptor of the test.
+ */
+void async_start(const EFITestContext* context, const EFITestDescriptor* test);
+
+/**
+ * Continue all tests whose event was signaled or whose timeout elapsed, without blocking.
+ */
+void async_poll();
+
+/**
+ * Block until all waiting tests have finished, has to be called before the group is reported.
+ */
+void async_finish();
+
+/**
+ * @return True if any asynchronous test is waiting for an event or its timeout.
+ */
+BOOLEAN async_has_waiting_tests();
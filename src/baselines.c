@@ -0,0 +1,288 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "baselines.h"
+#include "buffer.h"
+#include "efitest/efitest_init.h"
+#include "efitest/efitest_utils.h"
+#include "file.h"
+#include "options.h"
+#include "resident.h"
+
+#define MIN_SLOT_COUNT 64
+#define MAX_ITERATION_SAMPLES 16// The number of soak iterations whose medians are kept per case
+
+typedef struct _BaselineEntry {
+    UINT64 test_id;
+    UINT64 case_id;
+    const char* group_name;
+    const char* test_name;
+    UINTN tolerance;
+    UINT64 samples[MAX_ITERATION_SAMPLES];// The median of every iteration, the oldest ones are replaced
+    UINTN run_count;
+} BaselineEntry;
+
+// NOLINTBEGIN
+static BaselineEntry* g_entries = NULL;// In the order the cases were first measured
+static UINTN g_entry_count = 0;
+static UINTN g_entry_capacity = 0;
+static UINTN* g_slots = NULL;// Maps case IDs to the index of their entry plus one, 0 if the slot is free
+static UINTN g_slot_count = 0;// Always a power of two
+static Buffer g_merged_baselines = {0};// The baselines of all modules, only used by the resident runner
+static UINTN g_merged_count = 0;
+// NOLINTEND
+
+static const EFITestBaseline* find_baseline(UINT64 case_id) {
+    UINTN count = 0;
+    const EFITestBaseline* baselines = efitest_get_baselines(&count);
+    UINTN begin = 0;
+    UINTN end = count;
+    while(begin < end) {
+        const UINTN middle = begin + ((end - begin) >> 1);
+        if(baselines[middle].case_id == case_id) {
+            return &(baselines[middle]);
+        }
+        if(baselines[middle].case_id < case_id) {
+            begin = middle + 1;
+        }
+        else {
+            end = middle;
+        }
+    }
+    return NULL;
+}
+
+static UINTN get_tolerance(const EFITestBaseline* baseline) {
+    if(baseline != NULL && baseline->tolerance > 0) {
+        return baseline->tolerance;
+    }
+    return options_get_uintn("baseline-tolerance", BASELINES_DEFAULT_TOLERANCE);
+}
+
+// Case IDs are hashes already, so their low bits are used as they are
+static UINTN find_slot(UINT64 case_id) {
+    UINTN slot = (UINTN) case_id & (g_slot_count - 1);
+    while(g_slots[slot] != 0 && g_entries[g_slots[slot] - 1].case_id != case_id) {
+        slot = (slot + 1) & (g_slot_count - 1);
+    }
+    return slot;
+}
+
+// Keeps the table at most half full, so probe sequences stay short
+static BOOLEAN reserve_slots(UINTN entry_count) {
+    if((entry_count << 1) <= g_slot_count) {
+        return TRUE;
+    }
+    const UINTN slot_count = g_slot_count == 0 ? MIN_SLOT_COUNT : g_slot_count << 1;
+    UINTN* slots = malloc(slot_count * sizeof(UINTN));
+    if(slots == NULL) {
+        return FALSE;
+    }
+    free(g_slots);
+    g_slots = slots;
+    g_slot_count = slot_count;
+    for(UINTN index = 0; index < g_entry_count; ++index) {
+        g_slots[find_slot(g_entries[index].case_id)] = index + 1;
+    }
+    return TRUE;
+}
+
+static BaselineEntry* get_entry(UINT64 case_id) {
+    if(g_slot_count > 0) {
+        const UINTN slot = find_slot(case_id);
+        if(g_slots[slot] != 0) {
+            return &(g_entries[g_slots[slot] - 1]);
+        }
+    }
+    if(!reserve_slots(g_entry_count + 1)) {
+        return NULL;
+    }
+    if(g_entry_count == g_entry_capacity) {
+        const UINTN capacity = g_entry_capacity == 0 ? MIN_SLOT_COUNT : g_entry_capacity << 1;
+        BaselineEntry* entries = realloc(g_entries, capacity * sizeof(BaselineEntry));
+        if(entries == NULL) {
+            return NULL;
+        }
+        g_entries = entries;
+        g_entry_capacity = capacity;
+    }
+    BaselineEntry* entry = &(g_entries[g_entry_count]);
+    SetMem(entry, sizeof(BaselineEntry), 0);
+    entry->case_id = case_id;
+    g_slots[find_slot(case_id)] = ++g_entry_count;
+    return entry;
+}
+
+/*
+ * Cases measured more than once by soak runs keep a single entry,
+ * whose baseline is the median over the medians of all iterations.
+ */
+static void record_baseline(const EFITestContext* context, const EFITestBaseline* baseline) {
+    BaselineEntry* entry = get_entry(efitest_get_case_id(context));
+    if(entry == NULL) {
+        return;
+    }
+    entry->test_id = context->test_id;
+    entry->group_name = context->group_name;
+    entry->test_name = context->test_name;
+    entry->tolerance = get_tolerance(baseline);
+    entry->samples[entry->run_count++ % MAX_ITERATION_SAMPLES] = context->duration;
+}
+
+static void append_entries(Buffer* buffer) {
+    UINT64 samples[MAX_ITERATION_SAMPLES];
+    for(UINTN index = 0; index < g_entry_count; ++index) {
+        const BaselineEntry* entry = &(g_entries[index]);
+        const UINTN sample_count = entry->run_count < MAX_ITERATION_SAMPLES ? entry->run_count : MAX_ITERATION_SAMPLES;
+        CopyMem(samples, entry->samples, sample_count * sizeof(UINT64));
+        buffer_append(buffer, index == 0 ? "\n    {\"id\": \"" : ",\n    {\"id\": \"");
+        buffer_append_hex64(buffer, entry->test_id);
+        buffer_append(buffer, "\", \"case_id\": \"");
+        buffer_append_hex64(buffer, entry->case_id);
+        buffer_append(buffer, "\", \"name\": \"");
+        buffer_append_escaped(buffer, entry->group_name);
+        buffer_append(buffer, ".");
+        buffer_append_escaped(buffer, entry->test_name);
+        buffer_append(buffer, "\", \"duration_ns\": ");
+        buffer_append_uint64(buffer, baselines_compute_median(samples, sample_count));
+        buffer_append(buffer, ", \"tolerance\": ");
+        buffer_append_uint64(buffer, entry->tolerance);
+        buffer_append(buffer, "}");
+    }
+}
+
+BOOLEAN baselines_is_measured(UINT64 case_id) {
+    return options_has("update-baselines") || find_baseline(case_id) != NULL;
+}
+
+UINTN baselines_get_run_count() {
+    const UINTN count = options_get_uintn("baseline-runs", BASELINES_DEFAULT_RUNS);
+    if(count > BASELINES_MAX_RUNS) {
+        return BASELINES_MAX_RUNS;
+    }
+    return count > 0 ? count : 1;
+}
+
+/*
+ * Insertion sort is plenty for the handful of samples we take,
+ * the median is used since it ignores outliers like SMIs.
+ */
+UINT64 baselines_compute_median(UINT64* samples, UINTN count) {
+    for(UINTN index = 1; index < count; ++index) {
+        const UINT64 value = samples[index];
+        UINTN position = index;
+        while(position > 0 && samples[position - 1] > value) {
+            samples[position] = samples[position - 1];
+            --position;
+        }
+        samples[position] = value;
+    }
+    if((count & 1) == 0) {
+        return (samples[(count >> 1) - 1] + samples[count >> 1]) >> 1;
+    }
+    return samples[count >> 1];
+}
+
+void baselines_check(EFITestContext* context) {
+    const EFITestBaseline* baseline = find_baseline(efitest_get_case_id(context));
+    if(options_has("update-baselines") && !context->failed) {
+        record_baseline(context, baseline);
+    }
+    if(baseline == NULL || context->failed) {
+        return;
+    }
+    const UINT64 limit = baseline->duration + ((baseline->duration * get_tolerance(baseline)) / 100);
+    if(context->duration > limit + BASELINES_MIN_SLACK) {
+        context->failed = TRUE;
+        context->slower = TRUE;
+    }
+}
+
+void baselines_print_report(const EFITestContext* context) {
+    if(!context->slower) {
+        return;
+    }
+    const EFITestBaseline* baseline = find_baseline(efitest_get_case_id(context));
+    if(baseline == NULL) {
+        return;
+    }
+    set_colors(EFI_YELLOW);
+    Print(ETEST_SPACER_SLOWER L" ", NULL);
+    reset_colors();
+    Print(L"Median of " ETEST_FMT_UINTN L" runs took " ETEST_FMT_UINT64 L"us, baseline is " ETEST_FMT_UINT64
+          L"us +" ETEST_FMT_UINTN L"%%\n",
+          baselines_get_run_count(), context->duration / 1000, baseline->duration / 1000, get_tolerance(baseline));
+}
+
+void baselines_store() {
+    const char* path = options_get("update-baselines");
+    if(path == NULL) {
+        return;
+    }
+    if(*path == '\0') {
+        path = BASELINES_DEFAULT_PATH;
+    }
+    if(resident_is_module()) {
+        Buffer records = {0};
+        append_entries(&records);
+        resident_submit(RESIDENT_RECORD_BASELINES, records.data, records.length, g_entry_count);
+        buffer_free(&records);
+        return;
+    }
+
+    Buffer document = {0};
+    buffer_append(&document, "{\n  \"version\": 1,\n  \"baselines\": [");
+    append_entries(&document);
+    if(g_merged_count > 0) {
+        if(g_entry_count > 0) {
+            buffer_append(&document, ",");
+        }
+        buffer_append(&document, g_merged_baselines.data);
+    }
+    buffer_append(&document, "\n  ]\n}\n");
+
+    const EFI_STATUS status = file_write(path, document.data, document.length);
+    if(status == EFI_SUCCESS) {
+        Print(ETEST_SPACER L" Wrote " ETEST_FMT_UINTN L" baselines to %a\n\n", g_entry_count + g_merged_count,
+              path);
+    }
+    else {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Could not write baselines to %a: %r\n\n", path, status);
+        reset_colors();
+    }
+    buffer_free(&document);
+}
+
+void baselines_merge(const char* records, UINTN count) {
+    if(count == 0) {
+        return;
+    }
+    if(g_merged_count > 0) {
+        buffer_append(&g_merged_baselines, ",");
+    }
+    buffer_append(&g_merged_baselines, records);
+    g_merged_count += count;
+}
+
+void baselines_free() {
+    free(g_entries);
+    free(g_slots);
+    g_entries = NULL;
+    g_slots = NULL;
+    g_entry_count = 0;
+    g_entry_capacity = 0;
+    g_slot_count = 0;
+    buffer_free(&g_merged_baselines);
+    g_merged_count = 0;
+}
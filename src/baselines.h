@@ -0,0 +1,84 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Compares the durations of test cases against the baselines baked
+ * into the test image by the discoverer and collects updated
+ * baselines when running with --update-baselines.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define BASELINES_DEFAULT_PATH "\\efitest-baselines.json"
+#define BASELINES_DEFAULT_RUNS 5
+#define BASELINES_MAX_RUNS 64
+#define BASELINES_DEFAULT_TOLERANCE 10// Percent
+#define BASELINES_MIN_SLACK 1000      // Nanoseconds, keeps timer jitter of very short tests from failing them
+
+/**
+ * @param case_id The ID of the test case to check.
+ * @return True if the given test case should be run repeatedly
+ *  to measure its median duration, since it either has a baseline
+ *  or baselines are being updated.
+ */
+BOOLEAN baselines_is_measured(UINT64 case_id);
+
+/**
+ * @return The number of times measured test cases are run, passed via --baseline-runs
+ *  and limited to BASELINES_MAX_RUNS.
+ */
+UINTN baselines_get_run_count();
+
+/**
+ * Compute the median of the given samples, the samples are sorted in place.
+ * @param samples The samples to compute the median of.
+ * @param count The number of samples.
+ * @return The median of the given samples.
+ */
+UINT64 baselines_compute_median(UINT64* samples, UINTN count);
+
+/**
+ * Compare the duration of the test case described by the given
+ * context against its baseline and mark it as failed if it was
+ * slower than tolerated. Also records the duration as a new
+ * baseline when running with --update-baselines.
+ * @param context The context of the test case which just finished.
+ */
+void baselines_check(EFITestContext* context);
+
+/**
+ * Print how much slower than its baseline the given test case was.
+ * @param context The context of the test case which just finished.
+ */
+void baselines_print_report(const EFITestContext* context);
+
+/**
+ * Write the updated baselines to the path passed via --update-baselines,
+ * or BASELINES_DEFAULT_PATH if no path was given.
+ * Modules hand their baselines to the resident runner instead.
+ */
+void baselines_store();
+
+/**
+ * Add the updated baselines a module handed to the resident runner.
+ * @param records The comma-separated JSON objects of the baselines.
+ * @param count The number of baselines.
+ */
+void baselines_merge(const char* records, UINTN count);
+
+/**
+ * Free all memory associated with the updated baselines.
+ */
+void baselines_free();
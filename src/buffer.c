@@ -0,0 +1,88 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffer.h"
+#include "efitest/efitest_utils.h"
+
+#define MIN_BUFFER_CAPACITY 256
+
+static void reserve(Buffer* buffer, UINTN size) {
+    if(buffer->length + size < buffer->capacity) {
+        return;
+    }
+    UINTN capacity = buffer->capacity < MIN_BUFFER_CAPACITY ? MIN_BUFFER_CAPACITY : buffer->capacity;
+    while(buffer->length + size >= capacity) {
+        capacity <<= 1;
+    }
+    buffer->data = realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+static void append_char(Buffer* buffer, char value) {
+    reserve(buffer, 1);
+    buffer->data[buffer->length++] = value;
+    buffer->data[buffer->length] = '\0';
+}
+
+void buffer_append_data(Buffer* buffer, const void* data, UINTN size) {
+    reserve(buffer, size);
+    memcpy(buffer->data + buffer->length, data, size);
+    buffer->length += size;
+    buffer->data[buffer->length] = '\0';
+}
+
+void buffer_append(Buffer* buffer, const char* value) {
+    while(*value != '\0') {
+        append_char(buffer, *(value++));
+    }
+}
+
+void buffer_append_escaped(Buffer* buffer, const char* value) {
+    for(; *value != '\0'; ++value) {
+        switch(*value) {
+            case '"': buffer_append(buffer, "\\\""); break;
+            case '\\': buffer_append(buffer, "\\\\"); break;
+            case '\n': buffer_append(buffer, "\\n"); break;
+            case '\t': buffer_append(buffer, "\\t"); break;
+            default:
+                if((UINT8) *value >= ' ') {
+                    append_char(buffer, *value);
+                }
+                break;
+        }
+    }
+}
+
+void buffer_append_uint64(Buffer* buffer, UINT64 value) {
+    char digits[21];
+    UINTN index = sizeof(digits) - 1;
+    digits[index] = '\0';
+    do {
+        digits[--index] = (char) ('0' + (value % 10));
+        value /= 10;
+    } while(value != 0);
+    buffer_append(buffer, &(digits[index]));
+}
+
+void buffer_append_hex64(Buffer* buffer, UINT64 value) {
+    for(INTN shift = 60; shift >= 0; shift -= 4) {
+        append_char(buffer, "0123456789abcdef"[(value >> shift) & 0xF]);
+    }
+}
+
+void buffer_free(Buffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
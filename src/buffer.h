@@ -0,0 +1,70 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * A growable narrow character buffer used to assemble
+ * text files like JSON reports before writing them out.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+typedef struct _Buffer {
+    char* data;    // The null-terminated contents of the buffer
+    UINTN length;  // The number of characters in the buffer
+    UINTN capacity;// The number of characters which fit into the buffer without growing it
+} Buffer;
+
+/**
+ * Append a null-terminated string to the given buffer.
+ * @param buffer The buffer to append to.
+ * @param value The string to append.
+ */
+void buffer_append(Buffer* buffer, const char* value);
+
+/**
+ * Append raw bytes to the given buffer.
+ * @param buffer The buffer to append to.
+ * @param data The data to append.
+ * @param size The number of bytes to append.
+ */
+void buffer_append_data(Buffer* buffer, const void* data, UINTN size);
+
+/**
+ * Append a null-terminated string to the given buffer, escaping
+ * quotes, backslashes and control characters for JSON strings.
+ * @param buffer The buffer to append to.
+ * @param value The string to append.
+ */
+void buffer_append_escaped(Buffer* buffer, const char* value);
+
+/**
+ * Append the decimal representation of the given value.
+ * @param buffer The buffer to append to.
+ * @param value The value to append.
+ */
+void buffer_append_uint64(Buffer* buffer, UINT64 value);
+
+/**
+ * Append the given value as 16 lowercase hex digits.
+ * @param buffer The buffer to append to.
+ * @param value The value to append.
+ */
+void buffer_append_hex64(Buffer* buffer, UINT64 value);
+
+/**
+ * Free the contents of the given buffer and reset it.
+ * @param buffer The buffer to free.
+ */
+void buffer_free(Buffer* buffer);
@@ -0,0 +1,223 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "capture.h"
+#include "efitest/efitest_utils.h"
+#include "memory.h"
+#include "options.h"
+
+#define MAX_HEADER_LENGTH 256
+#define CONSOLE_CHUNK_LENGTH 128
+
+// NOLINTBEGIN
+static Verbosity g_verbosity = VERBOSITY_ALL;
+static CHAR16* g_buffer = NULL;
+static UINTN g_length = 0;
+static UINTN g_capacity = 0;                  // Including the null-terminator
+static UINTN g_test_start = 0;                // The length of the buffer when the current test started
+static UINTN g_dropped_count = 0;             // The number of characters of failed tests which didn't fit
+static UINTN g_test_dropped_count = 0;        // The number of characters of the current test which didn't fit
+static BOOLEAN g_is_capturing = FALSE;
+static BOOLEAN g_has_header = FALSE;          // True if the name of the current test was written already
+static const EFITestContext* g_context = NULL;// The context of the test being captured
+// NOLINTEND
+
+static void append(const CHAR16* value) {
+    if(g_buffer == NULL) {
+        g_test_dropped_count += StrLen(value);
+        return;
+    }
+    while(*value != L'\0') {
+        if(g_length + 1 >= g_capacity) {
+            g_test_dropped_count += StrLen(value);
+            break;
+        }
+        g_buffer[g_length++] = *(value++);
+    }
+    g_buffer[g_length] = L'\0';
+}
+
+/*
+ * Write directly to the console instead of going through Print, which
+ * would format the message a second time. Line feeds are expanded to
+ * CRLF like Print does.
+ */
+static void write_console(const CHAR16* message) {
+    CHAR16 chunk[CONSOLE_CHUNK_LENGTH];
+    UINTN length = 0;
+    while(*message != L'\0') {
+        if(length >= CONSOLE_CHUNK_LENGTH - 2) {
+            chunk[length] = L'\0';
+            UEFI_CALL(ST->ConOut->OutputString, ST->ConOut, chunk);
+            length = 0;
+        }
+        if(*message == L'\n') {
+            chunk[length++] = L'\r';
+        }
+        chunk[length++] = *(message++);
+    }
+    if(length > 0) {
+        chunk[length] = L'\0';
+        UEFI_CALL(ST->ConOut->OutputString, ST->ConOut, chunk);
+    }
+}
+
+void capture_init() {
+    const char* value = options_get("verbosity");
+    if(value == NULL || *value == '\0' || strcmp(value, "all") == 0) {
+        g_verbosity = VERBOSITY_ALL;
+    }
+    else if(strcmp(value, "results") == 0) {
+        g_verbosity = VERBOSITY_RESULTS;
+    }
+    else if(strcmp(value, "failures") == 0) {
+        g_verbosity = VERBOSITY_FAILURES;
+    }
+    else {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Ignoring unknown verbosity '%a', expected failures, results or all\n\n", value);
+        reset_colors();
+        g_verbosity = VERBOSITY_ALL;
+    }
+    if(g_verbosity == VERBOSITY_ALL) {
+        return;
+    }
+    g_capacity = options_get_uintn("log-buffer", CAPTURE_DEFAULT_BUFFER_SIZE);
+    if(g_capacity == 0) {
+        return;// Output is still captured, but all of it is dropped
+    }
+    // Allocated up front so capturing never shows up in the memory statistics of a test
+    g_buffer = malloc(g_capacity * sizeof(CHAR16));
+    if(g_buffer == NULL) {
+        g_capacity = 0;
+    }
+}
+
+void capture_free() {
+    free(g_buffer);
+    g_buffer = NULL;
+    g_length = 0;
+    g_capacity = 0;
+}
+
+Verbosity capture_get_verbosity() {
+    return g_verbosity;
+}
+
+BOOLEAN capture_is_result_shown(const EFITestContext* context) {
+    return context->failed || g_verbosity >= VERBOSITY_RESULTS;
+}
+
+void capture_begin_group() {
+    g_length = 0;
+    g_dropped_count = 0;
+    if(g_buffer != NULL) {
+        g_buffer[0] = L'\0';
+    }
+}
+
+void capture_begin_test(const EFITestContext* context) {
+    if(g_verbosity == VERBOSITY_ALL) {
+        return;
+    }
+    g_test_start = g_length;
+    g_test_dropped_count = 0;
+    g_has_header = FALSE;
+    g_context = context;
+    g_is_capturing = TRUE;
+}
+
+void capture_end_test(const EFITestContext* context) {
+    if(!g_is_capturing) {
+        return;
+    }
+    g_is_capturing = FALSE;
+    g_context = NULL;
+    if(!context->failed) {
+        g_length = g_test_start;
+        if(g_buffer != NULL) {
+            g_buffer[g_length] = L'\0';
+        }
+        return;
+    }
+    g_dropped_count += g_test_dropped_count;
+}
+
+void capture_suspend_test(CaptureState* state) {
+    if(!g_is_capturing) {
+        return;
+    }
+    const BOOLEAN was_tracking = memory_suspend();
+    state->output.length = 0;
+    if(g_buffer != NULL) {
+        buffer_append_data(&(state->output), &(g_buffer[g_test_start]), (g_length - g_test_start + 1) * sizeof(CHAR16));
+        g_length = g_test_start;
+        g_buffer[g_length] = L'\0';
+    }
+    memory_resume(was_tracking);
+    state->dropped_count = g_test_dropped_count;
+    state->has_header = g_has_header;
+    g_is_capturing = FALSE;
+    g_context = NULL;
+}
+
+void capture_resume_test(const EFITestContext* context, CaptureState* state) {
+    capture_begin_test(context);
+    if(!g_is_capturing) {
+        return;
+    }
+    if(state->output.length > 0) {
+        append((const CHAR16*) state->output.data);// Includes the null-terminator
+        state->output.length = 0;
+    }
+    g_test_dropped_count += state->dropped_count;
+    g_has_header = state->has_header;
+}
+
+void capture_free_state(CaptureState* state) {
+    buffer_free(&(state->output));
+    SetMem(state, sizeof(CaptureState), 0);
+}
+
+void capture_write(const CHAR16* message) {
+    if(!g_is_capturing) {
+        write_console(message);
+        return;
+    }
+    if(!g_has_header) {
+        // The name is only written once the test logs something, so silent tests take no space
+        CHAR16 header[MAX_HEADER_LENGTH];
+        if(g_context->param_count > 0) {
+            SPrint(header, sizeof(header), L"Output of %a[" ETEST_FMT_UINTN L"]:\n", g_context->test_name,
+                   g_context->param_index);
+        }
+        else {
+            SPrint(header, sizeof(header), L"Output of %a:\n", g_context->test_name);
+        }
+        append(header);
+        g_has_header = TRUE;
+    }
+    append(message);
+}
+
+void capture_print_group_report() {
+    if(g_length > 0) {
+        Print(L"%s\n", g_buffer);
+    }
+    if(g_dropped_count > 0) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" " ETEST_FMT_UINTN L" characters of output didn't fit into the log buffer\n\n",
+              g_dropped_count);
+        reset_colors();
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Captures the log output of every test into a preallocated buffer
+ * while running with --verbosity=failures or --verbosity=results.
+ * The output of passing tests is discarded, the output of failing
+ * tests is replayed together with the error report of their group.
+ */
+
+#pragma once
+
+#include "buffer.h"
+#include "efitest/efitest.h"
+
+#define CAPTURE_DEFAULT_BUFFER_SIZE 16384// In characters
+
+typedef enum _Verbosity {
+    VERBOSITY_FAILURES,// Only failed tests are reported, log output is captured
+    VERBOSITY_RESULTS, // All tests are reported, log output is captured
+    VERBOSITY_ALL      // All tests are reported, log output is printed immediately
+} Verbosity;
+
+typedef struct _CaptureState {
+    Buffer output;      // The output captured so far, moved out of the shared buffer
+    UINTN dropped_count;// The number of characters which didn't fit so far
+    BOOLEAN has_header; // True if the name of the test was written already
+} CaptureState;
+
+/**
+ * Parse the --verbosity option and allocate the capture buffer, its
+ * size can be changed via --log-buffer=<characters>.
+ */
+void capture_init();
+
+/**
+ * Free the capture buffer.
+ */
+void capture_free();
+
+/**
+ * @return The verbosity selected via --verbosity, VERBOSITY_ALL by default.
+ */
+Verbosity capture_get_verbosity();
+
+/**
+ * @param context The context of the test which just finished.
+ * @return True if the result line of the given test should be printed.
+ */
+BOOLEAN capture_is_result_shown(const EFITestContext* context);
+
+/**
+ * Discard the captured output of the previous group.
+ */
+void capture_begin_group();
+
+/**
+ * Start capturing the output of the given test.
+ * @param context The context of the test which is about to run.
+ */
+void capture_begin_test(const EFITestContext* context);
+
+/**
+ * Stop capturing and discard the output of the given test unless it failed.
+ * @param context The context of the test which just finished.
+ */
+void capture_end_test(const EFITestContext* context);
+
+/**
+ * Pause capturing the current test while it waits, moving its output so
+ * far out of the shared buffer so other tests can be captured meanwhile.
+ * @param state The state to move the output of the test into.
+ */
+void capture_suspend_test(CaptureState* state);
+
+/**
+ * Continue capturing a test suspended by capture_suspend_test.
+ * @param context The context of the test which is resumed.
+ * @param state The state the test was suspended into, which is emptied.
+ */
+void capture_resume_test(const EFITestContext* context, CaptureState* state);
+
+/**
+ * Free the output held by the given state.
+ * @param state The state to free.
+ */
+void capture_free_state(CaptureState* state);
+
+/**
+ * Write the given message to the capture buffer while a test is
+ * being captured, otherwise print it immediately.
+ * @param message The null-terminated message to write.
+ */
+void capture_write(const CHAR16* message);
+
+/**
+ * Replay the captured output of all failed tests in the current group.
+ */
+void capture_print_group_report();
@@ -0,0 +1,166 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "compare.h"
+
+#define BLOCK_SIZE 16
+#define WINDOW_ROWS 3// Rows of BLOCK_SIZE bytes dumped around the first difference
+#define MAX_ROW_LENGTH 96
+
+typedef UINT8 Block __attribute__((vector_size(BLOCK_SIZE)));
+typedef INT8 BlockMask __attribute__((vector_size(BLOCK_SIZE)));
+typedef UINT64 BlockWords[BLOCK_SIZE / sizeof(UINT64)];
+
+static const char* g_hex_digits = "0123456789ABCDEF";// NOLINT
+
+static inline Block load_block(const UINT8* address) {
+    Block block;
+    __builtin_memcpy(&block, address, BLOCK_SIZE);// Unaligned load
+    return block;
+}
+
+/*
+ * Compare a whole block at once and only fall back to
+ * counting single bytes if the block actually differs.
+ */
+static inline UINTN count_block_mismatches(const UINT8* actual, Block expected, UINTN offset, UINTN* first_offset,
+                                           BOOLEAN* has_mismatch) {
+    const BlockMask equal = load_block(actual) == expected;
+    BlockWords words;
+    __builtin_memcpy(words, &equal, BLOCK_SIZE);
+    if((words[0] & words[1]) == ~(UINT64) 0) {
+        return 0;
+    }
+    UINTN count = 0;
+    for(UINTN index = 0; index < BLOCK_SIZE; ++index) {
+        if(equal[index] != 0) {
+            continue;
+        }
+        if(!*has_mismatch) {
+            *first_offset = offset + index;
+            *has_mismatch = TRUE;
+        }
+        ++count;
+    }
+    return count;
+}
+
+UINTN compare_memory(const UINT8* actual, const UINT8* expected, UINTN size, UINTN* first_offset) {
+    BOOLEAN has_mismatch = FALSE;
+    UINTN count = 0;
+    UINTN offset = 0;
+    for(; offset + BLOCK_SIZE <= size; offset += BLOCK_SIZE) {
+        count += count_block_mismatches(actual + offset, load_block(expected + offset), offset, first_offset,
+                                        &has_mismatch);
+    }
+    for(; offset < size; ++offset) {
+        if(actual[offset] == expected[offset]) {
+            continue;
+        }
+        if(!has_mismatch) {
+            *first_offset = offset;
+            has_mismatch = TRUE;
+        }
+        ++count;
+    }
+    return count;
+}
+
+UINTN compare_fill(const UINT8* actual, UINT8 value, UINTN size, UINTN* first_offset) {
+    Block pattern;
+    for(UINTN index = 0; index < BLOCK_SIZE; ++index) {
+        pattern[index] = value;
+    }
+    BOOLEAN has_mismatch = FALSE;
+    UINTN count = 0;
+    UINTN offset = 0;
+    for(; offset + BLOCK_SIZE <= size; offset += BLOCK_SIZE) {
+        count += count_block_mismatches(actual + offset, pattern, offset, first_offset, &has_mismatch);
+    }
+    for(; offset < size; ++offset) {
+        if(actual[offset] == value) {
+            continue;
+        }
+        if(!has_mismatch) {
+            *first_offset = offset;
+            has_mismatch = TRUE;
+        }
+        ++count;
+    }
+    return count;
+}
+
+static UINTN append_hex(char* row, UINTN length, UINTN value, UINTN digits) {
+    for(UINTN index = 0; index < digits; ++index) {
+        row[length + index] = g_hex_digits[(value >> ((digits - index - 1) << 2)) & 0xF];
+    }
+    return length + digits;
+}
+
+static UINTN append_label(char* row, UINTN length, const char* label) {
+    while(*label != '\0') {
+        row[length++] = *(label++);
+    }
+    return length;
+}
+
+void compare_print_window(const UINT8* actual, const UINT8* expected, UINT8 value, UINTN size, UINTN offset) {
+    const UINTN offset_digits = (UINT64) size > 0xFFFFFFFFULL ? 16 : 8;
+    const UINTN row_offset = offset & ~(UINTN) (BLOCK_SIZE - 1);
+    UINTN start = row_offset >= BLOCK_SIZE ? row_offset - BLOCK_SIZE : 0;
+    const UINTN end = start + (WINDOW_ROWS * BLOCK_SIZE) < size ? start + (WINDOW_ROWS * BLOCK_SIZE) : size;
+
+    char row[MAX_ROW_LENGTH];
+    for(; start < end; start += BLOCK_SIZE) {
+        const UINTN row_end = start + BLOCK_SIZE < end ? start + BLOCK_SIZE : end;
+
+        // Actual bytes prefixed with the offset of the row
+        UINTN length = append_hex(row, 0, start, offset_digits);
+        length = append_label(row, length, " actual  ");
+        for(UINTN index = start; index < row_end; ++index) {
+            row[length++] = ' ';
+            length = append_hex(row, length, actual[index], 2);
+        }
+        row[length] = '\0';
+        efitest_loglna(row);
+
+        // Expected bytes with the differing ones marked below
+        char markers[MAX_ROW_LENGTH];
+        length = 0;
+        for(UINTN index = 0; index < offset_digits; ++index) {
+            row[length++] = ' ';
+        }
+        length = append_label(row, length, " expected");
+        UINTN marker_length = length;
+        UINTN marker_end = 0;// Trailing spaces are cut off
+        SetMem(markers, marker_length, ' ');
+        for(UINTN index = start; index < row_end; ++index) {
+            const UINT8 expected_value = expected != NULL ? expected[index] : value;
+            row[length++] = ' ';
+            length = append_hex(row, length, expected_value, 2);
+            const char marker = actual[index] != expected_value ? '^' : ' ';
+            markers[marker_length++] = ' ';
+            markers[marker_length++] = marker;
+            markers[marker_length++] = marker;
+            if(marker == '^') {
+                marker_end = marker_length;
+            }
+        }
+        row[length] = '\0';
+        markers[marker_end] = '\0';
+        efitest_loglna(row);
+        if(marker_end > 0) {
+            efitest_loglna(markers);
+        }
+    }
+}
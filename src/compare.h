@@ -0,0 +1,53 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Block-wise memory comparison kernels for the memory assertions,
+ * written using vector extensions which the compiler lowers to SSE2
+ * on x86_64, NEON on ARM64 and word-wide compares everywhere else.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+/**
+ * Compare two memory regions.
+ * @param actual A pointer to the first memory region.
+ * @param expected A pointer to the second memory region.
+ * @param size The number of bytes to compare.
+ * @param first_offset Receives the offset of the first differing byte if there is one.
+ * @return The number of differing bytes.
+ */
+UINTN compare_memory(const UINT8* actual, const UINT8* expected, UINTN size, UINTN* first_offset);
+
+/**
+ * Compare every byte of a memory region against the given value.
+ * @param actual A pointer to the memory region.
+ * @param value The expected value of every byte.
+ * @param size The number of bytes to compare.
+ * @param first_offset Receives the offset of the first differing byte if there is one.
+ * @return The number of differing bytes.
+ */
+UINTN compare_fill(const UINT8* actual, UINT8 value, UINTN size, UINTN* first_offset);
+
+/**
+ * Log a hex dump of both memory regions around the given offset,
+ * marking the bytes which differ.
+ * @param actual A pointer to the actual memory region.
+ * @param expected A pointer to the expected memory region or NULL to compare against value.
+ * @param value The expected value of every byte if expected is NULL.
+ * @param size The size of both memory regions.
+ * @param offset The offset to dump the memory around.
+ */
+void compare_print_window(const UINT8* actual, const UINT8* expected, UINT8 value, UINTN size, UINTN offset);
@@ -0,0 +1,276 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "console.h"
+#include "efitest/efitest_utils.h"
+#include "options.h"
+
+#define CHUNK_SIZE 256
+#define MAX_PROGRESS_LENGTH 256
+#define NO_ATTRIBUTE ((UINTN) -1)
+#define UART_TIMEOUT 100000// Polls of the status register before a byte is written regardless
+
+#define UART_16550_THR 0x00
+#define UART_16550_LSR 0x05
+#define UART_16550_LSR_THRE 0x20
+#define UART_PL011_DR 0x00
+#define UART_PL011_FR 0x18
+#define UART_PL011_FR_TXFF 0x20
+
+#if defined(ETEST_ARCH_AMD64) || defined(ETEST_ARCH_IA32)
+#define UART_DEFAULT_BASE 0x3F8// COM1
+#elif defined(ETEST_ARCH_ARM64) || defined(ETEST_ARCH_ARM)
+#define UART_DEFAULT_BASE 0x09000000// PL011 of the QEMU virt machine
+#else
+#define UART_DEFAULT_BASE 0x10000000// 16550 of the QEMU virt machine
+#endif
+
+// The proxy is called by the firmware calling convention, which isn't the default on x86_64
+#ifdef ETEST_ARCH_AMD64
+#define PROXY_API __attribute__((ms_abi))
+#else
+#define PROXY_API EFIAPI
+#endif
+
+typedef enum _ConOutMode {
+    CONOUT_MODE_FULL,   // Everything is rendered to the firmware console as well
+    CONOUT_MODE_SUMMARY,// Only progress lines are rendered to the firmware console
+    CONOUT_MODE_NONE    // Nothing is rendered to the firmware console
+} ConOutMode;
+
+// NOLINTBEGIN
+static const UINT8 g_ansi_colors[8] = {0, 4, 2, 6, 1, 5, 3, 7};// Maps EFI to ANSI color indices
+static SIMPLE_TEXT_OUTPUT_INTERFACE* g_conout = NULL;         // The firmware console while redirected
+static SIMPLE_TEXT_OUTPUT_INTERFACE g_proxy;
+static SERIAL_IO_INTERFACE* g_serial = NULL;// NULL if the UART is written directly
+static UINTN g_uart_base = 0;
+static UINTN g_attribute = NO_ATTRIBUTE;// The attribute last written to the serial port
+static ConOutMode g_conout_mode = CONOUT_MODE_SUMMARY;
+// NOLINTEND
+
+#if defined(ETEST_ARCH_AMD64) || defined(ETEST_ARCH_IA32)
+
+static inline UINT8 read_port(UINT16 port) {
+    UINT8 value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void write_port(UINT16 port, UINT8 value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static void write_uart(UINT8 value) {
+    const UINT16 port = (UINT16) g_uart_base;
+    for(UINTN poll = 0; poll < UART_TIMEOUT; ++poll) {
+        if((read_port(port + UART_16550_LSR) & UART_16550_LSR_THRE) != 0) {
+            break;
+        }
+    }
+    write_port(port + UART_16550_THR, value);
+}
+
+#elif defined(ETEST_ARCH_ARM64) || defined(ETEST_ARCH_ARM)
+
+static void write_uart(UINT8 value) {
+    volatile UINT32* registers = (volatile UINT32*) g_uart_base;
+    for(UINTN poll = 0; poll < UART_TIMEOUT; ++poll) {
+        if((registers[UART_PL011_FR >> 2] & UART_PL011_FR_TXFF) == 0) {
+            break;
+        }
+    }
+    registers[UART_PL011_DR >> 2] = value;
+}
+
+#else
+
+static void write_uart(UINT8 value) {
+    volatile UINT8* registers = (volatile UINT8*) g_uart_base;
+    for(UINTN poll = 0; poll < UART_TIMEOUT; ++poll) {
+        if((registers[UART_16550_LSR] & UART_16550_LSR_THRE) != 0) {
+            break;
+        }
+    }
+    registers[UART_16550_THR] = value;
+}
+
+#endif
+
+static void write_bytes(const UINT8* data, UINTN size) {
+    if(g_serial != NULL) {
+        UINTN written_size = size;
+        UEFI_CALL(g_serial->Write, g_serial, &written_size, (void*) data);
+        return;
+    }
+    for(UINTN index = 0; index < size; ++index) {
+        write_uart(data[index]);
+    }
+}
+
+/*
+ * Encode the given string as UTF-8, so the box drawing characters
+ * used by the code renderer survive on the serial terminal.
+ */
+static void write_string(const CHAR16* string) {
+    UINT8 chunk[CHUNK_SIZE];
+    UINTN length = 0;
+    for(; *string != L'\0'; ++string) {
+        if(length + 3 > CHUNK_SIZE) {
+            write_bytes(chunk, length);
+            length = 0;
+        }
+        const CHAR16 value = *string;
+        if(value < 0x80) {
+            chunk[length++] = (UINT8) value;
+        }
+        else if(value < 0x800) {
+            chunk[length++] = (UINT8) (0xC0 | (value >> 6));
+            chunk[length++] = (UINT8) (0x80 | (value & 0x3F));
+        }
+        else {
+            chunk[length++] = (UINT8) (0xE0 | (value >> 12));
+            chunk[length++] = (UINT8) (0x80 | ((value >> 6) & 0x3F));
+            chunk[length++] = (UINT8) (0x80 | (value & 0x3F));
+        }
+    }
+    if(length > 0) {
+        write_bytes(chunk, length);
+    }
+}
+
+static void write_attribute(UINTN attribute) {
+    if(attribute == g_attribute) {
+        return;
+    }
+    g_attribute = attribute;
+    if(attribute == (EFI_BACKGROUND_BLACK | EFI_LIGHTGRAY)) {
+        write_bytes((const UINT8*) "\x1b[0m", 4);// Restore the colors of the terminal
+        return;
+    }
+    const UINTN foreground = attribute & 0x0F;
+    const UINTN background = (attribute >> 4) & 0x07;
+    const UINT8 foreground_code = ((foreground & EFI_BRIGHT) != 0 ? 90 : 30) + g_ansi_colors[foreground & 0x07];
+    const UINT8 background_code = 40 + g_ansi_colors[background];
+    const UINT8 sequence[] = {
+            0x1B,
+            '[',
+            (UINT8) ('0' + (foreground_code / 10)),
+            (UINT8) ('0' + (foreground_code % 10)),
+            ';',
+            (UINT8) ('0' + (background_code / 10)),
+            (UINT8) ('0' + (background_code % 10)),
+            'm',
+    };
+    write_bytes(sequence, sizeof(sequence));
+}
+
+static EFI_STATUS PROXY_API proxy_output_string(SIMPLE_TEXT_OUTPUT_INTERFACE* self, CHAR16* string) {
+    write_string(string);
+    if(g_conout_mode == CONOUT_MODE_FULL) {
+        return UEFI_CALL(g_conout->OutputString, g_conout, string);
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS PROXY_API proxy_set_attribute(SIMPLE_TEXT_OUTPUT_INTERFACE* self, UINTN attribute) {
+    write_attribute(attribute);
+    if(g_conout_mode == CONOUT_MODE_FULL) {
+        return UEFI_CALL(g_conout->SetAttribute, g_conout, attribute);
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS PROXY_API proxy_clear_screen(SIMPLE_TEXT_OUTPUT_INTERFACE* self) {
+    // The serial log is never cleared, so earlier output is kept for CI
+    if(g_conout_mode != CONOUT_MODE_NONE) {
+        return UEFI_CALL(g_conout->ClearScreen, g_conout);
+    }
+    return EFI_SUCCESS;
+}
+
+static ConOutMode parse_conout_mode() {
+    const char* value = options_get("conout");
+    if(value == NULL || *value == '\0' || strcmp(value, "summary") == 0) {
+        return CONOUT_MODE_SUMMARY;
+    }
+    if(strcmp(value, "full") == 0) {
+        return CONOUT_MODE_FULL;
+    }
+    if(strcmp(value, "none") == 0) {
+        return CONOUT_MODE_NONE;
+    }
+    set_colors(EFI_YELLOW);
+    Print(ETEST_SPACER L" Ignoring unknown console mode '%a', expected full, summary or none\n\n", value);
+    reset_colors();
+    return CONOUT_MODE_SUMMARY;
+}
+
+void console_init() {
+    const char* output = options_get("output");
+    if(output == NULL || *output == '\0' || strcmp(output, "console") == 0) {
+        return;
+    }
+    if(strcmp(output, "serial") != 0) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Ignoring unknown output '%a', expected console or serial\n\n", output);
+        reset_colors();
+        return;
+    }
+    g_conout_mode = parse_conout_mode();
+
+    if(EFI_ERROR(UEFI_CALL(ST->BootServices->LocateProtocol, &SerialIoProtocol, NULL, (void**) &g_serial))) {
+        g_serial = NULL;
+        g_uart_base = options_get_uintn("serial-port", UART_DEFAULT_BASE);
+    }
+
+    // Swapping the console catches everything printed through Print, set_colors and the firmware itself
+    g_conout = ST->ConOut;
+    g_proxy = *g_conout;
+    g_proxy.OutputString = (EFI_TEXT_STRING) proxy_output_string;
+    g_proxy.SetAttribute = (EFI_TEXT_SET_ATTRIBUTE) proxy_set_attribute;
+    g_proxy.ClearScreen = (EFI_TEXT_CLEAR_SCREEN) proxy_clear_screen;
+    g_attribute = NO_ATTRIBUTE;
+    ST->ConOut = &g_proxy;
+
+    if(g_serial == NULL) {
+        console_print_progress(L"Serial I/O protocol not found, writing to the UART at 0x%lx", (UINT64) g_uart_base);
+    }
+    else {
+        console_print_progress(L"Writing test output to the serial port", NULL);
+    }
+}
+
+void console_free() {
+    if(g_conout == NULL) {
+        return;
+    }
+    write_attribute(EFI_BACKGROUND_BLACK | EFI_LIGHTGRAY);
+    ST->ConOut = g_conout;
+    g_conout = NULL;
+    g_serial = NULL;
+}
+
+void console_print_progress(const CHAR16* format, ...) {
+    if(g_conout == NULL || g_conout_mode != CONOUT_MODE_SUMMARY) {
+        return;
+    }
+    CHAR16 line[MAX_PROGRESS_LENGTH];
+    va_list args;
+    va_start(args, format);
+    const UINTN length = VSPrint(line, sizeof(line) - (2 * sizeof(CHAR16)), format, args);
+    va_end(args);
+    line[length] = L'\r';
+    line[length + 1] = L'\n';
+    line[length + 2] = L'\0';
+    UEFI_CALL(g_conout->OutputString, g_conout, line);
+}
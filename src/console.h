@@ -0,0 +1,43 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Redirects all console output to the serial port when running with
+ * --output=serial, either through the serial I/O protocol or by
+ * writing to a 16550 or PL011 UART directly. Color attributes are
+ * translated to ANSI escape sequences.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+/**
+ * Install the serial backend in place of ST->ConOut if --output=serial
+ * was passed. What is still rendered to the firmware console is selected
+ * via --conout=full|summary|none.
+ */
+void console_init();
+
+/**
+ * Restore the firmware console.
+ */
+void console_free();
+
+/**
+ * Print a line to the firmware console if it was reduced to a progress
+ * summary via --conout=summary, otherwise do nothing.
+ * @param format The format of the line without a trailing line feed.
+ * @param ... A variable number of formatting parameters.
+ */
+void console_print_progress(const CHAR16* format, ...);
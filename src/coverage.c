@@ -0,0 +1,188 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "coverage.h"
+
+#ifdef ETEST_ENABLE_COVERAGE
+
+#include "buffer.h"
+#include "efitest/efitest_utils.h"
+#include "file.h"
+#include "memory.h"
+#include "options.h"
+
+// The layout of the records emitted by GCC 12 and later, see gcc/gcov-io.h and libgcc/libgcov.h
+#if __GNUC__ >= 14
+#define GCOV_COUNTERS 9
+#else
+#define GCOV_COUNTERS 8
+#endif
+
+#define GCOV_DATA_MAGIC 0x67636461// gcda
+#define GCOV_TAG_FUNCTION 0x01000000
+#define GCOV_TAG_FUNCTION_LENGTH (3 * sizeof(UINT32))
+#define GCOV_TAG_COUNTER_BASE 0x01A10000
+
+struct gcov_info;
+
+struct gcov_ctr_info {
+    UINT32 num;
+    INT64* values;
+};
+
+struct gcov_fn_info {
+    const struct gcov_info* key;
+    UINT32 ident;
+    UINT32 lineno_checksum;
+    UINT32 cfg_checksum;
+    struct gcov_ctr_info ctrs[];// One for every counter kind which has a merge function
+};
+
+struct gcov_info {
+    UINT32 version;
+    struct gcov_info* next;
+    UINT32 stamp;
+    UINT32 checksum;
+    const char* filename;
+    void (*merge[GCOV_COUNTERS])(INT64*, UINT32);
+    UINT32 n_functions;
+    const struct gcov_fn_info* const* functions;
+};
+
+// Emitted by the linker around the section the compiler places the gcov_info pointers in
+extern const struct gcov_info* const __start_efitest_gcov_info[] __attribute__((weak));
+extern const struct gcov_info* const __stop_efitest_gcov_info[] __attribute__((weak));
+
+/*
+ * Counters are only merged on the host, this keeps the libgcov
+ * implementation which depends on libc file I/O out of the image.
+ */
+void __gcov_merge_add(INT64* counters, UINT32 count) {// NOLINT
+    (void) counters;
+    (void) count;
+}
+
+static void append_uint32(Buffer* buffer, UINT32 value) {
+    buffer_append_data(buffer, &value, sizeof(UINT32));
+}
+
+static void append_counter(Buffer* buffer, INT64 value) {
+    append_uint32(buffer, (UINT32) ((UINT64) value & 0xFFFFFFFF));
+    append_uint32(buffer, (UINT32) ((UINT64) value >> 32));
+}
+
+static BOOLEAN are_all_counters_zero(const struct gcov_ctr_info* counters) {
+    for(UINT32 index = 0; index < counters->num; ++index) {
+        if(counters->values[index] != 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Streams a .gcda file the same way __gcov_info_to_gcda does, so libgcov
+ * doesn't have to be built for the target. Coverage builds only emit
+ * additive arc counters, value profiles are never written.
+ */
+static void append_gcda(Buffer* buffer, const struct gcov_info* info) {
+    append_uint32(buffer, GCOV_DATA_MAGIC);
+    append_uint32(buffer, info->version);
+    append_uint32(buffer, info->stamp);
+    append_uint32(buffer, info->checksum);
+
+    for(UINT32 function_index = 0; function_index < info->n_functions; ++function_index) {
+        const struct gcov_fn_info* function = info->functions[function_index];
+        append_uint32(buffer, GCOV_TAG_FUNCTION);
+        if(function == NULL || function->key != info) {
+            append_uint32(buffer, 0);// Emitted into a different object by COMDAT folding
+            continue;
+        }
+        append_uint32(buffer, GCOV_TAG_FUNCTION_LENGTH);
+        append_uint32(buffer, function->ident);
+        append_uint32(buffer, function->lineno_checksum);
+        append_uint32(buffer, function->cfg_checksum);
+
+        const struct gcov_ctr_info* counters = function->ctrs;
+        for(UINT32 kind = 0; kind < GCOV_COUNTERS; ++kind) {
+            if(info->merge[kind] == NULL) {
+                continue;
+            }
+            append_uint32(buffer, GCOV_TAG_COUNTER_BASE + (kind << 17));
+            const UINT32 length = counters->num * 2 * sizeof(UINT32);
+            if(are_all_counters_zero(counters)) {
+                append_uint32(buffer, -length);// A negative length marks counters which are all zero
+            }
+            else {
+                append_uint32(buffer, length);
+                for(UINT32 index = 0; index < counters->num; ++index) {
+                    append_counter(buffer, counters->values[index]);
+                }
+            }
+            ++counters;
+        }
+    }
+    append_uint32(buffer, 0);
+}
+
+static void append_record(Buffer* buffer, const struct gcov_info* info) {
+    UINT32 length = 0;
+    while(info->filename[length] != '\0') {
+        ++length;
+    }
+    append_uint32(buffer, COVERAGE_RECORD_MAGIC);
+    append_uint32(buffer, length);
+    buffer_append_data(buffer, info->filename, length);
+    const UINTN size_offset = buffer->length;
+    append_uint32(buffer, 0);// The size of the .gcda data is only known afterwards
+    append_gcda(buffer, info);
+    const UINT32 size = (UINT32) (buffer->length - size_offset - sizeof(UINT32));
+    memcpy(buffer->data + size_offset, &size, sizeof(UINT32));
+}
+
+void coverage_store() {
+    const struct gcov_info* const* begin = __start_efitest_gcov_info;
+    const struct gcov_info* const* end = __stop_efitest_gcov_info;
+    if(begin == NULL || begin == end) {
+        return;// Nothing was instrumented
+    }
+    const char* path = options_get("coverage-path");
+    if(path == NULL || *path == '\0') {
+        path = COVERAGE_DEFAULT_PATH;
+    }
+
+    const BOOLEAN was_tracking = memory_suspend();
+    Buffer buffer = {0};
+    for(const struct gcov_info* const* info = begin; info != end; ++info) {
+        append_record(&buffer, *info);
+    }
+
+    const EFI_STATUS status = file_write(path, buffer.data, buffer.length);
+    if(status == EFI_SUCCESS) {
+        Print(ETEST_SPACER L" Wrote " ETEST_FMT_UINTN L" bytes of coverage data to %a\n\n", buffer.length, path);
+    }
+    else {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Could not write coverage data to %a: %r\n\n", path, status);
+        reset_colors();
+    }
+    buffer_free(&buffer);
+    memory_resume(was_tracking);
+}
+
+#else
+
+void coverage_store() {
+}
+
+#endif
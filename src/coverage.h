@@ -0,0 +1,36 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Freestanding code coverage collection. When the runtime is built
+ * with ETEST_ENABLE_COVERAGE, the gcov counters of all sources which
+ * were compiled with -fprofile-info-section=efitest_gcov_info are
+ * streamed into a single file on the boot volume before shutdown.
+ * The file is a sequence of records, each consisting of the magic,
+ * the length and name of the .gcda file, followed by its size and
+ * contents, all sizes being 32-bit little endian values.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define COVERAGE_DEFAULT_PATH "\\efitest-coverage.bin"
+#define COVERAGE_RECORD_MAGIC 0x56434645// EFCV
+
+/**
+ * Write the coverage counters of all instrumented sources to the
+ * path passed via --coverage-path, or COVERAGE_DEFAULT_PATH.
+ * Does nothing unless the runtime was built with coverage enabled.
+ */
+void coverage_store();
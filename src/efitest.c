@@ -17,14 +17,46 @@
  */
 
 #include "efitest/efitest.h"
+#include "async.h"
+#include "baselines.h"
+#include "capture.h"
+#include "compare.h"
+#include "console.h"
 #include "code_renderer.h"
+#include "coverage.h"
 #include "efitest/efitest_init.h"
 #include "efitest/efitest_utils.h"
+#include "failures.h"
+#include "file.h"
+#include "memory.h"
+#include "options.h"
+#include "parallel.h"
+#include "profile.h"
+#include "ramdisk.h"
+#include "resident.h"
+#include "results.h"
+#include "soak.h"
+#include "timer.h"
+#include "trace.h"
+
+#define MAX_TEST_NAME_LENGTH 256
+#define MAX_LOG_LINE_LENGTH 512// Longer log lines are truncated
+#define DEFAULT_MAX_ERROR_COUNT 1024
+
+typedef enum _RunPhase {
+    RUN_PHASE_ALL,     // Run every selected test
+    RUN_PHASE_FAILED,  // Only run tests which failed during the previous run
+    RUN_PHASE_REMAINING// Only run tests which passed during the previous run
+} RunPhase;
+
+static BOOLEAN is_test_selected(const EFITestGroup* group, const EFITestDescriptor* test, UINTN param_index);
+static inline UINTN get_case_count(const EFITestDescriptor* test);
 
 // NOLINTBEGIN
 static const char* g_hex_chars = "0123456789ABCDEF";// Used for UUID string conversion
 static UINTN g_group_pass_count = 0;
 static UINTN g_group_error_count = 0;
+static UINTN g_group_first_error = 0;
 static UINTN g_test_count = 0;
 static UINTN g_test_pass_count = 0;
 static EFITestRunCallback g_pre_run_callback = NULL;
@@ -35,6 +67,15 @@ static EFITestCallback g_pre_test_callback = NULL;
 static EFITestCallback g_post_test_callback = NULL;
 static EFITestError* g_errors = NULL;
 static UINTN g_error_count = 0;
+static UINTN g_error_capacity = 0;
+static UINTN g_max_error_count = DEFAULT_MAX_ERROR_COUNT;
+static UINTN g_group_dropped_count = 0;// The number of failures which weren't recorded since the limit was reached
+static RunPhase g_run_phase = RUN_PHASE_ALL;
+static UINTN g_shard_index = 0;
+static UINTN g_shard_count = 0;// 0 if the tests aren't sharded
+static BOOLEAN g_is_shard_planned = FALSE;
+static CHAR16 g_log_line[MAX_LOG_LINE_LENGTH];  // Log messages are formatted into this, so logging never allocates
+static CHAR16 g_log_format[MAX_LOG_LINE_LENGTH];// Narrow format strings are widened into this
 // RNG state
 static UINT64 g_rand_z = 362436069;// Value suggested by author
 static UINT64 g_rand_w = 521288629;// Value suggested by author
@@ -57,7 +98,11 @@ _Noreturn void shutdown() {
 }
 
 void print_test_result(const EFITestContext* context) {
-    if(context->failed) {
+    if(context->slower) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER_SLOWER L" ");
+    }
+    else if(context->failed) {
         set_colors(EFI_RED);
         Print(ETEST_SPACER_FAILED L" ");
     }
@@ -66,12 +111,43 @@ void print_test_result(const EFITestContext* context) {
         Print(ETEST_SPACER_OK L" ");
     }
     set_colors(EFI_WHITE);
-    Print(L"%a\n", context->test_name);
+    if(context->param_count > 0) {
+        Print(L"%a[" ETEST_FMT_UINTN "]", context->test_name, context->param_index);
+    }
+    else {
+        Print(L"%a", context->test_name);
+    }
+    set_colors(EFI_DARKGRAY);
+    const EFITestMemoryStats* memory = &(context->memory);
+    if(memory->allocation_count > 0) {
+        Print(L" (" ETEST_FMT_UINT64 L"us, " ETEST_FMT_UINTN L" allocations, " ETEST_FMT_UINTN L" bytes peak)\n",
+              context->duration / 1000, memory->allocation_count, memory->peak_bytes);
+    }
+    else {
+        Print(L" (" ETEST_FMT_UINT64 L"us)\n", context->duration / 1000);
+    }
     reset_colors();
 }
 
+static void print_case_name(const EFITestContext* context) {
+    if(context->param_count > 0) {
+        Print(L"%a[" ETEST_FMT_UINTN L"]", context->test_name, context->param_index);
+    }
+    else {
+        Print(L"%a", context->test_name);
+    }
+}
+
 void print_error(const EFITestError* error) {
     render_code(error->expression, error->line_number);
+    if(error->hit_count > 1) {
+        set_colors(EFI_DARKGRAY);
+        Print(L"\nFailed " ETEST_FMT_UINTN L" times, first in ", error->hit_count);
+        print_case_name(&(error->context));
+        Print(L", last in ", NULL);
+        print_case_name(&(error->last_context));
+        reset_colors();
+    }
     Print(L"\n", NULL);
 }
 
@@ -86,36 +162,239 @@ void print_test_results() {
         Print(ETEST_SPACER_OK L" ", NULL);
     }
     reset_colors();
-    Print(ETEST_FMT_UINTN "/" ETEST_FMT_UINTN L" tests passed in total\n\n", g_test_pass_count, g_test_count);
+    // Soak runs count every test case once per iteration
+    if(soak_get_iteration_count() > 1) {
+        Print(ETEST_FMT_UINTN "/" ETEST_FMT_UINTN L" test cases passed over all " ETEST_FMT_UINTN L" iterations\n\n",
+              g_test_pass_count, g_test_count, soak_get_iteration_count());
+    }
+    else {
+        Print(ETEST_FMT_UINTN "/" ETEST_FMT_UINTN L" tests passed in total\n\n", g_test_pass_count, g_test_count);
+    }
+    console_print_progress(L"Test run finished, " ETEST_FMT_UINTN L"/" ETEST_FMT_UINTN L" tests passed",
+                           g_test_pass_count, g_test_count);
+}
+
+/*
+ * Print all tests matching the current filter from the generated
+ * descriptor tables without running any of them.
+ */
+void list_tests() {
+    UINTN group_count = 0;
+    const EFITestGroup* groups = efitest_get_groups(&group_count);
+    UINTN test_count = 0;
+
+    for(UINTN group_index = 0; group_index < group_count; ++group_index) {
+        const EFITestGroup* group = &(groups[group_index]);
+        for(UINTN index = 0; index < group->test_count; ++index) {
+            const EFITestDescriptor* test = &(group->tests[index]);
+            BOOLEAN is_selected = FALSE;
+            for(UINTN param_index = 0; param_index < get_case_count(test) && !is_selected; ++param_index) {
+                is_selected = is_test_selected(group, test, param_index);
+            }
+            if(!is_selected) {
+                continue;
+            }
+
+            Print(L"%016lx %a.%a", test->id, group->name, test->name);
+            if(test->param_count > 0) {
+                Print(L"[" ETEST_FMT_UINTN L"]", test->param_count);
+            }
+            Print(L" %a:" ETEST_FMT_UINTN, group->file_path, test->line_number);
+            if(*(test->tags) != '\0') {
+                Print(L" [%a]", test->tags);
+            }
+            Print(L"\n", NULL);
+            ++test_count;
+        }
+    }
+
+    Print(ETEST_SPACER L" " ETEST_FMT_UINTN L" tests in " ETEST_FMT_UINTN L" groups\n", test_count, group_count);
+}
+
+/*
+ * Parse --shard=i/n, where i is the zero-based index of the shard
+ * to run out of n shards. The shard plan of the discoverer is used
+ * if it was made for the same number of shards, otherwise tests
+ * are distributed by hashing their case IDs.
+ */
+void parse_shard_option() {
+    const char* value = options_get("shard");
+    if(value == NULL) {
+        return;
+    }
+    UINTN index = 0;
+    UINTN count = 0;
+    while(*value >= '0' && *value <= '9') {
+        index = (index * 10) + (*(value++) - '0');
+    }
+    if(*(value++) == '/') {
+        while(*value >= '0' && *value <= '9') {
+            count = (count * 10) + (*(value++) - '0');
+        }
+    }
+    if(*value != '\0' || count == 0 || index >= count) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Ignoring malformed shard '%a', expected --shard=index/count\n\n", options_get("shard"));
+        reset_colors();
+        return;
+    }
+
+    g_shard_index = index;
+    g_shard_count = count;
+    g_is_shard_planned = efitest_get_shard_count() == count;
+    Print(ETEST_SPACER L" Running shard " ETEST_FMT_UINTN L"/" ETEST_FMT_UINTN L" (%a)\n\n", index, count,
+          g_is_shard_planned ? "planned" : "hashed");
+}
+
+/*
+ * Run all groups in the order of the generated table,
+ * or in a random order when requested through --shuffle.
+ */
+static void run_groups(EFITestContext* context) {
+    UINTN group_count = 0;
+    const EFITestGroup* groups = efitest_get_groups(&group_count);
+    const UINTN* order = soak_get_group_order(group_count);
+    if(order == NULL) {
+        efitest_run_tests(context);
+        return;
+    }
+    for(UINTN index = 0; index < group_count; ++index) {
+        efitest_run_group(context, &(groups[order[index]]));
+    }
+}
+
+/*
+ * Run all tests, or previously failed tests first
+ * when requested through --failed-first/--failed-only.
+ */
+void run_tests(EFITestContext* context) {
+    const BOOLEAN failed_only = options_has("failed-only");
+    if(!failed_only && !options_has("failed-first")) {
+        run_groups(context);
+        return;
+    }
+    if(failures_get_previous_count() == 0) {
+        Print(ETEST_SPACER L" No failed tests recorded, running all tests\n\n", NULL);
+        run_groups(context);
+        return;
+    }
+
+    Print(ETEST_SPACER L" Running " ETEST_FMT_UINTN L" previously failed tests first\n\n",
+          failures_get_previous_count());
+    g_run_phase = RUN_PHASE_FAILED;
+    run_groups(context);
+    if(!failed_only) {
+        Print(ETEST_SPACER L" Running remaining tests\n\n", NULL);
+        g_run_phase = RUN_PHASE_REMAINING;
+        run_groups(context);
+    }
+    g_run_phase = RUN_PHASE_ALL;
+}
+
+/*
+ * Modules return to the resident runner which loaded them,
+ * images booted directly shut the machine down.
+ */
+static EFI_STATUS exit_image() {
+    if(!resident_is_module()) {
+        shutdown();
+    }
+    return EFI_SUCCESS;
 }
 
 __attribute__((unused)) EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE* sys_table) {
     InitializeLib(image, sys_table);
     InitializeUnicodeSupport((UINT8*) "en-US");
+    options_parse(image);
+    resident_init();
 
     UEFI_CALL(sys_table->BootServices->SetWatchdogTimer, 0, 0, 0, NULL);
-    UEFI_CALL(sys_table->ConOut->ClearScreen, sys_table->ConOut);
+    if(!resident_is_module()) {// Modules keep the console of the runner which loaded them
+        UEFI_CALL(sys_table->ConOut->ClearScreen, sys_table->ConOut);
+        console_init();
 
-    set_colors(EFI_BACKGROUND_BLUE | EFI_WHITE);
-    Print(L"== EFITEST Integrated Testing Environment ==\n", NULL);
-    Print(L"Copyright (C) 2023 Karma Krafts & associates\n", NULL);
-    reset_colors();
-    Print(L"\n", NULL);
+        set_colors(EFI_BACKGROUND_BLUE | EFI_WHITE);
+        Print(L"== EFITEST Integrated Testing Environment ==\n", NULL);
+        Print(L"Copyright (C) 2023 Karma Krafts & associates\n", NULL);
+        reset_colors();
+        Print(L"\n", NULL);
+    }
+
+    if(efitest_is_resident_runner()) {
+        timer_calibrate();
+        file_init(image);// The runner writes the outputs of all modules
+        resident_run(image);
+        file_free();
+        console_free();
+        options_free();
+        shutdown();
+    }
+
+    parse_shard_option();
+    capture_init();
+    g_max_error_count = options_get_uintn("max-errors", DEFAULT_MAX_ERROR_COUNT);
+    if(options_has("list")) {
+        list_tests();
+        console_free();
+        options_free();
+        return exit_image();
+    }
+
+    timer_calibrate();
+    memory_init();
+    profile_init();
+    trace_init();
+    async_init();
+    parallel_init();
+    file_init(image);
 
+    trace_begin(TRACE_CATEGORY_RUN, "run", TRACE_NO_INDEX);
     if(g_pre_run_callback != NULL) {
+        trace_begin(TRACE_CATEGORY_CALLBACK, "pre_run", TRACE_NO_INDEX);
         g_pre_run_callback();
+        trace_end();
     }
 
     EFITestContext context;
-    efitest_run_tests(&context);
+    failures_load();
+    soak_init();
+    do {
+        efitest_errors_clear();// Failed assertions of previous iterations were reported already
+        soak_begin_iteration();
+        run_tests(&context);
+    } while(soak_end_iteration(g_test_count, g_test_pass_count));
+    soak_print_report(g_test_count, g_test_pass_count);
     print_test_results();
+    resident_report(g_test_count, g_test_pass_count);
+    failures_store();
+    results_store();
+    baselines_store();
 
     if(g_post_run_callback != NULL) {
+        trace_begin(TRACE_CATEGORY_CALLBACK, "post_run", TRACE_NO_INDEX);
         g_post_run_callback();
+        trace_end();
     }
-
-    free(g_errors);
-    shutdown();
+    trace_end();
+    trace_store();
+    coverage_store();// Also covers code run by the post-run callback
+
+    ramdisk_free();
+    soak_free();
+    efitest_errors_free();
+    failures_free();
+    results_free();
+    baselines_free();
+    capture_free();
+    file_free();
+    profile_free();
+    trace_free();
+    async_free();
+    parallel_free();
+    memory_free();
+    console_free();
+    options_free();
+    return exit_image();
 }
 
 /*
@@ -166,10 +445,38 @@ BOOLEAN efitest_uuid_compare(const EFITestUUID* value1, const EFITestUUID* value
     return TRUE;
 }
 
+/*
+ * Widen a narrow format string into the shared format buffer,
+ * overlong formats are truncated.
+ */
+static const CHAR16* widen_format(const char* format) {
+    UINTN length = 0;
+    while(format[length] != '\0' && length < MAX_LOG_LINE_LENGTH - 1) {
+        g_log_format[length] = (CHAR16) format[length];
+        ++length;
+    }
+    g_log_format[length] = L'\0';
+    return g_log_format;
+}
+
+static void write_narrow(const char* message) {
+    while(*message != '\0') {
+        UINTN length = 0;
+        while(message[length] != '\0' && length < MAX_LOG_LINE_LENGTH - 1) {
+            g_log_line[length] = (CHAR16) message[length];
+            ++length;
+        }
+        g_log_line[length] = L'\0';
+        capture_write(g_log_line);
+        message += length;
+    }
+}
+
 void efitest_loglnf_v(const UINT16* format, va_list args) {
-    UINT16* message = VPoolPrint(format, args);
-    Print(ETEST_SPACER L" %s\n", message);
-    FreePool(message);
+    VSPrint(g_log_line, sizeof(g_log_line), format, args);
+    capture_write(ETEST_SPACER L" ");
+    capture_write(g_log_line);
+    capture_write(L"\n");
 }
 
 void efitest_loglnf(const UINT16* format, ...) {
@@ -180,9 +487,8 @@ void efitest_loglnf(const UINT16* format, ...) {
 }
 
 void efitest_logf_v(const UINT16* format, va_list args) {
-    UINT16* message = VPoolPrint(format, args);
-    Print(L"%s", message);
-    FreePool(message);
+    VSPrint(g_log_line, sizeof(g_log_line), format, args);
+    capture_write(g_log_line);
 }
 
 void efitest_logf(const UINT16* format, ...) {
@@ -193,11 +499,61 @@ void efitest_logf(const UINT16* format, ...) {
 }
 
 void efitest_log(const UINT16* message) {
-    efitest_logf(message, NULL);
+    capture_write(message);
 }
 
 void efitest_logln(const UINT16* message) {
-    efitest_loglnf(message, NULL);
+    capture_write(ETEST_SPACER L" ");
+    capture_write(message);
+    capture_write(L"\n");
+}
+
+void efitest_loglnfa_v(const char* format, va_list args) {
+    efitest_loglnf_v(widen_format(format), args);
+}
+
+void efitest_loglnfa(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    efitest_loglnfa_v(format, args);
+    va_end(args);
+}
+
+void efitest_logfa_v(const char* format, va_list args) {
+    efitest_logf_v(widen_format(format), args);
+}
+
+void efitest_logfa(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    efitest_logfa_v(format, args);
+    va_end(args);
+}
+
+void efitest_loga(const char* message) {
+    write_narrow(message);
+}
+
+void efitest_loglna(const char* message) {
+    capture_write(ETEST_SPACER L" ");
+    write_narrow(message);
+    capture_write(L"\n");
+}
+
+static inline UINT64 compute_case_id(UINT64 test_id, UINTN param_count, UINTN param_index) {
+    if(param_count == 0) {
+        return test_id;
+    }
+    UINT64 hash = test_id;// Continue the FNV-1a hash of the test over the parameter index
+    for(UINTN index = 0; index < sizeof(UINT64); ++index) {
+        hash ^= (((UINT64) param_index) >> (index << 3)) & 0xFF;
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+UINT64 efitest_get_case_id(const EFITestContext* context) {
+    return compute_case_id(context->test_id, context->param_count, context->param_index);
 }
 
 void efitest_set_pre_run_callback(EFITestRunCallback callback) {
@@ -225,9 +581,13 @@ void efitest_set_post_test_callback(EFITestCallback callback) {
 }
 
 void efitest_errors_add(const EFITestError* error) {
-    const UINTN index = g_error_count++;
-    g_errors = realloc(g_errors, g_error_count * sizeof(EFITestError));
-    g_errors[index] = *error;
+    const BOOLEAN was_tracking = memory_suspend();// Don't account our own bookkeeping to the test
+    if(g_error_count == g_error_capacity) {
+        g_error_capacity = g_error_capacity == 0 ? 16 : g_error_capacity << 1;
+        g_errors = realloc(g_errors, g_error_capacity * sizeof(EFITestError));
+    }
+    g_errors[g_error_count++] = *error;
+    memory_resume(was_tracking);
 }
 
 const EFITestError* efitest_errors_get() {
@@ -247,6 +607,14 @@ UINTN efitest_errors_get_count() {
 
 void efitest_errors_clear() {
     g_error_count = 0;
+    g_group_first_error = 0;
+}
+
+void efitest_errors_free() {
+    free(g_errors);
+    g_errors = NULL;
+    g_error_capacity = 0;
+    efitest_errors_clear();
 }
 
 BOOLEAN efitest_errors_compare(const EFITestError* error1, const EFITestError* error2) {
@@ -269,24 +637,112 @@ BOOLEAN efitest_errors_get_index(const EFITestError* error, UINTN* index) {
 void efitest_on_pre_run_group(EFITestContext* context) {
     g_group_pass_count = 0;
     g_group_error_count = 0;
+    g_group_first_error = g_error_count;
+    g_group_dropped_count = 0;
     Print(ETEST_SPACER L" Running test group '%a'..\n", context->group_name);
 
     if(g_pre_group_callback != NULL) {
+        trace_begin(TRACE_CATEGORY_CALLBACK, "pre_group", TRACE_NO_INDEX);
         g_pre_group_callback(context);
+        trace_end();
     }
 }
 
 // Internal functions
 
+static inline BOOLEAN is_same_site(const EFITestError* error, const EFITestContext* context, UINTN line_number,
+                                    const char* expression) {
+    // The file path and expression are usually the same literal, so the pointers match
+    return error->line_number == line_number &&
+           (error->expression == expression || strcmp(error->expression, expression) == 0) &&
+           (error->context.file_path == context->file_path ||
+            strcmp(error->context.file_path, context->file_path) == 0);
+}
+
+/*
+ * Find the error recorded for the given assertion site in the current group,
+ * starting with the most recent one since failures usually repeat in loops.
+ */
+static EFITestError* find_site(const EFITestContext* context, UINTN line_number, const char* expression) {
+    for(UINTN index = g_error_count; index > g_group_first_error; --index) {
+        EFITestError* error = &(g_errors[index - 1]);
+        if(is_same_site(error, context, line_number, expression)) {
+            return error;
+        }
+    }
+    return NULL;
+}
+
 void efitest_assert(BOOLEAN condition, EFITestContext* context, UINTN line_number, const char* expression) {
-    if((context->failed = !condition)) {
-        EFITestError error;
-        efitest_uuid_generate(&(error.uuid));
-        error.context = *context;
-        error.line_number = line_number;
-        error.expression = expression;
-        efitest_errors_add(&error);
+    if(condition) {
+        return;// Don't reset the state of a test which failed an earlier assertion
+    }
+    // Other processors can't touch the error list, their failures are merged once they finished
+    if(parallel_record_failure(context, line_number, expression)) {
+        return;
+    }
+    efitest_assert_failed(context, line_number, expression, 1);
+}
+
+void efitest_assert_failed(EFITestContext* context, UINTN line_number, const char* expression, UINTN hit_count) {
+    context->failed = TRUE;
+
+    EFITestError* site = find_site(context, line_number, expression);
+    if(site != NULL) {
+        site->hit_count += hit_count;
+        site->last_context = *context;
+        return;
     }
+    if(g_error_count - g_group_first_error >= g_max_error_count) {
+        g_group_dropped_count += hit_count;
+        return;
+    }
+
+    EFITestError error;
+    efitest_uuid_generate(&(error.uuid));
+    error.context = *context;
+    error.line_number = line_number;
+    error.expression = expression;
+    error.hit_count = hit_count;
+    error.last_context = *context;
+    efitest_errors_add(&error);
+}
+
+/*
+ * The details of a memory mismatch are only logged for the first
+ * failure of an assertion site, the others are just counted.
+ */
+static void report_mismatch(const UINT8* actual, const UINT8* expected, UINT8 value, UINTN size, UINTN count,
+                            UINTN first_offset, const EFITestContext* context, UINTN line_number,
+                            const char* expression) {
+    if(parallel_is_worker(context) || find_site(context, line_number, expression) != NULL) {
+        return;
+    }
+    efitest_loglnfa("Memory differs in " ETEST_FMT_UINTN " of " ETEST_FMT_UINTN " bytes, first at offset "
+                    ETEST_FMT_UINTN, count, size, first_offset);
+    compare_print_window(actual, expected, value, size, first_offset);
+}
+
+void efitest_assert_mem_eq(const void* actual, const void* expected, UINTN size, EFITestContext* context,
+                           UINTN line_number, const char* expression) {
+    UINTN first_offset = 0;
+    const UINTN count = compare_memory((const UINT8*) actual, (const UINT8*) expected, size, &first_offset);
+    if(count > 0) {
+        report_mismatch((const UINT8*) actual, (const UINT8*) expected, 0, size, count, first_offset, context,
+                        line_number, expression);
+    }
+    efitest_assert(count == 0, context, line_number, expression);
+}
+
+void efitest_assert_mem_filled(const void* address, UINT8 value, UINTN size, EFITestContext* context,
+                               UINTN line_number, const char* expression) {
+    UINTN first_offset = 0;
+    const UINTN count = compare_fill((const UINT8*) address, value, size, &first_offset);
+    if(count > 0) {
+        report_mismatch((const UINT8*) address, NULL, value, size, count, first_offset, context, line_number,
+                        expression);
+    }
+    efitest_assert(count == 0, context, line_number, expression);
 }
 
 void efitest_on_post_run_group(EFITestContext* context) {
@@ -302,36 +758,71 @@ void efitest_on_post_run_group(EFITestContext* context) {
     }
     reset_colors();
     Print(ETEST_FMT_UINTN "/" ETEST_FMT_UINTN L" tests passed\n\n", g_group_pass_count, group_size);
+    console_print_progress(L"%a: " ETEST_FMT_UINTN L"/" ETEST_FMT_UINTN L" tests passed", context->group_name,
+                           g_group_pass_count, group_size);
+    profile_print_group_report(context);
 
     g_test_count += group_size;
 
     if(g_post_group_callback != NULL) {
+        trace_begin(TRACE_CATEGORY_CALLBACK, "post_group", TRACE_NO_INDEX);
         g_post_group_callback(context);
+        trace_end();
     }
 
-    if(g_group_error_count > 0) {
+    // Tests may fail without assertions (leaks) or fail more than one assertion
+    const UINTN group_assertion_count = g_error_count > g_group_first_error ? g_error_count - g_group_first_error : 0;
+    if(g_group_error_count > 0 && group_assertion_count > 0) {
         set_colors(EFI_BACKGROUND_BLACK | EFI_RED);
-        Print(L"Assertion%a in ", g_group_error_count == 1 ? "" : "s");
+        Print(L"Assertion%a in ", group_assertion_count == 1 ? "" : "s");
         set_colors(EFI_BACKGROUND_BLACK | EFI_LIGHTRED);
         Print(L"%a ", context->file_name);
         set_colors(EFI_BACKGROUND_BLACK | EFI_RED);
-        Print(L"%a failed:\n\n", g_group_error_count == 1 ? "has" : "have");
+        Print(L"%a failed:\n\n", group_assertion_count == 1 ? "has" : "have");
         reset_colors();
 
-        for(UINTN index = 0; index < g_group_error_count; ++index) {
-            print_error(efitest_errors_get_last() - ((g_group_error_count - 1) - index));
+        for(UINTN index = g_group_first_error; index < g_error_count; ++index) {
+            print_error(&(g_errors[index]));
         }
     }
+    if(g_group_dropped_count > 0) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" " ETEST_FMT_UINTN L" failed assertions weren't recorded, --max-errors was reached\n\n",
+              g_group_dropped_count);
+        reset_colors();
+    }
+    capture_print_group_report();
 }
 
 void efitest_on_pre_run_test(EFITestContext* context) {
+    // Before the callback, so it may prepare the disks itself. Waiting tests may still use the disks.
+    if(!async_has_waiting_tests()) {
+        ramdisk_reset_all();
+    }
     if(g_pre_test_callback != NULL) {
+        trace_begin(TRACE_CATEGORY_CALLBACK, "pre_test", TRACE_NO_INDEX);
         g_pre_test_callback(context);
+        trace_end();
+    }
+}
+
+static void run_post_test_callback(EFITestContext* context) {
+    if(g_post_test_callback != NULL) {
+        trace_begin(TRACE_CATEGORY_CALLBACK, "post_test", TRACE_NO_INDEX);
+        g_post_test_callback(context);
+        trace_end();
     }
 }
 
 void efitest_on_post_run_test(EFITestContext* context) {
-    print_test_result(context);
+    if(capture_is_result_shown(context)) {
+        print_test_result(context);
+    }
+    memory_print_report(&(context->memory));
+    baselines_print_report(context);
+    profile_print_test_report(context);
+    failures_record(efitest_get_case_id(context), context->failed);
+    results_record(context);
     if(!context->failed) {
         ++g_group_pass_count;
         ++g_test_pass_count;
@@ -340,7 +831,177 @@ void efitest_on_post_run_test(EFITestContext* context) {
         ++g_group_error_count;
     }
 
-    if(g_post_test_callback != NULL) {
-        g_post_test_callback(context);
+    run_post_test_callback(context);
+}
+
+/*
+ * Match the qualified name of a test case (group.test or group.test[index])
+ * against the comma separated glob patterns passed via --filter.
+ * Patterns prefixed with - exclude matching tests instead.
+ */
+static BOOLEAN is_test_selected(const EFITestGroup* group, const EFITestDescriptor* test, UINTN param_index) {
+    const UINT64 case_id = compute_case_id(test->id, test->param_count, param_index);
+    if(g_shard_count > 0) {
+        const UINTN shard = g_is_shard_planned ? test->shard : (UINTN) (case_id % g_shard_count);
+        if(shard != g_shard_index) {
+            return FALSE;
+        }
+    }
+
+    if(g_run_phase != RUN_PHASE_ALL) {
+        const BOOLEAN has_failed = failures_is_previous(case_id);
+        if(has_failed != (g_run_phase == RUN_PHASE_FAILED)) {
+            return FALSE;
+        }
+    }
+
+    const char* filter = options_get("filter");
+    if(filter == NULL || *filter == '\0') {
+        return TRUE;
+    }
+
+    CHAR16 wide_name[MAX_TEST_NAME_LENGTH];
+    if(test->param_count > 0) {
+        SPrint(wide_name, sizeof(wide_name), L"%a.%a[" ETEST_FMT_UINTN "]", group->name, test->name, param_index);
+    }
+    else {
+        SPrint(wide_name, sizeof(wide_name), L"%a.%a", group->name, test->name);
+    }
+    char name[MAX_TEST_NAME_LENGTH];
+    UINTN length = 0;
+    while(wide_name[length] != L'\0') {
+        name[length] = (char) wide_name[length];
+        ++length;
+    }
+    name[length] = '\0';
+
+    BOOLEAN has_includes = FALSE;
+    BOOLEAN is_included = FALSE;
+    const char* pattern = filter;
+    while(*pattern != '\0') {
+        if(*pattern == '-') {
+            if(options_match_glob(pattern + 1, name)) {
+                return FALSE;
+            }
+        }
+        else {
+            has_includes = TRUE;
+            is_included |= options_match_glob(pattern, name);
+        }
+        while(*pattern != '\0' && *(pattern++) != ',') {
+        }
+    }
+    return !has_includes || is_included;
+}
+
+static inline UINTN get_case_count(const EFITestDescriptor* test) {
+    return test->param_count > 0 ? test->param_count : 1;
+}
+
+/*
+ * Run a test case once with memory tracking and profiling,
+ * only the test function itself is timed.
+ */
+static void run_sample(EFITestContext* context, const EFITestDescriptor* test, EFITestMemoryStats* stats) {
+    memory_begin_test();
+    profile_begin_test();
+    const UINT64 start_time = timer_get_cycles();
+    test->function(context);
+    context->duration = timer_cycles_to_ns(timer_get_cycles() - start_time);
+    profile_end_test();
+    memory_end_test(stats);
+    if(memory_has_leaked(stats)) {
+        context->failed = TRUE;
+    }
+}
+
+/*
+ * Run a passing test case a few more times, so it can be compared
+ * against its baseline using the median instead of a single sample.
+ * Every sample is torn down and set up again like a test of its own,
+ * so tests which modify state like RAM disks start out the same way.
+ */
+static void measure_case(EFITestContext* context, const EFITestDescriptor* test) {
+    UINT64 samples[BASELINES_MAX_RUNS];
+    const UINTN run_count = baselines_get_run_count();
+    samples[0] = context->duration;
+    UINTN sample_count = 1;
+    EFITestMemoryStats stats;
+    while(sample_count < run_count && !context->failed) {
+        run_post_test_callback(context);
+        efitest_on_pre_run_test(context);
+        run_sample(context, test, &stats);
+        if(memory_has_leaked(&stats)) {
+            context->memory = stats;// Report the sample which leaked
+        }
+        samples[sample_count++] = context->duration;
+    }
+    context->duration = baselines_compute_median(samples, sample_count);
+}
+
+void efitest_run_group(EFITestContext* context, const EFITestGroup* group) {
+    UINTN group_size = 0;
+    for(UINTN index = 0; index < group->test_count; ++index) {
+        const EFITestDescriptor* test = &(group->tests[index]);
+        for(UINTN param_index = 0; param_index < get_case_count(test); ++param_index) {
+            if(is_test_selected(group, test, param_index)) {
+                ++group_size;
+            }
+        }
+    }
+    if(group_size == 0) {
+        return;// Don't report groups which were filtered out completely
+    }
+
+    context->file_path = group->file_path;
+    context->file_name = group->file_name;
+    context->group_name = group->name;
+    context->group_size = group_size;
+    trace_begin(TRACE_CATEGORY_GROUP, group->name, TRACE_NO_INDEX);
+    efitest_on_pre_run_group(context);
+    profile_begin_group();
+    capture_begin_group();
+
+    const UINTN* order = soak_get_test_order(group->test_count);
+    for(UINTN position = 0; position < group->test_count; ++position) {
+        const UINTN index = order != NULL ? order[position] : position;
+        const EFITestDescriptor* test = &(group->tests[index]);
+        for(UINTN param_index = 0; param_index < get_case_count(test); ++param_index) {
+            if(!is_test_selected(group, test, param_index)) {
+                continue;
+            }
+            context->test_name = test->name;
+            context->line_number = test->line_number;
+            context->test_id = test->id;
+            context->group_index = index;
+            context->param_index = param_index;
+            context->param_count = test->param_count;
+            context->resume_point = 0;
+            context->duration = 0;
+            SetMem(&(context->memory), sizeof(EFITestMemoryStats), 0);
+            context->failed = FALSE;// Reset passed state
+            context->slower = FALSE;
+            if(test->is_async) {
+                async_start(context, test);
+                continue;
+            }
+
+            trace_begin(TRACE_CATEGORY_TEST, test->name, test->param_count > 0 ? param_index : TRACE_NO_INDEX);
+            efitest_on_pre_run_test(context);
+            capture_begin_test(context);
+            run_sample(context, test, &(context->memory));
+            if(!context->failed && baselines_is_measured(efitest_get_case_id(context))) {
+                measure_case(context, test);
+            }
+            baselines_check(context);
+            capture_end_test(context);
+            efitest_on_post_run_test(context);
+            trace_end();
+            async_poll();// Continue waiting tests whose events were signaled meanwhile
+        }
     }
-}
\ No newline at end of file
+
+    async_finish();
+    efitest_on_post_run_group(context);
+    trace_end();
+}
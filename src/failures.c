@@ -0,0 +1,145 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "failures.h"
+#include "efitest/efitest_utils.h"
+#include "resident.h"
+
+#define MAX_STORED_FAILURES 512// Keeps the variable well below common NVRAM size limits
+#define VARIABLE_ATTRIBUTES (EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+// NOLINTBEGIN
+static EFI_GUID g_vendor_guid = {0x6A3F0E2B, 0x8C1D, 0x4B7E, {0x9F, 0x52, 0x1E, 0xA4, 0xC7, 0x3D, 0x60, 0xB9}};
+static CHAR16* g_variable_name = L"EfiTestFailedTests";
+static UINT64* g_previous_ids = NULL;
+static BOOLEAN* g_previous_was_run = NULL;
+static UINTN g_previous_count = 0;
+static UINT64* g_current_ids = NULL;
+static UINTN g_current_count = 0;
+// NOLINTEND
+
+void failures_load() {
+    UINT64 ids[MAX_STORED_FAILURES];
+    UINTN size = sizeof(ids);
+    UINT32 attributes = 0;
+    const EFI_STATUS status =
+            UEFI_CALL(ST->RuntimeServices->GetVariable, g_variable_name, &g_vendor_guid, &attributes, &size, ids);
+    if(status != EFI_SUCCESS || size < sizeof(UINT64)) {
+        return;
+    }
+
+    g_previous_count = size / sizeof(UINT64);
+    g_previous_ids = malloc(g_previous_count * sizeof(UINT64));
+    g_previous_was_run = malloc(g_previous_count * sizeof(BOOLEAN));
+    memcpy(g_previous_ids, ids, g_previous_count * sizeof(UINT64));
+}
+
+/*
+ * Only the cases the runner needs are handed over: previous failures
+ * which were run, so they can be cleared, and the current failures.
+ */
+static void submit_records() {
+    UINTN count = 0;
+    FailureRecord* records = malloc((g_previous_count + g_current_count + 1) * sizeof(FailureRecord));
+    if(records == NULL) {
+        return;
+    }
+    for(UINTN index = 0; index < g_previous_count; ++index) {
+        if(g_previous_was_run[index]) {
+            records[count].case_id = g_previous_ids[index];
+            records[count++].failed = FALSE;// Set again by the current failures if it still fails
+        }
+    }
+    for(UINTN index = 0; index < g_current_count; ++index) {
+        records[count].case_id = g_current_ids[index];
+        records[count++].failed = TRUE;
+    }
+    resident_submit(RESIDENT_RECORD_FAILURES, records, count * sizeof(FailureRecord), count);
+    free(records);
+}
+
+void failures_store() {
+    if(resident_is_module()) {
+        submit_records();
+        return;
+    }
+    // Failures of tests which weren't run this time (filtered, --failed-only) are kept
+    UINTN count = 0;
+    UINT64 ids[MAX_STORED_FAILURES];
+    for(UINTN index = 0; index < g_previous_count && count < MAX_STORED_FAILURES; ++index) {
+        if(!g_previous_was_run[index]) {
+            ids[count++] = g_previous_ids[index];
+        }
+    }
+    for(UINTN index = 0; index < g_current_count && count < MAX_STORED_FAILURES; ++index) {
+        ids[count++] = g_current_ids[index];
+    }
+
+    // Avoid wearing out the flash when nothing changed
+    if(count == g_previous_count && memcmp(ids, g_previous_ids, count * sizeof(UINT64)) == 0) {
+        return;
+    }
+    const EFI_STATUS status = UEFI_CALL(ST->RuntimeServices->SetVariable, g_variable_name, &g_vendor_guid,
+                                        VARIABLE_ATTRIBUTES, count * sizeof(UINT64), count == 0 ? NULL : ids);
+    if(status != EFI_SUCCESS && !(count == 0 && status == EFI_NOT_FOUND)) {
+        RETURN_IF_ERROR(status);
+    }
+}
+
+void failures_free() {
+    free(g_previous_ids);
+    free(g_previous_was_run);
+    free(g_current_ids);
+    g_previous_ids = NULL;
+    g_previous_was_run = NULL;
+    g_current_ids = NULL;
+    g_previous_count = 0;
+    g_current_count = 0;
+}
+
+void failures_merge(const FailureRecord* records, UINTN count) {
+    for(UINTN index = 0; index < count; ++index) {
+        failures_record(records[index].case_id, records[index].failed);
+    }
+}
+
+UINTN failures_get_previous_count() {
+    return g_previous_count;
+}
+
+BOOLEAN failures_is_previous(UINT64 case_id) {
+    for(UINTN index = 0; index < g_previous_count; ++index) {
+        if(g_previous_ids[index] == case_id) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void failures_record(UINT64 case_id, BOOLEAN failed) {
+    for(UINTN index = 0; index < g_previous_count; ++index) {
+        if(g_previous_ids[index] == case_id) {
+            g_previous_was_run[index] = TRUE;
+        }
+    }
+    if(!failed) {
+        return;
+    }
+    for(UINTN index = 0; index < g_current_count; ++index) {
+        if(g_current_ids[index] == case_id) {
+            return;// Already failed during an earlier iteration of a soak run
+        }
+    }
+    g_current_ids = realloc(g_current_ids, (g_current_count + 1) * sizeof(UINT64));
+    g_current_ids[g_current_count++] = case_id;
+}
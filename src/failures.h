@@ -0,0 +1,69 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Persists the IDs of failed test cases across boots
+ * in a non-volatile UEFI variable, so they can be rerun
+ * first (or exclusively) on the next boot.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+typedef struct _FailureRecord {
+    UINT64 case_id;
+    BOOLEAN failed;
+} FailureRecord;
+
+/**
+ * Load the IDs of all test cases which failed during the previous run.
+ */
+void failures_load();
+
+/**
+ * Merge the results of the current run into the previously
+ * failed tests and store them if they changed. Modules hand
+ * their results to the resident runner instead.
+ */
+void failures_store();
+
+/**
+ * Free all memory associated with the failure history.
+ */
+void failures_free();
+
+/**
+ * @return The number of test cases which failed during the previous run.
+ */
+UINTN failures_get_previous_count();
+
+/**
+ * @param case_id The stable ID of a test case.
+ * @return True if the given test case failed during the previous run.
+ */
+BOOLEAN failures_is_previous(UINT64 case_id);
+
+/**
+ * Record the result of a test case of the current run.
+ * @param case_id The stable ID of the test case.
+ * @param failed True if the test case failed.
+ */
+void failures_record(UINT64 case_id, BOOLEAN failed);
+
+/**
+ * Record the results a module handed to the resident runner.
+ * @param records The records of the test cases the module ran.
+ * @param count The number of records.
+ */
+void failures_merge(const FailureRecord* records, UINTN count);
@@ -0,0 +1,69 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "file.h"
+#include "efitest/efitest_utils.h"
+
+#define MAX_PATH_LENGTH 256
+
+// NOLINTBEGIN
+static EFI_FILE_HANDLE g_root = NULL;
+// NOLINTEND
+
+void file_init(EFI_HANDLE image) {
+    EFI_LOADED_IMAGE* loaded_image = NULL;
+    RETURN_IF_ERROR(UEFI_CALL(ST->BootServices->HandleProtocol, image, &LoadedImageProtocol, (void**) &loaded_image));
+    g_root = LibOpenRoot(loaded_image->DeviceHandle);
+}
+
+void file_free() {
+    if(g_root == NULL) {
+        return;
+    }
+    UEFI_CALL(g_root->Close, g_root);
+    g_root = NULL;
+}
+
+EFI_STATUS file_write(const char* path, const void* data, UINTN size) {
+    if(g_root == NULL) {
+        return EFI_NOT_READY;
+    }
+
+    CHAR16 wide_path[MAX_PATH_LENGTH];
+    UINTN length = 0;
+    while(path[length] != '\0' && length < MAX_PATH_LENGTH - 1) {
+        wide_path[length] = (CHAR16) path[length];
+        ++length;
+    }
+    wide_path[length] = L'\0';
+
+    // Delete any previous version first, opening it for writing wouldn't truncate it
+    EFI_FILE_HANDLE file = NULL;
+    EFI_STATUS status = UEFI_CALL(g_root->Open, g_root, &file, wide_path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+    if(status == EFI_SUCCESS) {
+        UEFI_CALL(file->Delete, file);
+    }
+    status = UEFI_CALL(g_root->Open, g_root, &file, wide_path,
+                       EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+    if(status != EFI_SUCCESS) {
+        return status;
+    }
+
+    UINTN written_size = size;
+    status = UEFI_CALL(file->Write, file, &written_size, (void*) data);
+    if(status == EFI_SUCCESS && written_size != size) {
+        status = EFI_VOLUME_FULL;
+    }
+    UEFI_CALL(file->Close, file);
+    return status;
+}
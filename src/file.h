@@ -0,0 +1,43 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Access to files on the volume the test image was loaded
+ * from, which is usually the ESP, so results can be picked up
+ * by the host after the machine has shut down.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+/**
+ * Open the root directory of the volume the given image was loaded from.
+ * @param image The handle of the currently running image.
+ */
+void file_init(EFI_HANDLE image);
+
+/**
+ * Close the root directory opened by file_init.
+ */
+void file_free();
+
+/**
+ * Create or replace the given file with the given data.
+ * @param path A null-terminated path relative to the root of the volume,
+ *  using backslashes as separators.
+ * @param data The data to write into the file.
+ * @param size The number of bytes to write.
+ * @return EFI_SUCCESS if the file was written completely.
+ */
+EFI_STATUS file_write(const char* path, const void* data, UINTN size);
@@ -0,0 +1,204 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "memory.h"
+#include "efitest/efitest_utils.h"
+#include "options.h"
+
+#define MEMORY_MAP_SLACK 32// Additional descriptors to reserve since the map grows while testing
+
+typedef struct _MemoryMapSnapshot {
+    UINT64 pages[EfiMaxMemoryType];// The number of pages per memory type
+    BOOLEAN is_valid;              // False if the snapshot could not be taken
+} MemoryMapSnapshot;
+
+// NOLINTBEGIN
+static const char* g_memory_type_names[EfiMaxMemoryType] = {
+        "EfiReservedMemoryType",
+        "EfiLoaderCode",
+        "EfiLoaderData",
+        "EfiBootServicesCode",
+        "EfiBootServicesData",
+        "EfiRuntimeServicesCode",
+        "EfiRuntimeServicesData",
+        "EfiConventionalMemory",
+        "EfiUnusableMemory",
+        "EfiACPIReclaimMemory",
+        "EfiACPIMemoryNVS",
+        "EfiMemoryMappedIO",
+        "EfiMemoryMappedIOPortSpace",
+        "EfiPalCode",
+        "EfiPersistentMemory",
+};
+static EFITestMemoryStats g_stats = {0};
+static BOOLEAN g_is_tracking = FALSE;
+static UINTN g_live_bytes = 0;
+static EFI_MEMORY_DESCRIPTOR* g_map_buffer = NULL;
+static UINTN g_map_buffer_size = 0;
+static MemoryMapSnapshot g_snapshot_before = {0};
+static MemoryMapSnapshot g_snapshot_after = {0};
+// NOLINTEND
+
+static inline BOOLEAN is_map_tracking_enabled() {
+    return !options_has("no-memory-map");
+}
+
+static void allocate_map_buffer() {
+    UINTN map_size = 0;
+    UINTN map_key = 0;
+    UINTN descriptor_size = 0;
+    UINT32 descriptor_version = 0;
+    UEFI_CALL(ST->BootServices->GetMemoryMap, &map_size, NULL, &map_key, &descriptor_size, &descriptor_version);
+
+    // Bypass the EFITEST allocator so the buffer never shows up in any statistics
+    if(g_map_buffer != NULL) {
+        UEFI_CALL(ST->BootServices->FreePool, g_map_buffer);
+        g_map_buffer = NULL;
+    }
+    g_map_buffer_size = map_size + (MEMORY_MAP_SLACK * descriptor_size);
+    RETURN_IF_ERROR(UEFI_CALL(ST->BootServices->AllocatePool, EfiLoaderData, g_map_buffer_size, (void**) &g_map_buffer));
+}
+
+static void take_snapshot(MemoryMapSnapshot* snapshot) {
+    SetMem(snapshot, sizeof(MemoryMapSnapshot), 0);
+    if(g_map_buffer == NULL) {
+        return;
+    }
+
+    UINTN map_size = g_map_buffer_size;
+    UINTN map_key = 0;
+    UINTN descriptor_size = 0;
+    UINT32 descriptor_version = 0;
+    const EFI_STATUS status = UEFI_CALL(ST->BootServices->GetMemoryMap, &map_size, g_map_buffer, &map_key,
+                                        &descriptor_size, &descriptor_version);
+    if(status == EFI_BUFFER_TOO_SMALL) {
+        allocate_map_buffer();// Invalidates this snapshot since the map changes while reallocating
+        return;
+    }
+    if(status != EFI_SUCCESS) {
+        return;
+    }
+
+    for(UINTN offset = 0; offset < map_size; offset += descriptor_size) {
+        const EFI_MEMORY_DESCRIPTOR* descriptor = (const EFI_MEMORY_DESCRIPTOR*) (((UINT8*) g_map_buffer) + offset);
+        if(descriptor->Type < EfiMaxMemoryType) {
+            snapshot->pages[descriptor->Type] += descriptor->NumberOfPages;
+        }
+    }
+    snapshot->is_valid = TRUE;
+}
+
+void memory_init() {
+    if(is_map_tracking_enabled()) {
+        allocate_map_buffer();
+    }
+}
+
+void memory_free() {
+    if(g_map_buffer != NULL) {
+        UEFI_CALL(ST->BootServices->FreePool, g_map_buffer);
+        g_map_buffer = NULL;
+    }
+}
+
+void memory_begin_test() {
+    SetMem(&g_stats, sizeof(EFITestMemoryStats), 0);
+    g_live_bytes = 0;
+    take_snapshot(&g_snapshot_before);
+    g_is_tracking = TRUE;
+}
+
+void memory_end_test(EFITestMemoryStats* stats) {
+    g_is_tracking = FALSE;
+    take_snapshot(&g_snapshot_after);
+    *stats = g_stats;
+}
+
+void memory_begin_step(const EFITestMemoryStats* stats) {
+    g_stats = *stats;
+    g_live_bytes = stats->allocated_bytes - stats->freed_bytes;
+    g_snapshot_before.is_valid = FALSE;
+    g_snapshot_after.is_valid = FALSE;
+    g_is_tracking = TRUE;
+}
+
+void memory_end_step(EFITestMemoryStats* stats) {
+    g_is_tracking = FALSE;
+    *stats = g_stats;
+}
+
+BOOLEAN memory_suspend() {
+    const BOOLEAN was_tracking = g_is_tracking;
+    g_is_tracking = FALSE;
+    return was_tracking;
+}
+
+void memory_resume(BOOLEAN was_tracking) {
+    g_is_tracking = was_tracking;
+}
+
+BOOLEAN memory_has_leaked(const EFITestMemoryStats* stats) {
+    return stats->allocated_bytes > stats->freed_bytes;
+}
+
+void memory_print_report(const EFITestMemoryStats* stats) {
+    if(memory_has_leaked(stats)) {
+        set_colors(EFI_RED);
+        Print(ETEST_SPACER_LEAK L" ", NULL);
+        reset_colors();
+        Print(ETEST_FMT_UINTN L" bytes in " ETEST_FMT_UINTN L" allocations were not freed\n",
+              stats->allocated_bytes - stats->freed_bytes, stats->allocation_count - stats->free_count);
+    }
+
+    if(!g_snapshot_before.is_valid || !g_snapshot_after.is_valid) {
+        return;
+    }
+    for(UINTN type = 0; type < EfiMaxMemoryType; ++type) {
+        // Conventional memory shrinks whenever anything else grows
+        if(type == EfiConventionalMemory || g_snapshot_after.pages[type] <= g_snapshot_before.pages[type]) {
+            continue;
+        }
+        const UINT64 page_count = g_snapshot_after.pages[type] - g_snapshot_before.pages[type];
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER_LEAK L" ", NULL);
+        reset_colors();
+        // Newer headers know types which aren't named here
+        if(g_memory_type_names[type] != NULL) {
+            Print(ETEST_FMT_UINT64 L" pages of %a were not released\n", page_count, g_memory_type_names[type]);
+        }
+        else {
+            Print(ETEST_FMT_UINT64 L" pages of memory type " ETEST_FMT_UINTN L" were not released\n", page_count, type);
+        }
+    }
+}
+
+void efitest_memory_on_alloc(UINTN size) {
+    if(!g_is_tracking) {
+        return;
+    }
+    g_stats.allocated_bytes += size;
+    ++g_stats.allocation_count;
+    g_live_bytes += size;
+    if(g_live_bytes > g_stats.peak_bytes) {
+        g_stats.peak_bytes = g_live_bytes;
+    }
+}
+
+void efitest_memory_on_free(UINTN size) {
+    if(!g_is_tracking) {
+        return;
+    }
+    g_stats.freed_bytes += size;
+    ++g_stats.free_count;
+    g_live_bytes = g_live_bytes > size ? g_live_bytes - size : 0;
+}
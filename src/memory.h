@@ -0,0 +1,85 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Per-test accounting of the EFITEST allocator and of
+ * the firmware memory map to detect leaking tests.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+/**
+ * Allocate the buffer used for memory map snapshots.
+ * Has to be called once before running any tests.
+ */
+void memory_init();
+
+/**
+ * Free the buffer used for memory map snapshots.
+ */
+void memory_free();
+
+/**
+ * Reset the allocator statistics, take a snapshot of the
+ * memory map and start tracking allocations.
+ */
+void memory_begin_test();
+
+/**
+ * Stop tracking allocations, take a second snapshot of
+ * the memory map and store the allocator statistics.
+ * @param stats A pointer to store the statistics of the test into.
+ */
+void memory_end_test(EFITestMemoryStats* stats);
+
+/**
+ * Continue tracking allocations of a test which runs in steps interleaved
+ * with other tests, like an asynchronous test. No memory map snapshots are
+ * taken, since pages can't be attributed to a single test.
+ * @param stats A pointer to the statistics of the previous steps of the test.
+ */
+void memory_begin_step(const EFITestMemoryStats* stats);
+
+/**
+ * Stop tracking allocations and store the statistics of all steps so far.
+ * @param stats A pointer to store the statistics of the test into.
+ */
+void memory_end_step(EFITestMemoryStats* stats);
+
+/**
+ * Temporarily stop tracking allocations, used for
+ * allocations made by the runtime on behalf of a test.
+ * @return True if tracking was enabled before.
+ */
+BOOLEAN memory_suspend();
+
+/**
+ * Restore the tracking state returned by memory_suspend.
+ * @param was_tracking The value returned by memory_suspend.
+ */
+void memory_resume(BOOLEAN was_tracking);
+
+/**
+ * @param stats The allocator statistics of a test.
+ * @return True if the test did not free all of its allocations.
+ */
+BOOLEAN memory_has_leaked(const EFITestMemoryStats* stats);
+
+/**
+ * Print leaked allocator memory and all memory types which
+ * grew in the firmware memory map during the last test.
+ * @param stats The allocator statistics of the last test.
+ */
+void memory_print_report(const EFITestMemoryStats* stats);
@@ -0,0 +1,151 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "options.h"
+#include "efitest/efitest_utils.h"
+
+#define MAX_OPTIONS 64
+
+// NOLINTBEGIN
+static char* g_option_buffer = NULL;
+static const char* g_option_names[MAX_OPTIONS];
+static const char* g_option_values[MAX_OPTIONS];
+static UINTN g_option_count = 0;
+// NOLINTEND
+
+static inline BOOLEAN is_separator(char value) {
+    return value == ' ' || value == '\t' || value == '\0';
+}
+
+void options_parse(EFI_HANDLE image) {
+    EFI_LOADED_IMAGE* loaded_image = NULL;
+    RETURN_IF_ERROR(UEFI_CALL(ST->BootServices->HandleProtocol, image, &LoadedImageProtocol, (void**) &loaded_image));
+    if(loaded_image->LoadOptions == NULL || loaded_image->LoadOptionsSize < sizeof(CHAR16)) {
+        return;
+    }
+
+    // Narrow the UCS-2 options into a buffer we can split in place
+    const CHAR16* options = (const CHAR16*) loaded_image->LoadOptions;
+    const UINTN length = loaded_image->LoadOptionsSize / sizeof(CHAR16);
+    g_option_buffer = malloc(length + 1);
+    if(g_option_buffer == NULL) {
+        return;
+    }
+    UINTN copied = 0;
+    for(; copied < length && options[copied] != L'\0'; ++copied) {
+        g_option_buffer[copied] = (char) options[copied];
+    }
+    g_option_buffer[copied] = '\0';
+
+    char* current = g_option_buffer;
+    while(*current != '\0' && g_option_count < MAX_OPTIONS) {
+        while(*current != '\0' && is_separator(*current)) {
+            ++current;
+        }
+        char* token = current;
+        while(!is_separator(*current)) {
+            ++current;
+        }
+        if(*current != '\0') {
+            *(current++) = '\0';
+        }
+        if(token[0] != '-' || token[1] != '-' || token[2] == '\0') {
+            continue;
+        }
+
+        char* value = token + 2;
+        g_option_names[g_option_count] = value;
+        while(*value != '\0' && *value != '=') {
+            ++value;
+        }
+        if(*value == '=') {
+            *(value++) = '\0';
+        }
+        g_option_values[g_option_count++] = value;
+    }
+}
+
+void options_free() {
+    free(g_option_buffer);
+    g_option_buffer = NULL;
+    g_option_count = 0;
+}
+
+const char* options_get(const char* name) {
+    for(UINTN index = 0; index < g_option_count; ++index) {
+        if(strcmp(g_option_names[index], name) == 0) {
+            return g_option_values[index];
+        }
+    }
+    return NULL;
+}
+
+BOOLEAN options_has(const char* name) {
+    return options_get(name) != NULL;
+}
+
+UINTN options_get_uintn(const char* name, UINTN default_value) {
+    const char* value = options_get(name);
+    if(value == NULL || *value < '0' || *value > '9') {
+        return default_value;
+    }
+    UINTN result = 0;
+    if(value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) {
+        value += 2;
+        while(TRUE) {
+            const char digit = *(value++);
+            if(digit >= '0' && digit <= '9') {
+                result = (result << 4) | (UINTN) (digit - '0');
+            }
+            else if(digit >= 'a' && digit <= 'f') {
+                result = (result << 4) | (UINTN) (digit - 'a' + 10);
+            }
+            else if(digit >= 'A' && digit <= 'F') {
+                result = (result << 4) | (UINTN) (digit - 'A' + 10);
+            }
+            else {
+                return result;
+            }
+        }
+    }
+    while(*value >= '0' && *value <= '9') {
+        result = (result * 10) + (*(value++) - '0');
+    }
+    return result;
+}
+
+BOOLEAN options_match_glob(const char* pattern, const char* name) {// NOLINT
+    const char* backtrack_pattern = NULL;
+    const char* backtrack_name = NULL;
+    while(*name != '\0') {
+        if(*pattern == '*') {
+            backtrack_pattern = ++pattern;
+            backtrack_name = name;
+            continue;
+        }
+        if(*pattern != '\0' && *pattern != ',' && (*pattern == '?' || *pattern == *name)) {
+            ++pattern;
+            ++name;
+            continue;
+        }
+        if(backtrack_pattern == NULL) {
+            return FALSE;
+        }
+        pattern = backtrack_pattern;
+        name = ++backtrack_name;
+    }
+    while(*pattern == '*') {
+        ++pattern;
+    }
+    return *pattern == '\0' || *pattern == ',';
+}
@@ -0,0 +1,67 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Parses the load options the test image was started with
+ * into a list of --name[=value] pairs.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+/**
+ * Parse the load options of the given image.
+ * Anything not starting with -- (like the image path
+ * passed by the UEFI shell) is ignored.
+ * @param image The handle of the currently running image.
+ */
+void options_parse(EFI_HANDLE image);
+
+/**
+ * Free all memory associated with the parsed options.
+ */
+void options_free();
+
+/**
+ * Look up the value of the given option.
+ * @param name The name of the option without the leading --.
+ * @return The value of the option, an empty string if the option
+ *  was passed without a value or NULL if it was not passed at all.
+ */
+const char* options_get(const char* name);
+
+/**
+ * @param name The name of the option without the leading --.
+ * @return True if the given option was passed.
+ */
+BOOLEAN options_has(const char* name);
+
+/**
+ * Look up the value of the given option as an unsigned integer,
+ * values prefixed with 0x are parsed as hexadecimal.
+ * @param name The name of the option without the leading --.
+ * @param default_value The value to return if the option was not passed.
+ * @return The value of the option or the given default value.
+ */
+UINTN options_get_uintn(const char* name, UINTN default_value);
+
+/**
+ * Match the given name against a glob pattern which
+ * supports * and ? as wildcards.
+ * @param pattern The pattern to match against. Matching stops at
+ *  the end of the string or at the first comma.
+ * @param name A null-terminated name to match.
+ * @return True if the given name matches the pattern.
+ */
+BOOLEAN options_match_glob(const char* pattern, const char* name);
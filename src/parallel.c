@@ -0,0 +1,363 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parallel.h"
+#include "efitest/efitest_utils.h"
+#include "options.h"
+#include "timer.h"
+#include "trace.h"
+
+// The procedures are called by the firmware calling convention, which isn't the default on x86_64
+#ifdef ETEST_ARCH_AMD64
+#define PROTOCOL_API __attribute__((ms_abi))
+#else
+#define PROTOCOL_API EFIAPI
+#endif
+
+#define MP_SERVICES_PROTOCOL_GUID {0x3fdda605, 0xa76e, 0x4f46, {0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08}}
+#define START_CLOSED (((UINTN) 1) << ((sizeof(UINTN) << 3) - 1))// Set once the start was released
+#define NO_SLOT ((UINTN) -1)
+
+typedef struct _MpServicesProtocol MpServicesProtocol;
+typedef void(PROTOCOL_API* MpProcedure)(void* argument);
+typedef EFI_STATUS(PROTOCOL_API* MpGetNumberOfProcessors)(MpServicesProtocol* self, UINTN* count,
+                                                          UINTN* enabled_count);
+typedef EFI_STATUS(PROTOCOL_API* MpStartupAllAps)(MpServicesProtocol* self, MpProcedure procedure,
+                                                  BOOLEAN single_thread, EFI_EVENT wait_event, UINTN timeout,
+                                                  void* argument, UINTN** failed_processors);
+typedef EFI_STATUS(PROTOCOL_API* MpWhoAmI)(MpServicesProtocol* self, UINTN* number);
+
+struct _MpServicesProtocol {
+    MpGetNumberOfProcessors get_number_of_processors;
+    void* get_processor_info;
+    MpStartupAllAps startup_all_aps;
+    void* startup_this_ap;
+    void* switch_bsp;
+    void* enable_disable_ap;
+    MpWhoAmI who_am_i;
+};
+
+typedef struct _Failure {
+    const char* expression;
+    UINTN line_number;
+    UINTN hit_count;
+} Failure;
+
+typedef struct _Worker {
+    EFITestContext context;// Has to come first, so the worker can be found from the context
+    Failure failures[PARALLEL_MAX_FAILURES];
+    UINTN failure_count;
+    UINTN dropped_count;// The number of failures which weren't recorded since the limit was reached
+    UINTN iteration_count;
+    UINTN slot;// The order in which the processor arrived at the start
+    UINT64 start_cycles;
+    UINT64 end_cycles;
+    BOOLEAN is_active;// Determines if the processor took part in the current call
+} Worker;
+
+// NOLINTBEGIN
+static EFI_GUID g_mp_services_guid = MP_SERVICES_PROTOCOL_GUID;
+static MpServicesProtocol* g_mp_services = NULL;
+static UINTN g_processor_count = 1;// Includes disabled processors, so processor numbers can be used as indices
+static UINTN g_cpu_count = 1;      // The number of processors which may take part in a call
+static Worker* g_workers = NULL;
+static EFITestCpuStats* g_stats = NULL;
+static UINTN g_stats_count = 0;
+static BOOLEAN g_is_running = FALSE;
+// Shared by all processors during a call, only written by the bootstrap processor before the start
+static EFITestContext* g_context = NULL;
+static EFITestParallelFunction g_function = NULL;
+static void* g_data = NULL;
+static UINTN g_index_count = 0;
+static BOOLEAN g_is_per_cpu = FALSE;
+static UINTN g_participant_count = 0;
+static UINT64 g_start_cycles = 0;
+// Modified by all processors during a call
+static UINTN g_arrived_count = 0;// The number of processors which claimed a slot, or'd with START_CLOSED
+static BOOLEAN g_is_started = FALSE;
+static UINTN g_next_index = 0;
+static UINTN g_barrier_count = 0;
+static UINTN g_barrier_generation = 0;
+// NOLINTEND
+
+static inline void relax() {
+#if defined(ETEST_ARCH_AMD64) || defined(ETEST_ARCH_IA32)
+    __builtin_ia32_pause();
+#elif defined(ETEST_ARCH_ARM64) || defined(ETEST_ARCH_ARM)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Claim the next slot at the start. Processors arriving after the start
+ * was released, or after enough processors arrived, stay out of the call.
+ */
+static UINTN arrive() {
+    UINTN count = __atomic_load_n(&g_arrived_count, __ATOMIC_ACQUIRE);
+    do {
+        if((count & START_CLOSED) != 0 || count >= g_cpu_count) {
+            return NO_SLOT;
+        }
+    } while(!__atomic_compare_exchange_n(&g_arrived_count, &count, count + 1, TRUE, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE));
+    return count;
+}
+
+static void run_worker(Worker* worker, UINTN slot) {
+    worker->context = *g_context;
+    worker->context.failed = FALSE;
+    worker->failure_count = 0;
+    worker->dropped_count = 0;
+    worker->iteration_count = 0;
+    worker->slot = slot;
+    worker->is_active = TRUE;
+    while(!__atomic_load_n(&g_is_started, __ATOMIC_ACQUIRE)) {
+        relax();
+    }
+
+    worker->start_cycles = timer_get_cycles();
+    if(g_is_per_cpu) {
+        g_function(&(worker->context), slot, g_data);
+        worker->iteration_count = 1;
+    }
+    else {
+        UINTN index = __atomic_fetch_add(&g_next_index, 1, __ATOMIC_RELAXED);
+        for(; index < g_index_count; index = __atomic_fetch_add(&g_next_index, 1, __ATOMIC_RELAXED)) {
+            g_function(&(worker->context), index, g_data);
+            ++worker->iteration_count;
+        }
+    }
+    worker->end_cycles = timer_get_cycles();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void PROTOCOL_API run_application_processor(void* argument) {
+    (void) argument;
+    UINTN number = 0;
+    if(UEFI_CALL(g_mp_services->who_am_i, g_mp_services, &number) != EFI_SUCCESS || number >= g_processor_count) {
+        return;
+    }
+    const UINTN slot = arrive();
+    if(slot != NO_SLOT) {
+        run_worker(&(g_workers[number]), slot);
+    }
+}
+
+/*
+ * Starts the application processors without blocking, so the bootstrap
+ * processor can release all of them at once and take part itself.
+ * Returns the event signaled once all of them returned, or NULL if none run.
+ */
+static EFI_EVENT start_application_processors() {
+    if(g_mp_services == NULL || g_cpu_count < 2) {
+        return NULL;
+    }
+    EFI_EVENT event = NULL;
+    if(UEFI_CALL(ST->BootServices->CreateEvent, 0, 0, NULL, NULL, &event) != EFI_SUCCESS) {
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    const EFI_STATUS status = UEFI_CALL(g_mp_services->startup_all_aps, g_mp_services, run_application_processor,
+                                        FALSE, event, 0, NULL, NULL);
+    if(status != EFI_SUCCESS) {
+        UEFI_CALL(ST->BootServices->CloseEvent, event);
+        return NULL;
+    }
+    return event;
+}
+
+/*
+ * Merges the failures of every processor into the error list and
+ * collects their timing, ordered by the slot they started in.
+ */
+static void collect_workers(EFITestContext* context) {
+    g_stats_count = 0;
+    for(UINTN number = 0; number < g_processor_count; ++number) {
+        const Worker* worker = &(g_workers[number]);
+        if(!worker->is_active) {
+            continue;
+        }
+        EFITestCpuStats* stats = &(g_stats[worker->slot]);
+        stats->processor_number = number;
+        stats->iteration_count = worker->iteration_count;
+        stats->duration = timer_cycles_to_ns(worker->end_cycles - g_start_cycles);
+        ++g_stats_count;
+        trace_add_span(TRACE_CATEGORY_PARALLEL, context->test_name, number, worker->start_cycles,
+                       worker->end_cycles);
+
+        for(UINTN index = 0; index < worker->failure_count; ++index) {
+            const Failure* failure = &(worker->failures[index]);
+            efitest_assert_failed(context, failure->line_number, failure->expression, failure->hit_count);
+        }
+        if(worker->dropped_count > 0) {
+            efitest_assert_failed(context, context->line_number, "Too many failed assertions on one processor",
+                                  worker->dropped_count);
+        }
+        if(worker->context.failed) {
+            context->failed = TRUE;
+        }
+    }
+}
+
+static UINTN run(EFITestContext* context, UINTN count, EFITestParallelFunction function, void* data,
+                 BOOLEAN is_per_cpu) {
+    const UINTN number = parallel_get_processor_number();
+    if(g_is_running || g_workers == NULL || number >= g_processor_count) {
+        efitest_assert(FALSE, context, context->line_number, "Parallel calls can't be nested");
+        return 0;
+    }
+    g_is_running = TRUE;
+    g_context = context;
+    g_function = function;
+    g_data = data;
+    g_index_count = count;
+    g_is_per_cpu = is_per_cpu;
+    g_arrived_count = 0;
+    g_is_started = FALSE;
+    g_next_index = 0;
+    g_barrier_count = 0;
+    for(UINTN index = 0; index < g_processor_count; ++index) {
+        g_workers[index].is_active = FALSE;
+    }
+
+    const UINTN slot = arrive();// The bootstrap processor always arrives first
+    EFI_EVENT event = start_application_processors();
+    const UINTN expected_count = event != NULL ? g_cpu_count : 1;
+    const UINT64 timeout = timer_get_cycles_per_us() * PARALLEL_START_TIMEOUT;
+    const UINT64 wait_start_cycles = timer_get_cycles();
+    while(__atomic_load_n(&g_arrived_count, __ATOMIC_ACQUIRE) < expected_count &&
+          timer_get_cycles() - wait_start_cycles < timeout) {
+        relax();
+    }
+    g_participant_count = __atomic_fetch_or(&g_arrived_count, START_CLOSED, __ATOMIC_ACQ_REL);
+    g_start_cycles = timer_get_cycles();
+    __atomic_store_n(&g_is_started, TRUE, __ATOMIC_RELEASE);
+
+    run_worker(&(g_workers[number]), slot);
+    if(event != NULL) {
+        UINTN index = 0;
+        UEFI_CALL(ST->BootServices->WaitForEvent, 1, &event, &index);
+        UEFI_CALL(ST->BootServices->CloseEvent, event);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    collect_workers(context);
+    g_is_running = FALSE;
+    return g_participant_count;
+}
+
+void parallel_init() {
+    UINTN enabled_count = 1;
+    EFI_STATUS status =
+            UEFI_CALL(ST->BootServices->LocateProtocol, &g_mp_services_guid, NULL, (void**) &g_mp_services);
+    if(status == EFI_SUCCESS) {
+        status = UEFI_CALL(g_mp_services->get_number_of_processors, g_mp_services, &g_processor_count,
+                           &enabled_count);
+    }
+    if(status != EFI_SUCCESS || g_processor_count == 0 || enabled_count == 0) {
+        g_mp_services = NULL;
+        g_processor_count = 1;
+        enabled_count = 1;
+    }
+    g_cpu_count = options_get_uintn("cpus", enabled_count);
+    if(g_cpu_count == 0 || g_cpu_count > enabled_count) {
+        g_cpu_count = enabled_count;
+    }
+    g_workers = malloc(g_processor_count * sizeof(Worker));
+    g_stats = malloc(g_processor_count * sizeof(EFITestCpuStats));
+    if(g_workers == NULL || g_stats == NULL) {
+        parallel_free();
+    }
+}
+
+void parallel_free() {
+    free(g_workers);
+    free(g_stats);
+    g_workers = NULL;
+    g_stats = NULL;
+    g_stats_count = 0;
+}
+
+UINTN parallel_get_processor_number() {
+    UINTN number = 0;
+    if(g_mp_services == NULL || UEFI_CALL(g_mp_services->who_am_i, g_mp_services, &number) != EFI_SUCCESS) {
+        return 0;
+    }
+    return number;
+}
+
+BOOLEAN parallel_is_worker(const EFITestContext* context) {
+    return g_workers != NULL && (const UINT8*) context >= (const UINT8*) g_workers &&
+           (const UINT8*) context < (const UINT8*) (g_workers + g_processor_count);
+}
+
+BOOLEAN parallel_record_failure(EFITestContext* context, UINTN line_number, const char* expression) {
+    if(!parallel_is_worker(context)) {
+        return FALSE;
+    }
+    Worker* worker = (Worker*) context;
+    context->failed = TRUE;
+    for(UINTN index = 0; index < worker->failure_count; ++index) {
+        Failure* failure = &(worker->failures[index]);
+        if(failure->line_number == line_number &&
+           (failure->expression == expression || strcmp(failure->expression, expression) == 0)) {
+            ++failure->hit_count;
+            return TRUE;
+        }
+    }
+    if(worker->failure_count == PARALLEL_MAX_FAILURES) {
+        ++worker->dropped_count;
+        return TRUE;
+    }
+    Failure* failure = &(worker->failures[worker->failure_count++]);
+    failure->expression = expression;
+    failure->line_number = line_number;
+    failure->hit_count = 1;
+    return TRUE;
+}
+
+UINTN efitest_parallel_for(EFITestContext* context, UINTN count, EFITestParallelFunction function, void* data) {
+    return run(context, count, function, data, FALSE);
+}
+
+UINTN efitest_run_on_all_cpus(EFITestContext* context, EFITestParallelFunction function, void* data) {
+    return run(context, 0, function, data, TRUE);
+}
+
+/*
+ * Counts arriving processors per generation, the last one to
+ * arrive resets the count and lets the others continue.
+ */
+void efitest_parallel_barrier() {
+    if(!g_is_running || !g_is_per_cpu) {
+        return;
+    }
+    const UINTN generation = __atomic_load_n(&g_barrier_generation, __ATOMIC_ACQUIRE);
+    if(__atomic_add_fetch(&g_barrier_count, 1, __ATOMIC_ACQ_REL) == g_participant_count) {
+        __atomic_store_n(&g_barrier_count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_barrier_generation, generation + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    while(__atomic_load_n(&g_barrier_generation, __ATOMIC_ACQUIRE) == generation) {
+        relax();
+    }
+}
+
+UINTN efitest_get_cpu_count() {
+    return g_cpu_count;
+}
+
+const EFITestCpuStats* efitest_parallel_get_stats(UINTN* count) {
+    *count = g_stats_count;
+    return g_stats;
+}
@@ -0,0 +1,60 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/**
+ * Runs test code on several processors at once through the
+ * MP services, with a spin barrier for synchronized starts and
+ * per-processor failure lists which are merged into the error
+ * list of the bootstrap processor once all processors finished.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define PARALLEL_MAX_FAILURES 16         // The number of distinct failed assertion sites recorded per processor
+#define PARALLEL_START_TIMEOUT 1000000ULL// Microseconds to wait for processors which don't show up to a start
+
+/**
+ * Locate the MP services and allocate the state of every processor,
+ * the number of processors used can be limited via --cpus=<count>.
+ */
+void parallel_init();
+
+/**
+ * Free the state of all processors.
+ */
+void parallel_free();
+
+/**
+ * @return The number of the processor calling this function
+ *  as reported by the MP services, 0 without them.
+ */
+UINTN parallel_get_processor_number();
+
+/**
+ * Record a failed assertion made with the context of a processor
+ * running a parallel function, since those can't touch the shared
+ * error list.
+ * @param context The context the assertion was made with.
+ * @param line_number The line number of the assertion.
+ * @param expression The asserted expression.
+ * @return True if the failure was recorded, false if the given
+ *  context doesn't belong to a parallel function.
+ */
+BOOLEAN parallel_record_failure(EFITestContext* context, UINTN line_number, const char* expression);
+
+/**
+ * @param context The context to check.
+ * @return True if the given context belongs to a processor running a parallel function.
+ */
+BOOLEAN parallel_is_worker(const EFITestContext* context);
@@ -0,0 +1,343 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "profile.h"
+#include "efitest/efitest_utils.h"
+#include "memory.h"
+#include "options.h"
+#include "timer.h"
+
+#define NODE_NONE ((UINTN) -1)
+#define NODE_ROOT 0
+
+typedef struct _ProfileEvent {
+    const char* name;// The name of the opened zone, NULL if this event closes a zone
+    UINT64 cycles;   // The value of the cycle counter when the event was recorded
+} ProfileEvent;
+
+typedef struct _ProfileNode {
+    const char* name;       // The name of the zone, NULL for the root node
+    UINTN parent;           // The index of the parent node
+    UINTN first_child;      // The index of the first child node or NODE_NONE
+    UINTN next_sibling;     // The index of the next sibling node or NODE_NONE
+    UINT64 inclusive_cycles;// The cycles spent in the zone including all nested zones
+    UINT64 child_cycles;    // The cycles spent in directly nested zones
+    UINTN call_count;       // The number of times the zone was entered
+} ProfileNode;
+
+typedef struct _ProfileTree {
+    ProfileNode* nodes;// The nodes of the tree, the first one being the root
+    UINTN count;       // The number of nodes in use
+    UINTN capacity;    // The number of allocated nodes
+    UINTN dropped;     // The number of zones which didn't fit into the tree
+} ProfileTree;
+
+typedef struct _StackEntry {
+    UINTN node;   // The node of the open zone
+    UINT64 cycles;// The value of the cycle counter when the zone was opened
+} StackEntry;
+
+// NOLINTBEGIN
+static ProfileEvent* g_events = NULL;
+static UINTN g_event_count = 0;
+static UINTN g_event_capacity = 0;
+static UINTN g_open_count = 0;   // The number of recorded zones which weren't closed yet
+static UINTN g_dropped_depth = 0;// The number of open zones which were dropped since the buffer was full
+static UINTN g_dropped_count = 0;
+static StackEntry* g_stack = NULL;
+static ProfileTree g_test_tree = {0};
+static ProfileTree g_group_tree = {0};
+// NOLINTEND
+
+static void tree_init(ProfileTree* tree, UINTN capacity) {
+    tree->nodes = malloc(capacity * sizeof(ProfileNode));
+    tree->capacity = capacity;
+}
+
+static void tree_reset(ProfileTree* tree) {
+    if(tree->nodes == NULL) {
+        return;
+    }
+    SetMem(&(tree->nodes[NODE_ROOT]), sizeof(ProfileNode), 0);
+    tree->nodes[NODE_ROOT].first_child = NODE_NONE;
+    tree->nodes[NODE_ROOT].next_sibling = NODE_NONE;
+    tree->count = 1;
+    tree->dropped = 0;
+}
+
+static void tree_free(ProfileTree* tree) {
+    free(tree->nodes);
+    SetMem(tree, sizeof(ProfileTree), 0);
+}
+
+static UINTN tree_get_child(ProfileTree* tree, UINTN parent, const char* name) {
+    if(parent == NODE_NONE) {
+        return NODE_NONE;
+    }
+    UINTN last_child = NODE_NONE;
+    for(UINTN index = tree->nodes[parent].first_child; index != NODE_NONE; index = tree->nodes[index].next_sibling) {
+        const char* node_name = tree->nodes[index].name;
+        if(node_name == name || strcmp(node_name, name) == 0) {// Usually the same literal
+            return index;
+        }
+        last_child = index;
+    }
+    if(tree->count == tree->capacity) {
+        ++tree->dropped;
+        return NODE_NONE;
+    }
+
+    const UINTN index = tree->count++;
+    ProfileNode* node = &(tree->nodes[index]);
+    SetMem(node, sizeof(ProfileNode), 0);
+    node->name = name;
+    node->parent = parent;
+    node->first_child = NODE_NONE;
+    node->next_sibling = NODE_NONE;
+    // Append so children are reported in the order they were first entered
+    if(last_child == NODE_NONE) {
+        tree->nodes[parent].first_child = index;
+    }
+    else {
+        tree->nodes[last_child].next_sibling = index;
+    }
+    return index;
+}
+
+static void tree_add_events(ProfileTree* tree) {
+    if(tree->nodes == NULL) {
+        return;
+    }
+    UINTN depth = 0;
+    for(UINTN index = 0; index < g_event_count; ++index) {
+        const ProfileEvent* event = &(g_events[index]);
+        if(event->name != NULL) {
+            const UINTN parent = depth == 0 ? NODE_ROOT : g_stack[depth - 1].node;
+            g_stack[depth].node = tree_get_child(tree, parent, event->name);
+            g_stack[depth++].cycles = event->cycles;
+            continue;
+        }
+        if(depth == 0) {
+            continue;
+        }
+        const StackEntry* entry = &(g_stack[--depth]);
+        if(entry->node == NODE_NONE) {
+            continue;
+        }
+        ProfileNode* node = &(tree->nodes[entry->node]);
+        const UINT64 cycles = event->cycles - entry->cycles;
+        node->inclusive_cycles += cycles;
+        ++node->call_count;
+        tree->nodes[node->parent].child_cycles += cycles;
+    }
+}
+
+static void print_node(const ProfileTree* tree, UINTN index, UINTN depth) {// NOLINT
+    const ProfileNode* node = &(tree->nodes[index]);
+    Print(ETEST_SPACER L" ", NULL);
+    for(UINTN level = 0; level < depth; ++level) {
+        Print(L"  ", NULL);
+    }
+    set_colors(EFI_WHITE);
+    Print(L"%a", node->name);
+    set_colors(EFI_DARKGRAY);
+    Print(L" " ETEST_FMT_UINT64 L" cycles (" ETEST_FMT_UINT64 L"us), " ETEST_FMT_UINT64 L" exclusive, " ETEST_FMT_UINTN
+          L" call%a\n",
+          node->inclusive_cycles, timer_cycles_to_ns(node->inclusive_cycles) / 1000,
+          node->inclusive_cycles - node->child_cycles, node->call_count, node->call_count == 1 ? "" : "s");
+    reset_colors();
+    for(UINTN child = node->first_child; child != NODE_NONE; child = tree->nodes[child].next_sibling) {
+        print_node(tree, child, depth + 1);
+    }
+}
+
+static void print_tree(const ProfileTree* tree, const char* kind, const char* name) {
+    if(tree->count <= 1) {
+        return;
+    }
+    Print(ETEST_SPACER L" Profile of %a '%a':\n", kind, name);
+    for(UINTN child = tree->nodes[NODE_ROOT].first_child; child != NODE_NONE; child = tree->nodes[child].next_sibling) {
+        print_node(tree, child, 1);
+    }
+    if(tree->dropped > 0) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" " ETEST_FMT_UINTN L" zones were dropped, increase --profile-buffer to record them\n",
+              tree->dropped);
+        reset_colors();
+    }
+}
+
+static BOOLEAN is_report_mode(const char* mode) {
+    const char* value = options_get("profile");
+    if(value == NULL || *value == '\0') {
+        value = "test";
+    }
+    return strcmp(mode, value) == 0;
+}
+
+static void append_path(Buffer* buffer, const ProfileTree* tree, UINTN index) {// NOLINT
+    const ProfileNode* node = &(tree->nodes[index]);
+    if(node->parent != NODE_ROOT) {
+        append_path(buffer, tree, node->parent);
+        buffer_append(buffer, "/");
+    }
+    buffer_append_escaped(buffer, node->name);
+}
+
+void profile_init() {
+#ifdef ETEST_ENABLE_PROFILING// Otherwise the macros compile to nothing and no zones can be recorded
+    g_event_capacity = options_get_uintn("profile-buffer", PROFILE_DEFAULT_EVENT_COUNT);
+    if(g_event_capacity < 2) {
+        return;
+    }
+    // Every zone takes two events, so this bounds both the nesting depth and the number of nodes
+    const UINTN max_zones = (g_event_capacity >> 1) + 1;
+    g_events = malloc(g_event_capacity * sizeof(ProfileEvent));
+    g_stack = malloc(max_zones * sizeof(StackEntry));
+    tree_init(&g_test_tree, max_zones);
+    tree_init(&g_group_tree, max_zones);
+    if(g_events == NULL || g_stack == NULL || g_test_tree.nodes == NULL || g_group_tree.nodes == NULL) {
+        profile_free();// Record nothing rather than part of the zones
+    }
+#endif
+}
+
+void profile_free() {
+    free(g_events);
+    free(g_stack);
+    tree_free(&g_test_tree);
+    tree_free(&g_group_tree);
+    g_events = NULL;
+    g_stack = NULL;
+    g_event_capacity = 0;
+}
+
+void profile_begin_group() {
+    tree_reset(&g_group_tree);
+}
+
+void profile_begin_test() {
+    g_event_count = 0;
+    g_open_count = 0;
+    g_dropped_depth = 0;
+    g_dropped_count = 0;
+}
+
+void profile_end_test() {
+    while(g_open_count > 0 || g_dropped_depth > 0) {
+        efitest_profile_end();
+    }
+    tree_reset(&g_test_tree);
+    tree_add_events(&g_test_tree);
+    tree_add_events(&g_group_tree);
+    g_test_tree.dropped += g_dropped_count;
+    g_group_tree.dropped += g_dropped_count;
+}
+
+void profile_suspend_test(ProfileState* state) {
+    while(g_open_count > 0 || g_dropped_depth > 0) {
+        efitest_profile_end();
+    }
+    state->events.length = 0;
+    if(g_event_count > 0) {
+        const BOOLEAN was_tracking = memory_suspend();
+        buffer_append_data(&(state->events), g_events, g_event_count * sizeof(ProfileEvent));
+        memory_resume(was_tracking);
+    }
+    state->dropped_count = g_dropped_count;
+}
+
+void profile_resume_test(ProfileState* state) {
+    profile_begin_test();
+    if(state->events.length > 0) {// Never more than fit, since they came from the same buffer
+        g_event_count = state->events.length / sizeof(ProfileEvent);
+        memcpy(g_events, state->events.data, state->events.length);
+        state->events.length = 0;
+    }
+    g_dropped_count = state->dropped_count;
+}
+
+void profile_free_state(ProfileState* state) {
+    buffer_free(&(state->events));
+    SetMem(state, sizeof(ProfileState), 0);
+}
+
+void profile_print_test_report(const EFITestContext* context) {
+    if(is_report_mode("test")) {
+        print_tree(&g_test_tree, "test", context->test_name);
+    }
+}
+
+void profile_print_group_report(const EFITestContext* context) {
+    if(is_report_mode("group")) {
+        print_tree(&g_group_tree, "group", context->group_name);
+    }
+}
+
+BOOLEAN profile_has_zones() {
+    return g_test_tree.count > 1;
+}
+
+void profile_append_json(Buffer* buffer) {
+    buffer_append(buffer, "[");
+    for(UINTN index = 1; index < g_test_tree.count; ++index) {
+        const ProfileNode* node = &(g_test_tree.nodes[index]);
+        buffer_append(buffer, index == 1 ? "{\"path\": \"" : ", {\"path\": \"");
+        append_path(buffer, &g_test_tree, index);
+        buffer_append(buffer, "\", \"calls\": ");
+        buffer_append_uint64(buffer, node->call_count);
+        buffer_append(buffer, ", \"inclusive_cycles\": ");
+        buffer_append_uint64(buffer, node->inclusive_cycles);
+        buffer_append(buffer, ", \"exclusive_cycles\": ");
+        buffer_append_uint64(buffer, node->inclusive_cycles - node->child_cycles);
+        buffer_append(buffer, "}");
+    }
+    buffer_append(buffer, "]");
+}
+
+/*
+ * Room for the end events of all open zones is always kept,
+ * so the recorded events stay balanced when the buffer fills up.
+ */
+const char* efitest_profile_begin(const char* name) {
+    if(g_dropped_depth > 0 || g_event_count + g_open_count + 2 > g_event_capacity) {
+        ++g_dropped_depth;
+        ++g_dropped_count;
+        return name;
+    }
+    ProfileEvent* event = &(g_events[g_event_count++]);
+    event->name = name;
+    ++g_open_count;
+    event->cycles = timer_get_cycles();// Sample last to keep our own overhead out of the zone
+    return name;
+}
+
+void efitest_profile_end() {
+    const UINT64 cycles = timer_get_cycles();
+    if(g_dropped_depth > 0) {
+        --g_dropped_depth;
+        return;
+    }
+    if(g_open_count == 0) {
+        return;// Unbalanced end, ignore it
+    }
+    ProfileEvent* event = &(g_events[g_event_count++]);
+    event->name = NULL;
+    event->cycles = cycles;
+    --g_open_count;
+}
+
+void efitest_profile_end_scope(const char** name) {
+    (void) name;
+    efitest_profile_end();
+}
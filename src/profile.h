@@ -0,0 +1,100 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Records nested profiling zones opened by ETEST_PROFILE_SCOPE and
+ * ETEST_PROFILE_BEGIN/END into a preallocated buffer which is reset
+ * for every test, and aggregates them into per-test and per-group
+ * call trees with inclusive/exclusive cycle counts.
+ */
+
+#pragma once
+
+#include "buffer.h"
+#include "efitest/efitest.h"
+
+#define PROFILE_DEFAULT_EVENT_COUNT 4096
+
+typedef struct _ProfileState {
+    Buffer events;      // The events recorded so far, moved out of the shared event buffer
+    UINTN dropped_count;// The number of zones dropped so far
+} ProfileState;
+
+/**
+ * Allocate the event buffer and call trees, their size can be
+ * changed via --profile-buffer=<events>.
+ */
+void profile_init();
+
+/**
+ * Free the event buffer and call trees.
+ */
+void profile_free();
+
+/**
+ * Reset the call tree of the current group.
+ */
+void profile_begin_group();
+
+/**
+ * Reset the event buffer before running a test.
+ */
+void profile_begin_test();
+
+/**
+ * Close all zones still open and aggregate the recorded
+ * events into the call trees of the test and its group.
+ */
+void profile_end_test();
+
+/**
+ * Close all zones still open and move the events recorded so far out of
+ * the shared event buffer, so other tests can be profiled while it waits.
+ * @param state The state to move the events of the test into.
+ */
+void profile_suspend_test(ProfileState* state);
+
+/**
+ * Reset the event buffer and restore the events of a test suspended by profile_suspend_test.
+ * @param state The state the test was suspended into, which is emptied.
+ */
+void profile_resume_test(ProfileState* state);
+
+/**
+ * Free the events held by the given state.
+ * @param state The state to free.
+ */
+void profile_free_state(ProfileState* state);
+
+/**
+ * Print the call tree of the last test unless --profile=group or --profile=none was passed.
+ * @param context The context of the test which just finished.
+ */
+void profile_print_test_report(const EFITestContext* context);
+
+/**
+ * Print the call tree of the current group if --profile=group was passed.
+ * @param context The context of the group which just finished.
+ */
+void profile_print_group_report(const EFITestContext* context);
+
+/**
+ * @return True if the last test recorded any zones.
+ */
+BOOLEAN profile_has_zones();
+
+/**
+ * Append the zones of the last test as a JSON array to the given buffer.
+ * @param buffer The buffer to append to.
+ */
+void profile_append_json(Buffer* buffer);
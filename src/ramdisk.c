@@ -0,0 +1,490 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ramdisk.h"
+#include "efitest/efitest_utils.h"
+
+// The protocols are called by the firmware calling convention, which isn't the default on x86_64
+#ifdef ETEST_ARCH_AMD64
+#define PROTOCOL_API __attribute__((ms_abi))
+#else
+#define PROTOCOL_API EFIAPI
+#endif
+
+#define RAM_DISK_PROTOCOL_GUID {0xab38a0df, 0x6873, 0x44a9, {0x87, 0xe6, 0xd4, 0xeb, 0x56, 0x14, 0x84, 0x49}}
+#define VIRTUAL_DISK_GUID {0x77ab535a, 0x45fc, 0x624b, {0x55, 0x60, 0xf7, 0xb2, 0x81, 0xd1, 0xf9, 0x6e}}
+#define EMULATED_DISK_GUID {0x5f1c8e3a, 0x9b47, 0x4d2e, {0x8a, 0x61, 0x3c, 0x0d, 0x72, 0xe4, 0xb9, 0x15}}
+
+#define DISK_FROM_BLOCK_IO2(x) ((EFITestRamDisk*) (((UINT8*) (x)) - __builtin_offsetof(EFITestRamDisk, block_io2)))
+
+typedef EFI_STATUS(PROTOCOL_API* RamDiskRegister)(UINT64 base, UINT64 size, EFI_GUID* type,
+                                                  EFI_DEVICE_PATH* parent_path, EFI_DEVICE_PATH** path);
+typedef EFI_STATUS(PROTOCOL_API* RamDiskUnregister)(EFI_DEVICE_PATH* path);
+
+typedef struct _RamDiskProtocol {
+    RamDiskRegister register_disk;
+    RamDiskUnregister unregister_disk;
+} RamDiskProtocol;
+
+typedef struct _EmulatedDevicePath {
+    VENDOR_DEVICE_PATH vendor;
+    UINT32 index;// Makes the path of every emulated disk unique
+    EFI_DEVICE_PATH end;
+} EmulatedDevicePath;
+
+struct _EFITestRamDisk {
+    EFI_BLOCK_IO block_io;// Has to come first, so the disk can be found from the protocol
+    EFI_BLOCK_IO2_PROTOCOL block_io2;
+    EFI_BLOCK_IO_MEDIA media;
+    EmulatedDevicePath device_path;
+    EFI_HANDLE handle;
+    EFI_BLOCK_IO* interface;             // The block I/O protocol installed on the handle
+    EFI_BLOCK_IO2_PROTOCOL* interface2;  // The block I/O 2 protocol of registered disks, NULL if there is none
+    EFI_BLOCK_WRITE firmware_write;      // The write function of the firmware driver, wrapped to track writes
+    EFI_BLOCK_WRITE_EX firmware_write_ex;// The same for block I/O 2
+    EFI_DEVICE_PATH* firmware_path;      // The path returned by EFI_RAM_DISK_PROTOCOL, NULL if emulated
+    const UINT8* image;                  // The initial contents, NULL if the disk starts out zeroed
+    UINT8* data;                         // The contents of disks registered through the firmware
+    UINT8** chunks;                      // Written chunks of emulated disks, unwritten ones are read from the image
+    UINTN chunk_count;
+    UINTN chunk_size;
+    UINT64 size;
+    UINT32 flags;
+    BOOLEAN is_dirty;// Set by every write, so disks which weren't written aren't reset
+    struct _EFITestRamDisk* next;
+};
+
+// NOLINTBEGIN
+static EFI_GUID g_ram_disk_protocol_guid = RAM_DISK_PROTOCOL_GUID;
+static EFI_GUID g_virtual_disk_guid = VIRTUAL_DISK_GUID;
+static EFI_GUID g_block_io2_guid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+static EFITestRamDisk* g_disks = NULL;// All disks which are alive
+static UINT32 g_next_index = 0;
+// NOLINTEND
+
+// Disks bypass the EFITEST allocator, so their contents never show up as allocations of the test writing them
+static void* allocate(UINTN size) {
+    void* address = NULL;
+    RETURN_IF_ERROR(UEFI_CALL(ST->BootServices->AllocatePool, EfiLoaderData, size, &address), NULL);
+    return address;
+}
+
+static inline void release(void* address) {
+    if(address != NULL) {
+        UEFI_CALL(ST->BootServices->FreePool, address);
+    }
+}
+
+static inline UINT64 min_uint64(UINT64 a, UINT64 b) {
+    return a < b ? a : b;
+}
+
+static EFI_STATUS check_request(const EFITestRamDisk* disk, UINT32 media_id, EFI_LBA lba, UINTN size,
+                                const void* buffer) {
+    if(media_id != disk->media.MediaId) {
+        return EFI_MEDIA_CHANGED;
+    }
+    if(buffer == NULL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if(size % disk->media.BlockSize != 0) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+    const UINT64 block_count = disk->size / disk->media.BlockSize;
+    if(lba >= block_count || (size / disk->media.BlockSize) > block_count - lba) {
+        return EFI_INVALID_PARAMETER;
+    }
+    return EFI_SUCCESS;
+}
+
+static void read_range(const EFITestRamDisk* disk, UINT64 offset, UINTN size, UINT8* buffer) {
+    while(size > 0) {
+        const UINTN chunk_index = offset / disk->chunk_size;
+        const UINTN chunk_offset = offset % disk->chunk_size;
+        const UINTN length = min_uint64(size, disk->chunk_size - chunk_offset);
+        const UINT8* chunk = disk->chunks[chunk_index];
+        if(chunk != NULL) {
+            memcpy(buffer, chunk + chunk_offset, length);
+        }
+        else if(disk->image != NULL) {
+            memcpy(buffer, disk->image + offset, length);
+        }
+        else {
+            memset(buffer, 0, length);
+        }
+        offset += length;
+        buffer += length;
+        size -= length;
+    }
+}
+
+static EFI_STATUS write_range(EFITestRamDisk* disk, UINT64 offset, UINTN size, const UINT8* buffer) {
+    while(size > 0) {
+        const UINTN chunk_index = offset / disk->chunk_size;
+        const UINTN chunk_offset = offset % disk->chunk_size;
+        const UINTN length = min_uint64(size, disk->chunk_size - chunk_offset);
+        UINT8* chunk = disk->chunks[chunk_index];
+        if(chunk == NULL) {
+            chunk = allocate(disk->chunk_size);
+            if(chunk == NULL) {
+                return EFI_OUT_OF_RESOURCES;
+            }
+            if(length < disk->chunk_size) {// Copy the chunk before writing to it
+                const UINT64 chunk_start = offset - chunk_offset;
+                read_range(disk, chunk_start, min_uint64(disk->chunk_size, disk->size - chunk_start), chunk);
+            }
+            disk->chunks[chunk_index] = chunk;
+        }
+        memcpy(chunk + chunk_offset, buffer, length);
+        offset += length;
+        buffer += length;
+        size -= length;
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS read_blocks(EFITestRamDisk* disk, UINT32 media_id, EFI_LBA lba, UINTN size, void* buffer) {
+    const EFI_STATUS status = check_request(disk, media_id, lba, size, buffer);
+    if(status != EFI_SUCCESS) {
+        return status;
+    }
+    read_range(disk, lba * disk->media.BlockSize, size, buffer);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS write_blocks(EFITestRamDisk* disk, UINT32 media_id, EFI_LBA lba, UINTN size, void* buffer) {
+    if(disk->media.ReadOnly) {
+        return EFI_WRITE_PROTECTED;
+    }
+    const EFI_STATUS status = check_request(disk, media_id, lba, size, buffer);
+    if(status != EFI_SUCCESS) {
+        return status;
+    }
+    disk->is_dirty = TRUE;
+    return write_range(disk, lba * disk->media.BlockSize, size, buffer);
+}
+
+static EFI_STATUS complete_token(EFI_BLOCK_IO2_TOKEN* token, EFI_STATUS status) {
+    if(token == NULL || token->Event == NULL || status != EFI_SUCCESS) {
+        return status;// Blocking request or it was never queued
+    }
+    token->TransactionStatus = EFI_SUCCESS;
+    UEFI_CALL(ST->BootServices->SignalEvent, token->Event);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS PROTOCOL_API block_io_reset(EFI_BLOCK_IO* self, BOOLEAN extended_verification) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS PROTOCOL_API block_io_read(EFI_BLOCK_IO* self, UINT32 media_id, EFI_LBA lba, UINTN size,
+                                             void* buffer) {
+    return read_blocks((EFITestRamDisk*) self, media_id, lba, size, buffer);
+}
+
+static EFI_STATUS PROTOCOL_API block_io_write(EFI_BLOCK_IO* self, UINT32 media_id, EFI_LBA lba, UINTN size,
+                                              void* buffer) {
+    return write_blocks((EFITestRamDisk*) self, media_id, lba, size, buffer);
+}
+
+static EFI_STATUS PROTOCOL_API block_io_flush(EFI_BLOCK_IO* self) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS PROTOCOL_API block_io2_reset(EFI_BLOCK_IO2_PROTOCOL* self, BOOLEAN extended_verification) {
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS PROTOCOL_API block_io2_read(EFI_BLOCK_IO2_PROTOCOL* self, UINT32 media_id, EFI_LBA lba,
+                                              EFI_BLOCK_IO2_TOKEN* token, UINTN size, void* buffer) {
+    return complete_token(token, read_blocks(DISK_FROM_BLOCK_IO2(self), media_id, lba, size, buffer));
+}
+
+static EFI_STATUS PROTOCOL_API block_io2_write(EFI_BLOCK_IO2_PROTOCOL* self, UINT32 media_id, EFI_LBA lba,
+                                               EFI_BLOCK_IO2_TOKEN* token, UINTN size, void* buffer) {
+    return complete_token(token, write_blocks(DISK_FROM_BLOCK_IO2(self), media_id, lba, size, buffer));
+}
+
+static EFI_STATUS PROTOCOL_API block_io2_flush(EFI_BLOCK_IO2_PROTOCOL* self, EFI_BLOCK_IO2_TOKEN* token) {
+    return complete_token(token, EFI_SUCCESS);
+}
+
+static inline BOOLEAN is_emulated(const EFITestRamDisk* disk) {
+    return disk->firmware_path == NULL;
+}
+
+static void set_node_length(EFI_DEVICE_PATH* node, UINT16 length) {
+    node->Length[0] = (UINT8) (length & 0xFF);
+    node->Length[1] = (UINT8) (length >> 8);
+}
+
+static EFI_STATUS install_emulated(EFITestRamDisk* disk) {
+    const UINTN block_size = disk->media.BlockSize;
+    disk->chunk_size = block_size < RAMDISK_CHUNK_SIZE ? (RAMDISK_CHUNK_SIZE / block_size) * block_size : block_size;
+    disk->chunk_count = (disk->size + disk->chunk_size - 1) / disk->chunk_size;
+    disk->chunks = allocate(disk->chunk_count * sizeof(UINT8*));
+    if(disk->chunks == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    memset(disk->chunks, 0, disk->chunk_count * sizeof(UINT8*));
+
+    disk->block_io.Revision = EFI_BLOCK_IO_PROTOCOL_REVISION3;
+    disk->block_io.Media = &(disk->media);
+    disk->block_io.Reset = (EFI_BLOCK_RESET) block_io_reset;
+    disk->block_io.ReadBlocks = (EFI_BLOCK_READ) block_io_read;
+    disk->block_io.WriteBlocks = (EFI_BLOCK_WRITE) block_io_write;
+    disk->block_io.FlushBlocks = (EFI_BLOCK_FLUSH) block_io_flush;
+    disk->block_io2.Media = &(disk->media);
+    disk->block_io2.Reset = (EFI_BLOCK_RESET_EX) block_io2_reset;
+    disk->block_io2.ReadBlocksEx = (EFI_BLOCK_READ_EX) block_io2_read;
+    disk->block_io2.WriteBlocksEx = (EFI_BLOCK_WRITE_EX) block_io2_write;
+    disk->block_io2.FlushBlocksEx = (EFI_BLOCK_FLUSH_EX) block_io2_flush;
+
+    const EFI_GUID vendor_guid = EMULATED_DISK_GUID;
+    disk->device_path.vendor.Header.Type = HARDWARE_DEVICE_PATH;
+    disk->device_path.vendor.Header.SubType = HW_VENDOR_DP;
+    set_node_length(&(disk->device_path.vendor.Header), sizeof(VENDOR_DEVICE_PATH) + sizeof(UINT32));
+    disk->device_path.vendor.Guid = vendor_guid;
+    disk->device_path.index = g_next_index++;
+    disk->device_path.end.Type = END_DEVICE_PATH_TYPE;
+    disk->device_path.end.SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE;
+    set_node_length(&(disk->device_path.end), sizeof(EFI_DEVICE_PATH));
+
+    const EFI_STATUS status = UEFI_CALL(ST->BootServices->InstallMultipleProtocolInterfaces, &(disk->handle),
+                                        &BlockIoProtocol, &(disk->block_io), &g_block_io2_guid, &(disk->block_io2),
+                                        &DevicePathProtocol, &(disk->device_path), NULL);
+    if(status != EFI_SUCCESS) {
+        return status;
+    }
+    disk->interface = &(disk->block_io);
+    UEFI_CALL(ST->BootServices->ConnectController, disk->handle, NULL, NULL, TRUE);
+    return EFI_SUCCESS;
+}
+
+static EFITestRamDisk* find_registered(const void* interface) {
+    for(EFITestRamDisk* disk = g_disks; disk != NULL; disk = disk->next) {
+        if(disk->interface == interface || disk->interface2 == interface) {
+            return disk;
+        }
+    }
+    return NULL;
+}
+
+static EFI_STATUS PROTOCOL_API firmware_write(EFI_BLOCK_IO* self, UINT32 media_id, EFI_LBA lba, UINTN size,
+                                              void* buffer) {
+    EFITestRamDisk* disk = find_registered(self);
+    disk->is_dirty = TRUE;
+    return UEFI_CALL(disk->firmware_write, self, media_id, lba, size, buffer);
+}
+
+static EFI_STATUS PROTOCOL_API firmware_write_ex(EFI_BLOCK_IO2_PROTOCOL* self, UINT32 media_id, EFI_LBA lba,
+                                                 EFI_BLOCK_IO2_TOKEN* token, UINTN size, void* buffer) {
+    EFITestRamDisk* disk = find_registered(self);
+    disk->is_dirty = TRUE;
+    return UEFI_CALL(disk->firmware_write_ex, self, media_id, lba, token, size, buffer);
+}
+
+/*
+ * The firmware driver writes to the data of the disk directly,
+ * so its write functions are wrapped to notice when to reset it.
+ */
+static void wrap_firmware_writes(EFITestRamDisk* disk) {
+    disk->firmware_write = disk->interface->WriteBlocks;
+    disk->interface->WriteBlocks = (EFI_BLOCK_WRITE) firmware_write;
+    if(UEFI_CALL(ST->BootServices->HandleProtocol, disk->handle, &g_block_io2_guid, (void**) &(disk->interface2)) !=
+       EFI_SUCCESS) {
+        disk->interface2 = NULL;
+        return;
+    }
+    disk->firmware_write_ex = disk->interface2->WriteBlocksEx;
+    disk->interface2->WriteBlocksEx = (EFI_BLOCK_WRITE_EX) firmware_write_ex;
+}
+
+static void unwrap_firmware_writes(EFITestRamDisk* disk) {
+    if(disk->firmware_write != NULL) {
+        disk->interface->WriteBlocks = disk->firmware_write;
+    }
+    if(disk->firmware_write_ex != NULL) {
+        disk->interface2->WriteBlocksEx = disk->firmware_write_ex;
+    }
+}
+
+static EFI_STATUS install_registered(EFITestRamDisk* disk, RamDiskProtocol* protocol) {
+    disk->data = allocate(disk->size);
+    if(disk->data == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    if(disk->image != NULL) {
+        memcpy(disk->data, disk->image, disk->size);
+    }
+    else {
+        memset(disk->data, 0, disk->size);
+    }
+
+    // The firmware connects the drivers to the new disk by itself
+    EFI_STATUS status = UEFI_CALL(protocol->register_disk, (UINT64) (UINTN) disk->data, disk->size,
+                                  &g_virtual_disk_guid, NULL, &(disk->firmware_path));
+    if(status != EFI_SUCCESS) {
+        disk->firmware_path = NULL;
+        release(disk->data);
+        disk->data = NULL;
+        return status;
+    }
+    EFI_DEVICE_PATH* path = disk->firmware_path;
+    status = UEFI_CALL(ST->BootServices->LocateDevicePath, &BlockIoProtocol, &path, &(disk->handle));
+    if(status == EFI_SUCCESS) {
+        status = UEFI_CALL(ST->BootServices->HandleProtocol, disk->handle, &BlockIoProtocol,
+                           (void**) &(disk->interface));
+    }
+    if(status == EFI_SUCCESS) {
+        wrap_firmware_writes(disk);
+    }
+    return status;
+}
+
+static void uninstall(EFITestRamDisk* disk) {
+    if(!is_emulated(disk)) {
+        unwrap_firmware_writes(disk);
+        RamDiskProtocol* protocol = NULL;
+        if(UEFI_CALL(ST->BootServices->LocateProtocol, &g_ram_disk_protocol_guid, NULL, (void**) &protocol) ==
+           EFI_SUCCESS) {
+            UEFI_CALL(protocol->unregister_disk, disk->firmware_path);
+        }
+        release(disk->firmware_path);
+        release(disk->data);
+        return;
+    }
+    if(disk->handle != NULL) {
+        UEFI_CALL(ST->BootServices->DisconnectController, disk->handle, NULL, NULL);
+        UEFI_CALL(ST->BootServices->UninstallMultipleProtocolInterfaces, disk->handle, &BlockIoProtocol,
+                  &(disk->block_io), &g_block_io2_guid, &(disk->block_io2), &DevicePathProtocol,
+                  &(disk->device_path), NULL);
+    }
+    if(disk->chunks != NULL) {
+        for(UINTN index = 0; index < disk->chunk_count; ++index) {
+            release(disk->chunks[index]);
+        }
+        release(disk->chunks);
+    }
+}
+
+static EFITestRamDisk* create(const void* image, UINT64 size, UINT32 block_size, UINT32 flags) {
+    if(block_size == 0 || size == 0 || size % block_size != 0) {
+        efitest_loglnfa("RAM disk size " ETEST_FMT_UINT64 " is no multiple of its block size %u", size, block_size);
+        return NULL;
+    }
+    EFITestRamDisk* disk = allocate(sizeof(EFITestRamDisk));
+    if(disk == NULL) {
+        return NULL;
+    }
+    memset(disk, 0, sizeof(EFITestRamDisk));
+    disk->image = image;
+    disk->size = size;
+    disk->flags = flags;
+    disk->media.MediaPresent = TRUE;
+    disk->media.ReadOnly = (flags & ETEST_RAMDISK_READ_ONLY) != 0;
+    disk->media.BlockSize = block_size;
+    disk->media.IoAlign = 1;
+    disk->media.LastBlock = (size / block_size) - 1;
+    disk->media.LogicalBlocksPerPhysicalBlock = 1;
+
+    RamDiskProtocol* protocol = NULL;
+    const BOOLEAN can_register = block_size == ETEST_RAMDISK_BLOCK_SIZE &&
+                                 (flags & (ETEST_RAMDISK_READ_ONLY | ETEST_RAMDISK_EMULATED)) == 0;
+    if(can_register && UEFI_CALL(ST->BootServices->LocateProtocol, &g_ram_disk_protocol_guid, NULL,
+                                 (void**) &protocol) != EFI_SUCCESS) {
+        protocol = NULL;
+    }
+    const EFI_STATUS status = protocol != NULL ? install_registered(disk, protocol) : install_emulated(disk);
+    if(status != EFI_SUCCESS) {
+        efitest_loglnfa("Could not create RAM disk: %r", status);
+        uninstall(disk);
+        release(disk);
+        return NULL;
+    }
+    disk->next = g_disks;
+    g_disks = disk;
+    return disk;
+}
+
+EFITestRamDisk* efitest_ramdisk_create(UINT64 size, UINT32 block_size, UINT32 flags) {
+    return create(NULL, size, block_size, flags);
+}
+
+EFITestRamDisk* efitest_ramdisk_create_from_image(const void* image, UINT64 size, UINT32 block_size, UINT32 flags) {
+    return create(image, size, block_size, flags);
+}
+
+void efitest_ramdisk_reset(EFITestRamDisk* disk) {
+    if(!disk->is_dirty) {
+        return;
+    }
+    disk->is_dirty = FALSE;
+    if(is_emulated(disk)) {
+        for(UINTN index = 0; index < disk->chunk_count; ++index) {
+            release(disk->chunks[index]);
+            disk->chunks[index] = NULL;
+        }
+        ++disk->media.MediaId;// Makes drivers holding on to the old media notice the change
+    }
+    else if(disk->image != NULL) {
+        memcpy(disk->data, disk->image, disk->size);
+    }
+    else {
+        memset(disk->data, 0, disk->size);
+    }
+    // Reconnects all drivers, so filesystems don't keep serving cached state
+    UEFI_CALL(ST->BootServices->ReinstallProtocolInterface, disk->handle, &BlockIoProtocol, disk->interface,
+              disk->interface);
+}
+
+void efitest_ramdisk_destroy(EFITestRamDisk* disk) {
+    if(disk == NULL) {
+        return;
+    }
+    EFITestRamDisk** link = &g_disks;
+    while(*link != NULL && *link != disk) {
+        link = &((*link)->next);
+    }
+    if(*link != NULL) {
+        *link = disk->next;
+    }
+    uninstall(disk);
+    release(disk);
+}
+
+EFI_HANDLE efitest_ramdisk_get_handle(const EFITestRamDisk* disk) {
+    return disk->handle;
+}
+
+EFI_BLOCK_IO* efitest_ramdisk_get_block_io(const EFITestRamDisk* disk) {
+    return disk->interface;
+}
+
+BOOLEAN efitest_ramdisk_is_emulated(const EFITestRamDisk* disk) {
+    return is_emulated(disk);
+}
+
+void ramdisk_reset_all() {
+    for(EFITestRamDisk* disk = g_disks; disk != NULL; disk = disk->next) {
+        if((disk->flags & ETEST_RAMDISK_RESET_BETWEEN_TESTS) != 0) {
+            efitest_ramdisk_reset(disk);
+        }
+    }
+}
+
+void ramdisk_free() {
+    while(g_disks != NULL) {
+        efitest_ramdisk_destroy(g_disks);
+    }
+}
@@ -0,0 +1,28 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "efitest/efitest_ramdisk.h"
+
+#define RAMDISK_CHUNK_SIZE 65536// The granularity at which writes to emulated disks are copied
+
+/**
+ * Restore all disks which were created with ETEST_RAMDISK_RESET_BETWEEN_TESTS.
+ */
+void ramdisk_reset_all();
+
+/**
+ * Destroy all disks which are still alive.
+ */
+void ramdisk_free();
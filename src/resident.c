@@ -0,0 +1,419 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "resident.h"
+#include "baselines.h"
+#include "buffer.h"
+#include "efitest/efitest_utils.h"
+#include "failures.h"
+#include "options.h"
+#include "results.h"
+#include "soak.h"
+#include "timer.h"
+#include "trace.h"
+
+#define MAX_MODULE_NAME_LENGTH 128
+#define MAX_DIRECTORY_LENGTH 256
+#define FILE_INFO_BUFFER_SIZE (sizeof(EFI_FILE_INFO) + (MAX_MODULE_NAME_LENGTH * sizeof(CHAR16)))
+#define MIN_MODULE_CAPACITY 16
+#define RESIDENT_PROTOCOL_REVISION 2
+#define RESIDENT_PROTOCOL_GUID {0x3e1c5a07, 0x52d9, 0x4f6b, {0x9c, 0x28, 0x6a, 0x41, 0xd0, 0x7e, 0xb3, 0x95}}
+
+// The runner is called by the firmware calling convention, which isn't the default on x86_64
+#ifdef ETEST_ARCH_AMD64
+#define PROTOCOL_API __attribute__((ms_abi))
+#else
+#define PROTOCOL_API EFIAPI
+#endif
+
+typedef struct _ResidentProtocol {
+    UINT32 revision;
+    void(PROTOCOL_API* report)(UINTN test_count, UINTN pass_count);
+    // Since revision 2
+    void(PROTOCOL_API* submit)(UINT32 kind, const void* data, UINTN size, UINTN count);
+    UINT64 start_cycles;
+} ResidentProtocol;
+
+typedef struct _Module {
+    EFI_HANDLE volume;
+    CHAR16 name[MAX_MODULE_NAME_LENGTH];
+    EFI_TIME modification_time;
+    UINT64 size;
+    BOOLEAN is_present;// Found by the last scan
+    BOOLEAN is_stale;  // Changed since it was last run
+    BOOLEAN has_run;
+    BOOLEAN has_reported;
+    EFI_STATUS status;
+    UINTN test_count;
+    UINTN pass_count;
+    UINT64 duration;
+    Buffer records[RESIDENT_RECORD_KIND_COUNT];// The records submitted during the last run
+    UINTN record_counts[RESIDENT_RECORD_KIND_COUNT];
+} Module;
+
+// NOLINTBEGIN
+static EFI_GUID g_protocol_guid = RESIDENT_PROTOCOL_GUID;
+static ResidentProtocol g_protocol;
+static ResidentProtocol* g_runner = NULL;// The runner which loaded the current image, NULL if it was booted directly
+static Module* g_modules = NULL;
+static UINTN g_module_count = 0;
+static UINTN g_module_capacity = 0;
+static Module* g_running_module = NULL;
+static CHAR16 g_directory[MAX_DIRECTORY_LENGTH];
+static void* g_load_options = NULL;// Passed on to every module
+static UINT32 g_load_options_size = 0;
+static UINTN g_run_count = 0;
+// NOLINTEND
+
+static void PROTOCOL_API report_results(UINTN test_count, UINTN pass_count) {
+    if(g_running_module == NULL) {
+        return;
+    }
+    g_running_module->test_count = test_count;
+    g_running_module->pass_count = pass_count;
+    g_running_module->has_reported = TRUE;
+}
+
+static void PROTOCOL_API submit_records(UINT32 kind, const void* data, UINTN size, UINTN count) {
+    if(g_running_module == NULL || kind >= RESIDENT_RECORD_KIND_COUNT) {
+        return;
+    }
+    Buffer* records = &(g_running_module->records[kind]);
+    records->length = 0;
+    if(size > 0) {
+        buffer_append_data(records, data, size);
+    }
+    g_running_module->record_counts[kind] = count;
+}
+
+static void free_records(Module* module) {
+    for(UINTN kind = 0; kind < RESIDENT_RECORD_KIND_COUNT; ++kind) {
+        buffer_free(&(module->records[kind]));
+        module->record_counts[kind] = 0;
+    }
+}
+
+static BOOLEAN is_module_name(const CHAR16* name) {
+    const UINTN length = StrLen(name);
+    if(length < 5 || length >= MAX_MODULE_NAME_LENGTH) {
+        return FALSE;
+    }
+    const CHAR16* extension = name + length - 4;
+    return extension[0] == L'.' && (extension[1] | 0x20) == L'e' && (extension[2] | 0x20) == L'f' &&
+           (extension[3] | 0x20) == L'i';
+}
+
+static void update_module(EFI_HANDLE volume, const EFI_FILE_INFO* info) {
+    for(UINTN index = 0; index < g_module_count; ++index) {
+        Module* module = &(g_modules[index]);
+        if(module->volume != volume || StrCmp(module->name, info->FileName) != 0) {
+            continue;
+        }
+        module->is_present = TRUE;
+        if(module->size != info->FileSize ||
+           CompareMem(&(module->modification_time), &(info->ModificationTime), sizeof(EFI_TIME)) != 0) {
+            module->size = info->FileSize;
+            module->modification_time = info->ModificationTime;
+            module->is_stale = TRUE;
+        }
+        return;
+    }
+
+    if(g_module_count == g_module_capacity) {
+        const UINTN capacity = g_module_capacity == 0 ? MIN_MODULE_CAPACITY : g_module_capacity << 1;
+        Module* modules = realloc(g_modules, capacity * sizeof(Module));
+        if(modules == NULL) {
+            return;// Picked up again by the next scan
+        }
+        g_modules = modules;
+        g_module_capacity = capacity;
+    }
+    Module* module = &(g_modules[g_module_count++]);
+    memset(module, 0, sizeof(Module));
+    module->volume = volume;
+    StrCpy(module->name, info->FileName);
+    module->modification_time = info->ModificationTime;
+    module->size = info->FileSize;
+    module->is_present = TRUE;
+    module->is_stale = TRUE;
+}
+
+static void scan_volume(EFI_HANDLE volume) {
+    EFI_FILE_HANDLE root = LibOpenRoot(volume);
+    if(root == NULL) {
+        return;
+    }
+    EFI_FILE_HANDLE directory = NULL;
+    if(UEFI_CALL(root->Open, root, &directory, g_directory, EFI_FILE_MODE_READ, 0) == EFI_SUCCESS) {
+        UINT64 buffer[(FILE_INFO_BUFFER_SIZE + sizeof(UINT64) - 1) / sizeof(UINT64)];// Keeps the info aligned
+        while(TRUE) {
+            UINTN size = sizeof(buffer);
+            if(UEFI_CALL(directory->Read, directory, &size, buffer) != EFI_SUCCESS || size == 0) {
+                break;// Entries with longer names than any module may have are reported as errors too
+            }
+            const EFI_FILE_INFO* info = (const EFI_FILE_INFO*) buffer;
+            if((info->Attribute & EFI_FILE_DIRECTORY) == 0 && is_module_name(info->FileName)) {
+                update_module(volume, info);
+            }
+        }
+        UEFI_CALL(directory->Close, directory);
+    }
+    UEFI_CALL(root->Close, root);
+}
+
+/*
+ * Find the modules in the module directory of every volume, so modules
+ * can be copied onto the ESP or come from a directory shared by the host.
+ */
+static void scan_modules() {
+    for(UINTN index = 0; index < g_module_count; ++index) {
+        g_modules[index].is_present = FALSE;
+    }
+
+    UINTN volume_count = 0;
+    EFI_HANDLE* volumes = NULL;
+    if(UEFI_CALL(ST->BootServices->LocateHandleBuffer, ByProtocol, &FileSystemProtocol, NULL, &volume_count,
+                 &volumes) == EFI_SUCCESS) {
+        for(UINTN index = 0; index < volume_count; ++index) {
+            scan_volume(volumes[index]);
+        }
+        UEFI_CALL(ST->BootServices->FreePool, volumes);
+    }
+
+    UINTN count = 0;
+    for(UINTN index = 0; index < g_module_count; ++index) {
+        if(!g_modules[index].is_present) {
+            Print(ETEST_SPACER L" Module %s was removed\n", g_modules[index].name);
+            free_records(&(g_modules[index]));
+            continue;
+        }
+        g_modules[count++] = g_modules[index];
+    }
+    g_module_count = count;
+}
+
+static void run_module(EFI_HANDLE image, Module* module) {
+    set_colors(EFI_BACKGROUND_BLUE | EFI_WHITE);
+    Print(L"== Running module %s ==\n", module->name);
+    reset_colors();
+    Print(L"\n", NULL);
+
+    module->is_stale = FALSE;
+    module->has_run = TRUE;
+    module->has_reported = FALSE;
+    for(UINTN kind = 0; kind < RESIDENT_RECORD_KIND_COUNT; ++kind) {
+        module->records[kind].length = 0;// Modules which fail to start leave no records behind
+        module->record_counts[kind] = 0;
+    }
+    CHAR16 path[MAX_DIRECTORY_LENGTH + MAX_MODULE_NAME_LENGTH];
+    SPrint(path, sizeof(path), L"%s\\%s", g_directory, module->name);
+    EFI_DEVICE_PATH* device_path = FileDevicePath(module->volume, path);
+    if(device_path == NULL) {
+        module->status = EFI_OUT_OF_RESOURCES;
+        return;
+    }
+
+    const UINT64 start_time = timer_get_cycles();
+    EFI_HANDLE child = NULL;
+    EFI_STATUS status = UEFI_CALL(ST->BootServices->LoadImage, FALSE, image, device_path, NULL, 0, &child);
+    if(status == EFI_SUCCESS) {
+        EFI_LOADED_IMAGE* loaded_image = NULL;
+        if(UEFI_CALL(ST->BootServices->HandleProtocol, child, &LoadedImageProtocol, (void**) &loaded_image) ==
+           EFI_SUCCESS) {
+            loaded_image->LoadOptions = g_load_options;
+            loaded_image->LoadOptionsSize = g_load_options_size;
+        }
+        // The firmware unloads the module once it returns, the next run always loads the latest build
+        g_running_module = module;
+        status = UEFI_CALL(ST->BootServices->StartImage, child, NULL, NULL);
+        g_running_module = NULL;
+    }
+    module->duration = timer_cycles_to_ns(timer_get_cycles() - start_time);
+    module->status = status;
+    UEFI_CALL(ST->BootServices->FreePool, device_path);
+}
+
+static void print_summary() {
+    Print(ETEST_SPACER L" Resident run " ETEST_FMT_UINTN L" finished\n", g_run_count);
+    for(UINTN index = 0; index < g_module_count; ++index) {
+        const Module* module = &(g_modules[index]);
+        if(!module->has_run) {
+            continue;
+        }
+        const BOOLEAN passed = module->has_reported && module->pass_count == module->test_count;
+        set_colors(passed ? EFI_GREEN : EFI_RED);
+        Print(passed ? ETEST_SPACER_OK L" " : ETEST_SPACER_FAILED L" ", NULL);
+        reset_colors();
+        if(module->has_reported) {
+            Print(L"%s: " ETEST_FMT_UINTN L"/" ETEST_FMT_UINTN L" %s (" ETEST_FMT_UINT64 L"ms)\n", module->name,
+                  module->pass_count, module->test_count,
+                  soak_is_enabled() ? L"test cases passed over all iterations" : L"tests passed",
+                  module->duration / 1000000);
+        }
+        else {
+            Print(L"%s: returned without results (%r)\n", module->name, module->status);
+        }
+    }
+    set_colors(EFI_DARKGRAY);
+    Print(L"Changed modules are rerun automatically, press r to rerun all modules or q to quit\n\n", NULL);
+    reset_colors();
+}
+
+/*
+ * Every output is written once per run from the records of all modules,
+ * including those of modules which weren't rerun since they didn't change.
+ */
+static void store_records() {
+    failures_load();
+    for(UINTN index = 0; index < g_module_count; ++index) {
+        const Module* module = &(g_modules[index]);
+        const Buffer* records = module->records;
+        const UINTN* counts = module->record_counts;
+        failures_merge((const FailureRecord*) records[RESIDENT_RECORD_FAILURES].data,
+                       counts[RESIDENT_RECORD_FAILURES]);
+        results_merge(records[RESIDENT_RECORD_RESULTS].data, counts[RESIDENT_RECORD_RESULTS]);
+        baselines_merge(records[RESIDENT_RECORD_BASELINES].data, counts[RESIDENT_RECORD_BASELINES]);
+        trace_merge(records[RESIDENT_RECORD_TRACE].data, counts[RESIDENT_RECORD_TRACE]);
+    }
+    failures_store();
+    results_store();
+    baselines_store();
+    trace_store();
+    failures_free();
+    results_free();
+    baselines_free();
+    trace_free();
+}
+
+static void parse_directory_option() {
+    const char* value = options_get("modules");
+    if(value == NULL || *value == '\0') {
+        value = RESIDENT_DEFAULT_DIRECTORY;
+    }
+    UINTN length = 0;
+    while(value[length] != '\0' && length < MAX_DIRECTORY_LENGTH - 1) {
+        g_directory[length] = value[length] == '/' ? L'\\' : (CHAR16) value[length];
+        ++length;
+    }
+    g_directory[length] = L'\0';
+}
+
+void resident_init() {
+    if(UEFI_CALL(ST->BootServices->LocateProtocol, &g_protocol_guid, NULL, (void**) &g_runner) != EFI_SUCCESS) {
+        g_runner = NULL;
+    }
+}
+
+BOOLEAN resident_is_module() {
+    return g_runner != NULL;
+}
+
+void resident_report(UINTN test_count, UINTN pass_count) {
+    if(g_runner != NULL) {
+        UEFI_CALL(g_runner->report, test_count, pass_count);
+    }
+}
+
+void resident_submit(ResidentRecordKind kind, const void* data, UINTN size, UINTN count) {
+    if(g_runner != NULL && g_runner->revision >= 2) {
+        UEFI_CALL(g_runner->submit, (UINT32) kind, data, size, count);
+    }
+}
+
+UINT64 resident_get_start_cycles() {
+    if(g_runner != NULL && g_runner->revision >= 2) {
+        return g_runner->start_cycles;
+    }
+    return timer_get_cycles();
+}
+
+void resident_run(EFI_HANDLE image) {
+    parse_directory_option();
+    soak_parse_options();// The options are passed on, so every module runs the same soak run
+    EFI_LOADED_IMAGE* loaded_image = NULL;
+    if(UEFI_CALL(ST->BootServices->HandleProtocol, image, &LoadedImageProtocol, (void**) &loaded_image) ==
+       EFI_SUCCESS) {
+        g_load_options = loaded_image->LoadOptions;
+        g_load_options_size = loaded_image->LoadOptionsSize;
+    }
+
+    g_protocol.revision = RESIDENT_PROTOCOL_REVISION;
+    g_protocol.report = report_results;
+    g_protocol.submit = submit_records;
+    g_protocol.start_cycles = timer_get_cycles();
+    RETURN_IF_ERROR(UEFI_CALL(ST->BootServices->InstallProtocolInterface, &image, &g_protocol_guid,
+                              EFI_NATIVE_INTERFACE, &g_protocol));
+    // Without the timer, the modules are only scanned again once a key was pressed
+    EFI_EVENT events[2] = {ST->ConIn->WaitForKey, NULL};
+    UINTN event_count = 1;
+    const UINT64 interval = options_get_uintn("scan-interval", RESIDENT_DEFAULT_SCAN_INTERVAL);
+    if(UEFI_CALL(ST->BootServices->CreateEvent, EVT_TIMER, 0, NULL, NULL, &(events[1])) == EFI_SUCCESS) {
+        if(UEFI_CALL(ST->BootServices->SetTimer, events[1], TimerPeriodic, interval * 10000) == EFI_SUCCESS) {
+            event_count = 2;
+        }
+        else {
+            UEFI_CALL(ST->BootServices->CloseEvent, events[1]);
+        }
+    }
+    Print(ETEST_SPACER L" Resident runner loading modules from %s\n\n", g_directory);
+    if(event_count < 2) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Could not create the scan timer, press any key to rescan the modules\n\n", NULL);
+        reset_colors();
+    }
+
+    BOOLEAN rerun_all = TRUE;
+    while(TRUE) {
+        scan_modules();
+        BOOLEAN has_run = FALSE;
+        for(UINTN index = 0; index < g_module_count; ++index) {
+            Module* module = &(g_modules[index]);
+            if(rerun_all || module->is_stale) {
+                run_module(image, module);
+                has_run = TRUE;
+            }
+        }
+        if(has_run) {
+            ++g_run_count;
+            store_records();
+            print_summary();
+        }
+        else if(rerun_all) {
+            Print(ETEST_SPACER L" No modules found, waiting for modules to appear\n\n", NULL);
+        }
+        rerun_all = FALSE;
+
+        UINTN event_index = 0;
+        UEFI_CALL(ST->BootServices->WaitForEvent, event_count, events, &event_index);
+        EFI_INPUT_KEY key;
+        if(event_index != 0 || UEFI_CALL(ST->ConIn->ReadKeyStroke, ST->ConIn, &key) != EFI_SUCCESS) {
+            continue;
+        }
+        if(key.UnicodeChar == L'q') {
+            break;
+        }
+        rerun_all = key.UnicodeChar == L'r';
+    }
+
+    if(event_count == 2) {
+        UEFI_CALL(ST->BootServices->CloseEvent, events[1]);
+    }
+    UEFI_CALL(ST->BootServices->UninstallProtocolInterface, image, &g_protocol_guid, &g_protocol);
+    for(UINTN index = 0; index < g_module_count; ++index) {
+        free_records(&(g_modules[index]));
+    }
+    free(g_modules);
+    g_modules = NULL;
+    g_module_count = 0;
+    g_module_capacity = 0;
+}
@@ -0,0 +1,77 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Resident runner which boots once and then loads test modules from
+ * disk with LoadImage/StartImage, rerunning them whenever they change.
+ * Modules are regular test images which find the runner through its
+ * protocol, report their results to it and return instead of shutting down.
+ * Modules hand their records to the runner instead of writing them, so
+ * failures, results, baselines and traces are written once per run.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define RESIDENT_DEFAULT_DIRECTORY "\\EFI\\efitest"// Searched on every volume, changed via --modules=<path>
+#define RESIDENT_DEFAULT_SCAN_INTERVAL 1000        // Milliseconds between scans, changed via --scan-interval=<ms>
+
+typedef enum _ResidentRecordKind {
+    RESIDENT_RECORD_FAILURES, // An array of FailureRecord
+    RESIDENT_RECORD_RESULTS,  // JSON objects of the results file
+    RESIDENT_RECORD_BASELINES,// JSON objects of the baselines file
+    RESIDENT_RECORD_TRACE,    // JSON objects of the trace file
+    RESIDENT_RECORD_KIND_COUNT
+} ResidentRecordKind;
+
+/**
+ * Look for a resident runner which loaded the current image.
+ */
+void resident_init();
+
+/**
+ * @return True if the current image was loaded by a resident runner.
+ */
+BOOLEAN resident_is_module();
+
+/**
+ * Pass the results of the current module to the runner which loaded it.
+ * Does nothing if the current image was booted directly.
+ * @param test_count The number of test cases which were run, summed over all soak iterations.
+ * @param pass_count The number of test cases which passed, summed over all soak iterations.
+ */
+void resident_report(UINTN test_count, UINTN pass_count);
+
+/**
+ * Run all modules found on any volume, then keep rerunning
+ * changed modules until q is pressed. Pressing r reruns all modules.
+ * @param image The handle of the runner image, modules are loaded as its children.
+ */
+void resident_run(EFI_HANDLE image);
+
+/**
+ * Hand records of the current module to the runner which loaded it. They
+ * replace the records the module submitted during its previous run.
+ * @param kind The kind of the records.
+ * @param data The records, which are copied.
+ * @param size The size of the records in bytes.
+ * @param count The number of records.
+ */
+void resident_submit(ResidentRecordKind kind, const void* data, UINTN size, UINTN count);
+
+/**
+ * @return The cycle count the runner started at if the current image is a module,
+ *  so the traces of all modules share a timeline, otherwise the current cycle count.
+ */
+UINT64 resident_get_start_cycles();
@@ -0,0 +1,221 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "results.h"
+#include "buffer.h"
+#include "efitest/efitest_utils.h"
+#include "file.h"
+#include "options.h"
+#include "profile.h"
+#include "resident.h"
+
+#define MIN_SLOT_COUNT 64
+
+typedef struct _ResultEntry {
+    UINT64 test_id;
+    UINT64 case_id;
+    const char* group_name;
+    const char* test_name;
+    UINTN param_index;
+    const char* status;// The status of the last run
+    UINT64 duration;   // The duration of the last run
+    UINTN run_count;   // The number of times the case was run, more than once in soak runs
+    UINTN fail_count;
+    Buffer zones;// The profiling zones of the last run as JSON, empty if there were none
+} ResultEntry;
+
+// NOLINTBEGIN
+static ResultEntry* g_entries = NULL;// In the order the cases were first run
+static UINTN g_entry_count = 0;
+static UINTN g_entry_capacity = 0;
+static UINTN* g_slots = NULL;// Maps case IDs to the index of their entry plus one, 0 if the slot is free
+static UINTN g_slot_count = 0;// Always a power of two
+static Buffer g_merged_results = {0};// The results of all modules, only used by the resident runner
+static UINTN g_merged_count = 0;
+// NOLINTEND
+
+// Case IDs are hashes already, so their low bits are used as they are
+static UINTN find_slot(UINT64 case_id) {
+    UINTN slot = (UINTN) case_id & (g_slot_count - 1);
+    while(g_slots[slot] != 0 && g_entries[g_slots[slot] - 1].case_id != case_id) {
+        slot = (slot + 1) & (g_slot_count - 1);
+    }
+    return slot;
+}
+
+// Keeps the table at most half full, so probe sequences stay short
+static BOOLEAN reserve_slots(UINTN entry_count) {
+    if((entry_count << 1) <= g_slot_count) {
+        return TRUE;
+    }
+    const UINTN slot_count = g_slot_count == 0 ? MIN_SLOT_COUNT : g_slot_count << 1;
+    UINTN* slots = malloc(slot_count * sizeof(UINTN));
+    if(slots == NULL) {
+        return FALSE;
+    }
+    free(g_slots);
+    g_slots = slots;
+    g_slot_count = slot_count;
+    for(UINTN index = 0; index < g_entry_count; ++index) {
+        g_slots[find_slot(g_entries[index].case_id)] = index + 1;
+    }
+    return TRUE;
+}
+
+static ResultEntry* get_entry(UINT64 case_id) {
+    if(g_slot_count > 0) {
+        const UINTN slot = find_slot(case_id);
+        if(g_slots[slot] != 0) {
+            return &(g_entries[g_slots[slot] - 1]);
+        }
+    }
+    if(!reserve_slots(g_entry_count + 1)) {
+        return NULL;
+    }
+    if(g_entry_count == g_entry_capacity) {
+        const UINTN capacity = g_entry_capacity == 0 ? MIN_SLOT_COUNT : g_entry_capacity << 1;
+        ResultEntry* entries = realloc(g_entries, capacity * sizeof(ResultEntry));
+        if(entries == NULL) {
+            return NULL;
+        }
+        g_entries = entries;
+        g_entry_capacity = capacity;
+    }
+    ResultEntry* entry = &(g_entries[g_entry_count]);
+    SetMem(entry, sizeof(ResultEntry), 0);
+    entry->case_id = case_id;
+    g_slots[find_slot(case_id)] = ++g_entry_count;
+    return entry;
+}
+
+/*
+ * Cases run more than once by soak runs keep a single entry with
+ * the outcome of their last run, along with run and failure counts.
+ */
+void results_record(const EFITestContext* context) {
+    if(!options_has("results")) {
+        return;
+    }
+    ResultEntry* entry = get_entry(efitest_get_case_id(context));
+    if(entry == NULL) {
+        return;
+    }
+    entry->test_id = context->test_id;
+    entry->group_name = context->group_name;
+    entry->test_name = context->test_name;
+    entry->param_index = context->param_index;
+    entry->status = context->slower ? "slower" : (context->failed ? "failed" : "passed");
+    entry->duration = context->duration;
+    ++entry->run_count;
+    if(context->failed) {
+        ++entry->fail_count;
+    }
+    entry->zones.length = 0;
+    if(profile_has_zones()) {
+        profile_append_json(&(entry->zones));
+    }
+}
+
+static void append_entries(Buffer* buffer) {
+    for(UINTN index = 0; index < g_entry_count; ++index) {
+        const ResultEntry* entry = &(g_entries[index]);
+        buffer_append(buffer, index == 0 ? "\n    {\"id\": \"" : ",\n    {\"id\": \"");
+        buffer_append_hex64(buffer, entry->test_id);
+        buffer_append(buffer, "\", \"case_id\": \"");
+        buffer_append_hex64(buffer, entry->case_id);
+        buffer_append(buffer, "\", \"group\": \"");
+        buffer_append_escaped(buffer, entry->group_name);
+        buffer_append(buffer, "\", \"name\": \"");
+        buffer_append_escaped(buffer, entry->test_name);
+        buffer_append(buffer, "\", \"index\": ");
+        buffer_append_uint64(buffer, entry->param_index);
+        buffer_append(buffer, ", \"status\": \"");
+        buffer_append(buffer, entry->status);
+        buffer_append(buffer, "\", \"duration_ns\": ");
+        buffer_append_uint64(buffer, entry->duration);
+        buffer_append(buffer, ", \"runs\": ");
+        buffer_append_uint64(buffer, entry->run_count);
+        buffer_append(buffer, ", \"failures\": ");
+        buffer_append_uint64(buffer, entry->fail_count);
+        if(entry->zones.length > 0) {
+            buffer_append(buffer, ", \"zones\": ");
+            buffer_append(buffer, entry->zones.data);
+        }
+        buffer_append(buffer, "}");
+    }
+}
+
+void results_store() {
+    const char* path = options_get("results");
+    if(path == NULL) {
+        return;
+    }
+    if(*path == '\0') {
+        path = RESULTS_DEFAULT_PATH;
+    }
+    if(resident_is_module()) {
+        Buffer records = {0};
+        append_entries(&records);
+        resident_submit(RESIDENT_RECORD_RESULTS, records.data, records.length, g_entry_count);
+        buffer_free(&records);
+        return;
+    }
+
+    Buffer document = {0};
+    buffer_append(&document, "{\n  \"version\": 1,\n  \"tests\": [");
+    append_entries(&document);
+    if(g_merged_count > 0) {
+        if(g_entry_count > 0) {
+            buffer_append(&document, ",");
+        }
+        buffer_append(&document, g_merged_results.data);
+    }
+    buffer_append(&document, "\n  ]\n}\n");
+
+    const EFI_STATUS status = file_write(path, document.data, document.length);
+    if(status == EFI_SUCCESS) {
+        Print(ETEST_SPACER L" Wrote " ETEST_FMT_UINTN L" results to %a\n\n", g_entry_count + g_merged_count, path);
+    }
+    else {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Could not write results to %a: %r\n\n", path, status);
+        reset_colors();
+    }
+    buffer_free(&document);
+}
+
+void results_merge(const char* records, UINTN count) {
+    if(count == 0) {
+        return;
+    }
+    if(g_merged_count > 0) {
+        buffer_append(&g_merged_results, ",");
+    }
+    buffer_append(&g_merged_results, records);
+    g_merged_count += count;
+}
+
+void results_free() {
+    for(UINTN index = 0; index < g_entry_count; ++index) {
+        buffer_free(&(g_entries[index].zones));
+    }
+    free(g_entries);
+    free(g_slots);
+    g_entries = NULL;
+    g_slots = NULL;
+    g_entry_count = 0;
+    g_entry_capacity = 0;
+    g_slot_count = 0;
+    buffer_free(&g_merged_results);
+    g_merged_count = 0;
+}
@@ -0,0 +1,52 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Collects the outcome and duration of every test case and
+ * writes them as JSON to the boot volume when --results is
+ * passed, so the discoverer can balance shards using the
+ * durations of previous runs.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define RESULTS_DEFAULT_PATH "\\efitest-results.json"
+
+/**
+ * Record the outcome of the test case described by the given context,
+ * replacing the outcome of an earlier iteration of a soak run.
+ * Does nothing unless results were requested via --results.
+ * @param context The context of the test case which just finished.
+ */
+void results_record(const EFITestContext* context);
+
+/**
+ * Write all recorded results to the path passed via
+ * --results, or RESULTS_DEFAULT_PATH if no path was given.
+ * Modules hand their results to the resident runner instead.
+ */
+void results_store();
+
+/**
+ * Add the results a module handed to the resident runner.
+ * @param records The comma-separated JSON objects of the results.
+ * @param count The number of results.
+ */
+void results_merge(const char* records, UINTN count);
+
+/**
+ * Free all memory associated with the recorded results.
+ */
+void results_free();
@@ -0,0 +1,304 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "soak.h"
+#include "console.h"
+#include "efitest/efitest_utils.h"
+#include "memory.h"
+#include "options.h"
+#include "timer.h"
+
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SECOND 1000000000ULL
+#define SEED_INCREMENT 0x9E3779B97F4A7C15ULL// The golden ratio, as used by SplitMix64
+
+typedef struct _Order {
+    UINTN* indices;
+    UINTN capacity;
+} Order;
+
+// NOLINTBEGIN
+static SoakLimits g_limits = {1, 0, FALSE};
+static BOOLEAN g_is_shuffled = FALSE;
+static UINT64 g_seed = 0;// The seed of the current iteration
+static UINT64 g_random_state = 0;
+static UINTN g_iteration = 0;
+static UINTN g_failed_iterations = 0;
+static UINTN g_last_test_count = 0;
+static UINTN g_last_pass_count = 0;
+static UINT64 g_start_cycles = 0;
+static UINT64 g_iteration_start_cycles = 0;
+static UINT64 g_min_iteration_time = 0;
+static UINT64 g_max_iteration_time = 0;
+static const char* g_stop_reason = "";
+static Order g_group_order = {0};
+static Order g_test_order = {0};
+// NOLINTEND
+
+/*
+ * The output function of SplitMix64, it spreads consecutive
+ * seeds over the whole range so every iteration gets its own order.
+ */
+static UINT64 mix(UINT64 value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+static UINT64 next_random(UINT64* random_state) {
+    *random_state += SEED_INCREMENT;
+    return mix(*random_state);
+}
+
+UINT64 soak_next_seed(UINT64 seed) {
+    return mix(seed + SEED_INCREMENT);
+}
+
+void soak_shuffle_indices(UINTN* indices, UINTN count, UINT64* random_state) {
+    if(count == 0) {
+        return;
+    }
+    for(UINTN index = 0; index < count; ++index) {
+        indices[index] = index;
+    }
+    for(UINTN index = count - 1; index > 0; --index) {
+        const UINTN other_index = (UINTN) (next_random(random_state) % (index + 1));
+        const UINTN value = indices[index];
+        indices[index] = indices[other_index];
+        indices[other_index] = value;
+    }
+}
+
+const char* soak_get_stop_reason(const SoakLimits* limits, UINTN iteration, BOOLEAN has_failed, UINT64 time) {
+    if(limits->is_until_fail && has_failed) {
+        return "a test failed";
+    }
+    if(limits->max_iterations != 0 && iteration >= limits->max_iterations) {
+        return "all iterations were run";
+    }
+    if(limits->max_duration != 0 && time >= limits->max_duration) {
+        return "the duration was reached";
+    }
+    return NULL;
+}
+
+BOOLEAN soak_parse_duration(const char* value, UINT64* duration) {
+    if(*value < '0' || *value > '9') {
+        return FALSE;
+    }
+    UINT64 result = 0;
+    while(*value >= '0' && *value <= '9') {
+        result = (result * 10) + (UINT64) (*(value++) - '0');
+    }
+    if(strcmp(value, "ms") == 0) {
+        *duration = result * NS_PER_MS;
+    }
+    else if(*value == '\0' || strcmp(value, "s") == 0) {
+        *duration = result * NS_PER_SECOND;
+    }
+    else if(strcmp(value, "m") == 0) {
+        *duration = result * 60 * NS_PER_SECOND;
+    }
+    else if(strcmp(value, "h") == 0) {
+        *duration = result * 60 * 60 * NS_PER_SECOND;
+    }
+    else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void print_settings() {
+    if(g_is_shuffled) {
+        Print(ETEST_SPACER L" Shuffling tests with seed 0x%016lx\n", g_seed);
+    }
+    if(!soak_is_enabled()) {
+        Print(L"\n", NULL);
+        return;
+    }
+    Print(ETEST_SPACER L" Soak run", NULL);
+    if(g_limits.max_iterations != 0) {
+        Print(L", up to " ETEST_FMT_UINTN L" iterations", g_limits.max_iterations);
+    }
+    if(g_limits.max_duration != 0) {
+        Print(L", up to " ETEST_FMT_UINT64 L"s", g_limits.max_duration / NS_PER_SECOND);
+    }
+    if(g_limits.is_until_fail) {
+        Print(L", until a test fails", NULL);
+    }
+    Print(L"\n\n", NULL);
+}
+
+void soak_parse_options() {
+    g_limits.is_until_fail = options_has("until-fail");
+    const char* duration = options_get("duration");
+    if(duration != NULL && !soak_parse_duration(duration, &g_limits.max_duration)) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Ignoring malformed duration '%a', expected --duration=<n>[ms|s|m|h]\n\n", duration);
+        reset_colors();
+        g_limits.max_duration = 0;
+    }
+    // Without a repeat count the other conditions end the run, which makes overnight runs a single option
+    const BOOLEAN has_stop_condition = g_limits.is_until_fail || g_limits.max_duration != 0;
+    g_limits.max_iterations = options_get_uintn("repeat", has_stop_condition ? 0 : 1);
+}
+
+void soak_init() {
+    soak_parse_options();
+
+    g_is_shuffled = options_has("shuffle");
+    if(g_is_shuffled) {
+        g_seed = options_get_uintn("shuffle", mix(timer_get_cycles()));
+    }
+    if(g_is_shuffled || soak_is_enabled()) {
+        print_settings();
+    }
+    g_start_cycles = timer_get_cycles();
+}
+
+void soak_free() {
+    free(g_group_order.indices);
+    free(g_test_order.indices);
+    SetMem(&g_group_order, sizeof(Order), 0);
+    SetMem(&g_test_order, sizeof(Order), 0);
+}
+
+UINTN soak_get_iteration_count() {
+    return g_iteration;
+}
+
+BOOLEAN soak_is_enabled() {
+    return g_limits.max_iterations != 1 || g_limits.max_duration != 0 || g_limits.is_until_fail;
+}
+
+void soak_begin_iteration() {
+    // Every iteration prints the seed it was shuffled with, so it can be reproduced on its own
+    if(g_iteration > 0) {
+        g_seed = soak_next_seed(g_seed);
+    }
+    g_random_state = g_seed;
+    ++g_iteration;
+    g_iteration_start_cycles = timer_get_cycles();
+    if(!soak_is_enabled()) {
+        return;
+    }
+
+    set_colors(EFI_BACKGROUND_BLUE | EFI_WHITE);
+    Print(L"Iteration " ETEST_FMT_UINTN, g_iteration);
+    if(g_limits.max_iterations != 0) {
+        Print(L"/" ETEST_FMT_UINTN, g_limits.max_iterations);
+    }
+    if(g_is_shuffled) {
+        Print(L" (seed 0x%016lx)", g_seed);
+    }
+    reset_colors();
+    Print(L"\n\n", NULL);
+}
+
+static inline UINT64 get_throughput(UINTN test_count, UINT64 time) {
+    return time == 0 ? 0 : ((UINT64) test_count * NS_PER_SECOND) / time;
+}
+
+BOOLEAN soak_end_iteration(UINTN test_count, UINTN pass_count) {
+    const UINT64 end_cycles = timer_get_cycles();
+    const UINT64 time = timer_cycles_to_ns(end_cycles - g_iteration_start_cycles);
+    const UINTN iteration_test_count = test_count - g_last_test_count;
+    const UINTN iteration_pass_count = pass_count - g_last_pass_count;
+    const BOOLEAN has_failed = iteration_pass_count < iteration_test_count;
+    g_last_test_count = test_count;
+    g_last_pass_count = pass_count;
+    if(has_failed) {
+        ++g_failed_iterations;
+    }
+    if(g_iteration == 1 || time < g_min_iteration_time) {
+        g_min_iteration_time = time;
+    }
+    if(time > g_max_iteration_time) {
+        g_max_iteration_time = time;
+    }
+    if(!soak_is_enabled()) {
+        return FALSE;
+    }
+
+    set_colors(has_failed ? EFI_RED : EFI_GREEN);
+    Print(L"%a ", has_failed ? ETEST_SPACER_FAILED : ETEST_SPACER_OK);
+    reset_colors();
+    Print(L"Iteration " ETEST_FMT_UINTN L": " ETEST_FMT_UINTN L"/" ETEST_FMT_UINTN L" tests passed in " ETEST_FMT_UINT64
+          L"ms (" ETEST_FMT_UINT64 L" tests/s)\n\n", g_iteration, iteration_pass_count, iteration_test_count,
+          time / NS_PER_MS, get_throughput(iteration_test_count, time));
+    console_print_progress(L"Iteration " ETEST_FMT_UINTN L": " ETEST_FMT_UINTN L"/" ETEST_FMT_UINTN L" tests passed",
+                           g_iteration, iteration_pass_count, iteration_test_count);
+
+    // The duration is only checked between iterations, so every iteration runs the whole suite
+    const UINT64 total_time = timer_cycles_to_ns(end_cycles - g_start_cycles);
+    const char* stop_reason = soak_get_stop_reason(&g_limits, g_iteration, has_failed, total_time);
+    if(stop_reason != NULL) {
+        g_stop_reason = stop_reason;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void soak_print_report(UINTN test_count, UINTN pass_count) {
+    if(!soak_is_enabled()) {
+        return;
+    }
+    const UINT64 time = timer_cycles_to_ns(timer_get_cycles() - g_start_cycles);
+    const UINTN fail_count = test_count - pass_count;
+    // In hundredths of a percent, so rare failures of long runs don't show up as 0%
+    const UINT64 failure_rate = test_count == 0 ? 0 : ((UINT64) fail_count * 10000) / test_count;
+
+    Print(ETEST_SPACER L" Soak run finished after " ETEST_FMT_UINTN L" iterations in " ETEST_FMT_UINT64
+          L"s, %a\n", g_iteration, time / NS_PER_SECOND, g_stop_reason);
+    set_colors(fail_count == 0 ? EFI_GREEN : EFI_RED);
+    Print(L"%a ", fail_count == 0 ? ETEST_SPACER_OK : ETEST_SPACER_FAILED);
+    reset_colors();
+    Print(ETEST_FMT_UINTN L" test cases failed (" ETEST_FMT_UINT64 L".%02d%%), " ETEST_FMT_UINTN L"/"
+          ETEST_FMT_UINTN L" iterations failed\n", fail_count, failure_rate / 100, (INT32) (failure_rate % 100),
+          g_failed_iterations, g_iteration);
+    Print(ETEST_SPACER L" " ETEST_FMT_UINT64 L" tests/s on average, iterations took " ETEST_FMT_UINT64 L"ms to "
+          ETEST_FMT_UINT64 L"ms\n\n", get_throughput(test_count, time), g_min_iteration_time / NS_PER_MS,
+          g_max_iteration_time / NS_PER_MS);
+}
+
+/*
+ * Shuffle the indices using Fisher-Yates, the buffers are kept between
+ * calls so shuffling doesn't allocate for every group. The allocations
+ * happen between tests, but are kept from being accounted to them anyway.
+ */
+static const UINTN* shuffle(Order* order, UINTN count) {
+    if(!g_is_shuffled || count == 0) {
+        return NULL;
+    }
+    if(count > order->capacity) {
+        const BOOLEAN was_tracking = memory_suspend();
+        free(order->indices);
+        order->indices = malloc(count * sizeof(UINTN));
+        memory_resume(was_tracking);
+        if(order->indices == NULL) {
+            order->capacity = 0;
+            return NULL;// Run in the original order instead
+        }
+        order->capacity = count;
+    }
+    soak_shuffle_indices(order->indices, count, &g_random_state);
+    return order->indices;
+}
+
+const UINTN* soak_get_group_order(UINTN count) {
+    return shuffle(&g_group_order, count);
+}
+
+const UINTN* soak_get_test_order(UINTN count) {
+    return shuffle(&g_test_order, count);
+}
@@ -0,0 +1,119 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+/**
+ * Repeats the test run for soak testing via --repeat, --until-fail
+ * and --duration, and shuffles the order of groups and tests with
+ * a reproducible seed via --shuffle.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+typedef struct _SoakLimits {
+    UINTN max_iterations;// 0 if the run is only stopped by a failure or the duration
+    UINT64 max_duration; // In nanoseconds, 0 if unlimited
+    BOOLEAN is_until_fail;
+} SoakLimits;
+
+/**
+ * Parse the soak options without starting a run.
+ */
+void soak_parse_options();
+
+/**
+ * Parse the soak options and print the settings of the run.
+ */
+void soak_init();
+
+/**
+ * Free all memory associated with the soak run.
+ */
+void soak_free();
+
+/**
+ * @return True if the tests may be run more than once.
+ */
+BOOLEAN soak_is_enabled();
+
+/**
+ * @return The number of iterations started so far.
+ */
+UINTN soak_get_iteration_count();
+
+/**
+ * Start the next iteration, which reseeds the shuffled order.
+ */
+void soak_begin_iteration();
+
+/**
+ * Print the results of the iteration which just finished.
+ * @param test_count The total number of test cases run so far.
+ * @param pass_count The total number of test cases passed so far.
+ * @return True if another iteration should be run.
+ */
+BOOLEAN soak_end_iteration(UINTN test_count, UINTN pass_count);
+
+/**
+ * Print the failure rates and throughput over all iterations.
+ * @param test_count The total number of test cases run.
+ * @param pass_count The total number of test cases passed.
+ */
+void soak_print_report(UINTN test_count, UINTN pass_count);
+
+/**
+ * @param count The number of groups.
+ * @return The indices of all groups in the order they should be
+ *  run in, or NULL if they should be run in their original order.
+ */
+const UINTN* soak_get_group_order(UINTN count);
+
+/**
+ * @param count The number of tests in the group.
+ * @return The indices of all tests in the order they should be
+ *  run in, or NULL if they should be run in their original order.
+ *  Only valid until the next call.
+ */
+const UINTN* soak_get_test_order(UINTN count);
+
+/**
+ * Parse a duration like 90, 90s, 15m, 8h or 500ms,
+ * values without a unit are taken as seconds.
+ * @param value The string to parse.
+ * @param duration Receives the duration in nanoseconds.
+ * @return True if the duration could be parsed.
+ */
+BOOLEAN soak_parse_duration(const char* value, UINT64* duration);
+
+/**
+ * @param seed The seed of the previous iteration.
+ * @return The seed of the next iteration.
+ */
+UINT64 soak_next_seed(UINT64 seed);
+
+/**
+ * Fill the indices with 0 to count - 1 and shuffle them using Fisher-Yates.
+ * @param indices The indices to shuffle.
+ * @param count The number of indices.
+ * @param random_state The state of the generator, starts out as the seed.
+ */
+void soak_shuffle_indices(UINTN* indices, UINTN count, UINT64* random_state);
+
+/**
+ * @param limits The conditions which end the run.
+ * @param iteration The number of iterations run so far.
+ * @param has_failed True if a test of the last iteration failed.
+ * @param time The time since the run started in nanoseconds.
+ * @return The reason the run should be stopped, or NULL if another iteration should be run.
+ */
+const char* soak_get_stop_reason(const SoakLimits* limits, UINTN iteration, BOOLEAN has_failed, UINT64 time);
@@ -0,0 +1,36 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "timer.h"
+#include "efitest/efitest_utils.h"
+
+#define CALIBRATION_TIME_US 10000
+
+// NOLINTBEGIN
+static UINT64 g_cycles_per_us = 1;
+// NOLINTEND
+
+void timer_calibrate() {
+    const UINT64 start = timer_get_cycles();
+    UEFI_CALL(ST->BootServices->Stall, CALIBRATION_TIME_US);
+    const UINT64 cycles_per_us = (timer_get_cycles() - start) / CALIBRATION_TIME_US;
+    g_cycles_per_us = cycles_per_us == 0 ? 1 : cycles_per_us;
+}
+
+UINT64 timer_get_cycles_per_us() {
+    return g_cycles_per_us;
+}
+
+UINT64 timer_cycles_to_ns(UINT64 cycles) {
+    return (cycles * 1000) / g_cycles_per_us;
+}
@@ -0,0 +1,60 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Cheap timestamps based on the CPU cycle counter of the
+ * target architecture, calibrated against the boot services.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+static inline UINT64 timer_get_cycles() {
+#if defined(ETEST_ARCH_AMD64) || defined(ETEST_ARCH_IA32)
+    return __builtin_ia32_rdtsc();
+#elif defined(ETEST_ARCH_ARM64)
+    UINT64 value;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#elif defined(ETEST_ARCH_ARM)
+    UINT64 value;
+    __asm__ __volatile__("mrrc p15, 1, %Q0, %R0, c14" : "=r"(value));
+    return value;
+#elif defined(ETEST_ARCH_RISCV64)
+    UINT64 value;
+    __asm__ __volatile__("rdtime %0" : "=r"(value));
+    return value;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Measure the frequency of the cycle counter by stalling
+ * for a fixed amount of time. Has to be called once before
+ * any cycle counts are converted.
+ */
+void timer_calibrate();
+
+/**
+ * @return The number of counter cycles per microsecond.
+ */
+UINT64 timer_get_cycles_per_us();
+
+/**
+ * Convert the given number of counter cycles to nanoseconds.
+ * @param cycles The number of cycles to convert.
+ * @return The given number of cycles in nanoseconds.
+ */
+UINT64 timer_cycles_to_ns(UINT64 cycles);
@@ -0,0 +1,215 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+#include "buffer.h"
+#include "efitest/efitest_utils.h"
+#include "file.h"
+#include "options.h"
+#include "parallel.h"
+#include "resident.h"
+#include "timer.h"
+
+typedef struct _TraceEvent {
+    const char* category;// The category of the phase, NULL if this event ends a phase
+    const char* name;    // The name of the phase
+    UINTN index;         // The index of the test case or TRACE_NO_INDEX
+    UINT64 cycles;       // The value of the cycle counter when the event was recorded
+    UINTN cpu;           // The index of the processor which recorded the event
+} TraceEvent;
+
+// NOLINTBEGIN
+static TraceEvent* g_events = NULL;
+static UINTN g_event_count = 0;
+static UINTN g_event_capacity = 0;
+static UINTN g_open_count = 0;   // The number of recorded phases which didn't end yet
+static UINTN g_dropped_depth = 0;// The number of open phases which were dropped since the buffer was full
+static UINTN g_dropped_count = 0;
+static UINT64 g_start_cycles = 0;
+static Buffer g_merged_events = {0};// The events of all modules, only used by the resident runner
+static UINTN g_merged_count = 0;
+// NOLINTEND
+
+static void append_event(const char* category, const char* name, UINTN index, UINT64 cycles, UINTN cpu) {
+    TraceEvent* event = &(g_events[g_event_count++]);
+    event->category = category;
+    event->name = name;
+    event->index = index;
+    event->cycles = cycles;
+    event->cpu = cpu;
+}
+
+/*
+ * Phases are only recorded by the bootstrap processor, work done on other
+ * processors is added as spans once it finished, see trace_add_span.
+ */
+static void record(const char* category, const char* name, UINTN index) {
+    append_event(category, name, index, timer_get_cycles(), parallel_get_processor_number());
+}
+
+void trace_init() {
+    if(!options_has("trace")) {
+        return;
+    }
+    g_event_capacity = options_get_uintn("trace-buffer", TRACE_DEFAULT_EVENT_COUNT);
+    g_events = malloc(g_event_capacity * sizeof(TraceEvent));
+    if(g_events == NULL) {
+        g_event_capacity = 0;
+    }
+    g_start_cycles = resident_get_start_cycles();// Modules share the timeline of the runner
+}
+
+void trace_free() {
+    free(g_events);
+    g_events = NULL;
+    g_event_count = 0;
+    g_event_capacity = 0;
+    buffer_free(&g_merged_events);
+    g_merged_count = 0;
+}
+
+void trace_begin(const char* category, const char* name, UINTN index) {
+    if(g_events == NULL) {
+        return;
+    }
+    // Always keep room for ending all open phases, so the trace stays balanced
+    if(g_dropped_depth > 0 || g_event_count + g_open_count + 2 > g_event_capacity) {
+        ++g_dropped_depth;
+        ++g_dropped_count;
+        return;
+    }
+    record(category, name, index);
+    ++g_open_count;
+}
+
+void trace_end() {
+    if(g_events == NULL) {
+        return;
+    }
+    if(g_dropped_depth > 0) {
+        --g_dropped_depth;
+        return;
+    }
+    if(g_open_count == 0) {
+        return;
+    }
+    record(NULL, NULL, TRACE_NO_INDEX);
+    --g_open_count;
+}
+
+void trace_add_span(const char* category, const char* name, UINTN cpu, UINT64 begin_cycles, UINT64 end_cycles) {
+    if(g_events == NULL) {
+        return;
+    }
+    if(g_dropped_depth > 0 || g_event_count + g_open_count + 2 > g_event_capacity) {
+        ++g_dropped_count;
+        return;
+    }
+    append_event(category, name, TRACE_NO_INDEX, begin_cycles, cpu);
+    append_event(NULL, NULL, TRACE_NO_INDEX, end_cycles, cpu);
+}
+
+static void append_timestamp(Buffer* buffer, UINT64 cycles) {
+    // Trace viewers expect microseconds, the fraction keeps nanosecond resolution
+    const UINT64 time = timer_cycles_to_ns(cycles - g_start_cycles);
+    buffer_append_uint64(buffer, time / 1000);
+    const UINT64 fraction = time % 1000;
+    buffer_append(buffer, fraction < 10 ? ".00" : (fraction < 100 ? ".0" : "."));
+    buffer_append_uint64(buffer, fraction);
+}
+
+static void append_events(Buffer* buffer) {
+    for(UINTN index = 0; index < g_event_count; ++index) {
+        const TraceEvent* event = &(g_events[index]);
+        buffer_append(buffer, index == 0 ? "\n    {\"ph\": \"" : ",\n    {\"ph\": \"");
+        buffer_append(buffer, event->category != NULL ? "B" : "E");
+        buffer_append(buffer, "\", \"ts\": ");
+        append_timestamp(buffer, event->cycles);
+        buffer_append(buffer, ", \"pid\": 0, \"tid\": ");
+        buffer_append_uint64(buffer, event->cpu);
+        if(event->category != NULL) {
+            buffer_append(buffer, ", \"cat\": \"");
+            buffer_append(buffer, event->category);
+            buffer_append(buffer, "\", \"name\": \"");
+            buffer_append_escaped(buffer, event->name);
+            if(event->index != TRACE_NO_INDEX) {
+                buffer_append(buffer, "[");
+                buffer_append_uint64(buffer, event->index);
+                buffer_append(buffer, "]");
+            }
+            buffer_append(buffer, "\"");
+        }
+        buffer_append(buffer, "}");
+    }
+}
+
+static void print_dropped_count() {
+    if(g_dropped_count > 0) {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" " ETEST_FMT_UINTN L" phases didn't fit into the trace buffer\n\n", g_dropped_count);
+        reset_colors();
+    }
+}
+
+void trace_store() {
+    if(g_events == NULL && g_merged_count == 0) {
+        return;
+    }
+    const char* path = options_get("trace");
+    if(path == NULL || *path == '\0') {
+        path = TRACE_DEFAULT_PATH;
+    }
+    if(resident_is_module()) {
+        Buffer events = {0};
+        append_events(&events);
+        resident_submit(RESIDENT_RECORD_TRACE, events.data, events.length, g_event_count);
+        buffer_free(&events);
+        print_dropped_count();
+        return;
+    }
+
+    Buffer document = {0};
+    buffer_append(&document, "{\n  \"displayTimeUnit\": \"ns\",\n  \"traceEvents\": [");
+    append_events(&document);
+    if(g_merged_count > 0) {
+        if(g_event_count > 0) {
+            buffer_append(&document, ",");
+        }
+        buffer_append(&document, g_merged_events.data);
+    }
+    buffer_append(&document, "\n  ]\n}\n");
+
+    const EFI_STATUS status = file_write(path, document.data, document.length);
+    if(status == EFI_SUCCESS) {
+        Print(ETEST_SPACER L" Wrote " ETEST_FMT_UINTN L" trace events to %a\n\n", g_event_count + g_merged_count,
+              path);
+    }
+    else {
+        set_colors(EFI_YELLOW);
+        Print(ETEST_SPACER L" Could not write trace to %a: %r\n\n", path, status);
+        reset_colors();
+    }
+    print_dropped_count();
+    buffer_free(&document);
+}
+
+void trace_merge(const char* records, UINTN count) {
+    if(count == 0) {
+        return;
+    }
+    if(g_merged_count > 0) {
+        buffer_append(&g_merged_events, ",");
+    }
+    buffer_append(&g_merged_events, records);
+    g_merged_count += count;
+}
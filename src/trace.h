@@ -0,0 +1,81 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/**
+ * Records begin/end events of the run, every group, test and callback
+ * into a preallocated buffer when --trace is passed, and writes them
+ * as Chrome trace event JSON to the boot volume, which can be opened
+ * in chrome://tracing or Perfetto.
+ */
+
+#pragma once
+
+#include "efitest/efitest.h"
+
+#define TRACE_DEFAULT_PATH "\\efitest-trace.json"
+#define TRACE_DEFAULT_EVENT_COUNT 65536
+#define TRACE_NO_INDEX ((UINTN) -1)
+
+#define TRACE_CATEGORY_RUN "run"
+#define TRACE_CATEGORY_GROUP "group"
+#define TRACE_CATEGORY_TEST "test"
+#define TRACE_CATEGORY_CALLBACK "callback"
+#define TRACE_CATEGORY_PARALLEL "parallel"
+
+/**
+ * Allocate the event buffer if --trace was passed, its size
+ * can be changed via --trace-buffer=<events>.
+ */
+void trace_init();
+
+/**
+ * Free the event buffer.
+ */
+void trace_free();
+
+/**
+ * Record the beginning of a phase. Phases have to be properly nested.
+ * @param category The category of the phase, one of the TRACE_CATEGORY_* values.
+ * @param name The name of the phase, has to stay valid until trace_store is called.
+ * @param index The index of the test case for parameterized tests, otherwise TRACE_NO_INDEX.
+ */
+void trace_begin(const char* category, const char* name, UINTN index);
+
+/**
+ * Record the end of the phase which was begun last.
+ */
+void trace_end();
+
+/**
+ * Record a finished phase which ran on another processor.
+ * @param category The category of the phase, one of the TRACE_CATEGORY_* values.
+ * @param name The name of the phase, has to stay valid until trace_store is called.
+ * @param cpu The number of the processor which ran the phase.
+ * @param begin_cycles The value of the cycle counter when the phase began.
+ * @param end_cycles The value of the cycle counter when the phase ended.
+ */
+void trace_add_span(const char* category, const char* name, UINTN cpu, UINT64 begin_cycles, UINT64 end_cycles);
+
+/**
+ * Write all recorded events to the path passed via
+ * --trace, or TRACE_DEFAULT_PATH if no path was given.
+ * Modules hand their events to the resident runner instead.
+ */
+void trace_store();
+
+/**
+ * Add the events a module handed to the resident runner.
+ * @param records The comma-separated JSON objects of the events.
+ * @param count The number of events.
+ */
+void trace_merge(const char* records, UINTN count);
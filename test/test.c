@@ -57,4 +57,11 @@ ETEST_DEFINE_TEST(test_ustring_compare_success) {
 
 ETEST_DEFINE_TEST(test_ustring_compare_failure) {
     ETEST_ASSERT_EQ(u8"HELLO \"WORLD\"!", NULL);
-}
\ No newline at end of file
+}
+
+ETEST_DEFINE_TEST(test_loop_failure) {
+    for(UINTN index = 0; index < 1000; ++index) {
+        ETEST_ASSERT_LT(index, 10);// Reported once with its hit count
+    }
+    ETEST_ASSERT(TRUE);// Doesn't reset the failed state
+}
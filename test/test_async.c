@@ -0,0 +1,68 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+#include <efitest/efitest_utils.h>
+
+#define TIMER_DELAY 100000// In microseconds
+
+static EFI_EVENT g_first_timer = NULL;
+static EFI_EVENT g_second_timer = NULL;
+static EFI_EVENT g_idle_timer = NULL;
+static UINTN g_iteration = 0;
+
+static BOOLEAN start_timer(EFI_EVENT* event, UINT64 delay) {
+    if(EFI_ERROR(UEFI_CALL(ST->BootServices->CreateEvent, EVT_TIMER, 0, NULL, NULL, event))) {
+        return FALSE;
+    }
+    return !EFI_ERROR(UEFI_CALL(ST->BootServices->SetTimer, *event, TimerRelative, delay * 10));
+}
+
+// Both timers elapse at about the same time, so the group takes about TIMER_DELAY instead of twice as long
+ETEST_DEFINE_ASYNC_TEST(test_await_timer) {
+    ETEST_ASYNC_BEGIN();
+    ETEST_ASSERT(start_timer(&g_first_timer, TIMER_DELAY));
+    ETEST_AWAIT_EVENT(g_first_timer, TIMER_DELAY * 10);
+    UEFI_CALL(ST->BootServices->CloseEvent, g_first_timer);
+    ETEST_ASYNC_END();
+}
+
+ETEST_DEFINE_ASYNC_TEST(test_await_other_timer) {
+    ETEST_ASYNC_BEGIN();
+    ETEST_ASSERT(start_timer(&g_second_timer, TIMER_DELAY));
+    ETEST_AWAIT_EVENT(g_second_timer, TIMER_DELAY * 10);
+    UEFI_CALL(ST->BootServices->CloseEvent, g_second_timer);
+    ETEST_ASYNC_END();
+}
+
+ETEST_DEFINE_ASYNC_TEST(test_sleep_loop) {
+    ETEST_ASYNC_BEGIN();
+    for(g_iteration = 0; g_iteration < 3; ++g_iteration) {
+        ETEST_SLEEP(TIMER_DELAY / 4);// The loop counter is static, so it survives sleeping
+    }
+    ETEST_ASSERT_EQ(g_iteration, 3);
+    ETEST_ASYNC_END();
+}
+
+ETEST_DEFINE_TEST(test_between_async_tests) {
+    ETEST_ASSERT(TRUE);
+}
+
+ETEST_DEFINE_ASYNC_TEST(test_await_timeout_failure) {
+    ETEST_ASYNC_BEGIN();
+    // The timer is never set, so waiting for it times out
+    ETEST_ASSERT(!EFI_ERROR(UEFI_CALL(ST->BootServices->CreateEvent, EVT_TIMER, 0, NULL, NULL, &g_idle_timer)));
+    ETEST_TRY_AWAIT_EVENT(g_idle_timer, TIMER_DELAY);
+    UEFI_CALL(ST->BootServices->CloseEvent, g_idle_timer);// Still reached after the timeout was reported
+    ETEST_ASYNC_END();
+}
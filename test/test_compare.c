@@ -0,0 +1,43 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+
+static UINT8 g_buffer[4096];
+static UINT8 g_copy[4096];
+
+ETEST_DEFINE_TEST(test_mem_eq) {
+    for(UINTN index = 0; index < sizeof(g_buffer); ++index) {
+        g_buffer[index] = (UINT8) index;
+        g_copy[index] = (UINT8) index;
+    }
+    ETEST_ASSERT_MEM_EQ(g_buffer, g_copy, sizeof(g_buffer));
+    ETEST_ASSERT_MEM_EQ(g_buffer + 3, g_copy + 3, 29);// Unaligned with a tail
+}
+
+ETEST_DEFINE_TEST(test_mem_eq_failure) {
+    for(UINTN index = 0; index < sizeof(g_buffer); ++index) {
+        g_buffer[index] = (UINT8) index;
+        g_copy[index] = (UINT8) index;
+    }
+    g_copy[1000] ^= 0xFF;
+    g_copy[4095] ^= 0xFF;
+    ETEST_ASSERT_MEM_EQ(g_buffer, g_copy, sizeof(g_buffer));
+}
+
+ETEST_DEFINE_TEST(test_mem_filled) {
+    for(UINTN index = 0; index < sizeof(g_buffer); ++index) {
+        g_buffer[index] = 0xA5;
+    }
+    ETEST_ASSERT_MEM_FILLED(g_buffer, 0xA5, sizeof(g_buffer));
+}
@@ -0,0 +1,40 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+
+/*
+ * Walks a list of records which start with a type and a length
+ * covering the whole record, like the structures of most firmware
+ * tables. Returns the number of bytes covered by valid records.
+ */
+static UINTN walk_records(const UINT8* data, UINTN size, UINTN* count) {
+    UINTN offset = 0;
+    *count = 0;
+    while(size - offset >= 2) {
+        const UINTN length = data[offset + 1];
+        if(length < 2 || length > size - offset) {
+            break;
+        }
+        offset += length;
+        ++(*count);
+    }
+    return offset;
+}
+
+ETEST_DEFINE_FUZZ(fuzz_walk_records, data, size) {
+    UINTN count = 0;
+    const UINTN length = walk_records(data, size, &count);
+    ETEST_ASSERT(length <= size);
+    ETEST_ASSERT(count <= size / 2);
+}
@@ -0,0 +1,24 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+
+ETEST_DEFINE_TEST(test_log_narrow) {
+    UINT64 sum = 0;
+    for(UINTN index = 0; index < 16; ++index) {
+        sum += index;
+        efitest_loglnfa("Partial sum " ETEST_FMT_UINTN " is " ETEST_FMT_UINT64, index, sum);
+    }
+    efitest_loglna("Done summing");
+    ETEST_ASSERT_EQ(sum, 120);
+}
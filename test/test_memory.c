@@ -0,0 +1,28 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+#include <efitest/efitest_utils.h>
+
+ETEST_DEFINE_TEST(test_alloc_free) {
+    UINT8* buffer = malloc(128);
+    ETEST_ASSERT_NE(buffer, NULL);
+    buffer = realloc(buffer, 256);
+    ETEST_ASSERT_EQ(usable_size(buffer), 256);
+    free(buffer);
+}
+
+ETEST_DEFINE_TEST(test_alloc_leak) {
+    UINT8* buffer = malloc(64);
+    ETEST_ASSERT_NE(buffer, NULL);
+}
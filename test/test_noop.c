@@ -24,7 +24,7 @@ ETEST_DEFINE_TEST(test_noop1) {
 ETEST_DEFINE_TEST(test_noop2) {
 }
 
-ETEST_DEFINE_TEST(test_noop3) {
+ETEST_DEFINE_TEST(test_noop3, noop, tagged) {
 }
 
 //ETEST_DEFINE_TEST(test_noop4) {}
@@ -0,0 +1,100 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+#include <efitest/efitest_utils.h>
+
+#define INDEX_COUNT 4096
+#define FAILING_INDEX_COUNT 10
+
+typedef struct _BarrierState {
+    UINTN first_count; // The number of processors which reached the first barrier
+    UINTN second_count;// The number of processors which reached the second barrier
+    UINTN seen_counts[INDEX_COUNT][2];
+} BarrierState;
+
+static UINT8 g_visits[INDEX_COUNT];
+static BarrierState g_barrier_state;
+static UINTN g_failure_line = 0;
+
+static void visit_index(EFITestContext* context, UINTN index, void* data) {
+    __atomic_fetch_add(&(g_visits[index]), 1, __ATOMIC_RELAXED);
+}
+
+static void wait_at_barriers(EFITestContext* context, UINTN index, void* data) {
+    BarrierState* state = data;
+    __atomic_fetch_add(&(state->first_count), 1, __ATOMIC_RELAXED);
+    efitest_parallel_barrier();
+    state->seen_counts[index][0] = __atomic_load_n(&(state->first_count), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(state->second_count), 1, __ATOMIC_RELAXED);
+    efitest_parallel_barrier();// Reuses the barrier, so its generations are checked too
+    state->seen_counts[index][1] = __atomic_load_n(&(state->second_count), __ATOMIC_RELAXED);
+}
+
+// Expands on a single line, so the recorded line matches the one reported by ETEST_ASSERT
+#define ASSERT_GE_AND_RECORD_LINE(a, b)                                                                                \
+    do {                                                                                                               \
+        __atomic_store_n(&g_failure_line, __LINE__ - 4, __ATOMIC_RELAXED);                                             \
+        ETEST_ASSERT_GE(a, b);                                                                                         \
+    } while(0)
+
+static void fail_low_indices(EFITestContext* context, UINTN index, void* data) {
+    ASSERT_GE_AND_RECORD_LINE(index, FAILING_INDEX_COUNT);
+}
+
+ETEST_DEFINE_TEST(test_parallel_for) {
+    SetMem(g_visits, sizeof(g_visits), 0);
+    const UINTN cpu_count = ETEST_PARALLEL_FOR(INDEX_COUNT, visit_index, NULL);
+    ETEST_ASSERT_GE(cpu_count, 1);
+    ETEST_ASSERT_LE(cpu_count, efitest_get_cpu_count());
+    ETEST_ASSERT_MEM_FILLED(g_visits, 1, sizeof(g_visits));// Every index is visited exactly once
+
+    UINTN stats_count = 0;
+    const EFITestCpuStats* stats = efitest_parallel_get_stats(&stats_count);
+    ETEST_ASSERT_EQ(stats_count, cpu_count);
+    UINTN iteration_count = 0;
+    for(UINTN index = 0; index < stats_count; ++index) {
+        iteration_count += stats[index].iteration_count;
+    }
+    ETEST_ASSERT_EQ(iteration_count, INDEX_COUNT);
+}
+
+ETEST_DEFINE_TEST(test_run_on_all_cpus) {
+    SetMem(g_visits, sizeof(g_visits), 0);
+    const UINTN cpu_count = ETEST_RUN_ON_ALL_CPUS(visit_index, NULL);
+    ETEST_ASSERT_GE(cpu_count, 1);
+    ETEST_ASSERT_LE(cpu_count, efitest_get_cpu_count());
+    // Every processor which took part gets its own index below the returned count
+    ETEST_ASSERT_MEM_FILLED(g_visits, 1, cpu_count);
+    ETEST_ASSERT_MEM_FILLED(g_visits + cpu_count, 0, sizeof(g_visits) - cpu_count);
+}
+
+ETEST_DEFINE_TEST(test_parallel_barrier) {
+    SetMem(&g_barrier_state, sizeof(BarrierState), 0);
+    const UINTN cpu_count = ETEST_RUN_ON_ALL_CPUS(wait_at_barriers, &g_barrier_state);
+    // No processor may pass a barrier before all of them reached it
+    for(UINTN index = 0; index < cpu_count; ++index) {
+        ETEST_ASSERT_EQ(g_barrier_state.seen_counts[index][0], cpu_count);
+        ETEST_ASSERT_EQ(g_barrier_state.seen_counts[index][1], cpu_count);
+    }
+}
+
+ETEST_DEFINE_TEST(test_parallel_failure) {
+    const UINTN error_count = efitest_errors_get_count();
+    ETEST_PARALLEL_FOR(INDEX_COUNT, fail_low_indices, NULL);
+    // Reported once with the line of the assertion and a hit count of 10, any other failure is a bug
+    ETEST_ASSERT_EQ(efitest_errors_get_count(), error_count + 1);
+    const EFITestError* error = efitest_errors_get_last();
+    ETEST_ASSERT_EQ(error->line_number, g_failure_line);
+    ETEST_ASSERT_EQ(error->hit_count, FAILING_INDEX_COUNT);
+}
@@ -0,0 +1,37 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+
+typedef struct _ShiftCase {
+    UINT32 value;
+    UINT32 shift;
+    UINT32 expected;
+} ShiftCase;
+
+static const ShiftCase g_shift_cases[] = {
+        {1, 0, 1},
+        {1, 1, 2},
+        {3, 4, 48},
+        {0xFF, 8, 0xFF00},
+};
+
+static const UINTN g_squares[] = {0, 1, 4, 9, 16, 25};
+
+ETEST_DEFINE_PARAM_TEST(test_shift, g_shift_cases) {
+    ETEST_ASSERT_EQ(ETEST_PARAM.value << ETEST_PARAM.shift, ETEST_PARAM.expected);
+}
+
+ETEST_DEFINE_PARAM_TEST(test_squares, g_squares) {
+    ETEST_ASSERT_EQ(ETEST_PARAM_INDEX * ETEST_PARAM_INDEX, ETEST_PARAM);
+}
@@ -0,0 +1,32 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+
+static UINT64 sum_range(UINT64 count) {
+    ETEST_PROFILE_SCOPE("sum_range");
+    volatile UINT64 sum = 0;
+    for(UINT64 index = 0; index < count; ++index) {
+        sum += index;
+    }
+    return sum;
+}
+
+ETEST_DEFINE_TEST(test_profile_zones) {
+    ETEST_PROFILE_BEGIN("outer");
+    for(UINTN index = 0; index < 4; ++index) {
+        ETEST_ASSERT_EQ(sum_range(1000), 499500);
+    }
+    ETEST_PROFILE_END();
+    ETEST_ASSERT_EQ(sum_range(10), 45);
+}
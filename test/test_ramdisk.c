@@ -0,0 +1,126 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+#include <efitest/efitest_ramdisk.h>
+#include <efitest/efitest_utils.h>
+
+#define BLOCK_SIZE ETEST_RAMDISK_BLOCK_SIZE
+#define BLOCK_COUNT 256// Spans several copy-on-write chunks
+#define CHUNK_EDGE_LBA 126// Writes of four blocks from here cross the first chunk boundary
+
+static UINT8 g_image[BLOCK_SIZE * BLOCK_COUNT];
+static UINT8 g_block[BLOCK_SIZE * 4];
+static EFITestRamDisk* g_disk = NULL;// Shared by the tests, so they rely on it being reset in between
+
+static EFI_BLOCK_IO* get_shared_disk() {
+    if(g_disk == NULL) {
+        for(UINTN index = 0; index < sizeof(g_image); ++index) {
+            g_image[index] = (UINT8) (index / BLOCK_SIZE);
+        }
+        g_disk = efitest_ramdisk_create_from_image(g_image, sizeof(g_image), BLOCK_SIZE,
+                                                   ETEST_RAMDISK_RESET_BETWEEN_TESTS | ETEST_RAMDISK_EMULATED);
+    }
+    return g_disk != NULL ? efitest_ramdisk_get_block_io(g_disk) : NULL;
+}
+
+ETEST_DEFINE_TEST(test_ramdisk_write) {
+    EFI_BLOCK_IO* block_io = get_shared_disk();
+    ETEST_ASSERT_NE(block_io, NULL);
+    if(block_io == NULL) {
+        return;
+    }
+    const UINT32 media_id = block_io->Media->MediaId;
+    memset(g_block, 0xAA, sizeof(g_block));
+    EFI_STATUS status = UEFI_CALL(block_io->WriteBlocks, block_io, media_id, CHUNK_EDGE_LBA, sizeof(g_block), g_block);
+    ETEST_ASSERT_EQ(status, EFI_SUCCESS);
+    memset(g_block, 0, sizeof(g_block));
+    status = UEFI_CALL(block_io->ReadBlocks, block_io, media_id, CHUNK_EDGE_LBA, sizeof(g_block), g_block);
+    ETEST_ASSERT_EQ(status, EFI_SUCCESS);
+    ETEST_ASSERT_MEM_FILLED(g_block, 0xAA, sizeof(g_block));
+    ETEST_ASSERT_EQ(g_image[CHUNK_EDGE_LBA * BLOCK_SIZE], (UINT8) CHUNK_EDGE_LBA);// Writes never reach the image
+}
+
+// The first read also catches writes of earlier tests which weren't undone before this one
+ETEST_DEFINE_TEST(test_ramdisk_reset_between_tests) {
+    EFI_BLOCK_IO* block_io = get_shared_disk();
+    ETEST_ASSERT_NE(block_io, NULL);
+    if(block_io == NULL) {
+        return;
+    }
+    const UINT8* expected = g_image + (CHUNK_EDGE_LBA * BLOCK_SIZE);
+    UINT32 media_id = block_io->Media->MediaId;
+    EFI_STATUS status = UEFI_CALL(block_io->ReadBlocks, block_io, media_id, CHUNK_EDGE_LBA, sizeof(g_block), g_block);
+    ETEST_ASSERT_EQ(status, EFI_SUCCESS);
+    ETEST_ASSERT_MEM_EQ(g_block, expected, sizeof(g_block));
+
+    memset(g_block, 0x55, sizeof(g_block));
+    status = UEFI_CALL(block_io->WriteBlocks, block_io, media_id, CHUNK_EDGE_LBA, sizeof(g_block), g_block);
+    ETEST_ASSERT_EQ(status, EFI_SUCCESS);
+    efitest_ramdisk_reset(g_disk);
+    media_id = block_io->Media->MediaId;// Changed by resetting an emulated disk
+    status = UEFI_CALL(block_io->ReadBlocks, block_io, media_id, CHUNK_EDGE_LBA, sizeof(g_block), g_block);
+    ETEST_ASSERT_EQ(status, EFI_SUCCESS);
+    ETEST_ASSERT_MEM_EQ(g_block, expected, sizeof(g_block));
+}
+
+ETEST_DEFINE_TEST(test_ramdisk_out_of_range) {
+    EFI_BLOCK_IO* block_io = get_shared_disk();
+    ETEST_ASSERT_NE(block_io, NULL);
+    if(block_io == NULL) {
+        return;
+    }
+    const UINT32 media_id = block_io->Media->MediaId;
+    ETEST_ASSERT_EQ(block_io->Media->LastBlock, BLOCK_COUNT - 1);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->ReadBlocks, block_io, media_id, BLOCK_COUNT - 1, BLOCK_SIZE * 2, g_block),
+                    EFI_INVALID_PARAMETER);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->ReadBlocks, block_io, media_id, 0, BLOCK_SIZE - 1, g_block),
+                    EFI_BAD_BUFFER_SIZE);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->ReadBlocks, block_io, media_id + 1, 0, BLOCK_SIZE, g_block),
+                    EFI_MEDIA_CHANGED);
+}
+
+ETEST_DEFINE_TEST(test_ramdisk_read_only) {
+    EFITestRamDisk* disk = efitest_ramdisk_create(BLOCK_SIZE * 8, BLOCK_SIZE, ETEST_RAMDISK_READ_ONLY);
+    ETEST_ASSERT_NE(disk, NULL);
+    if(disk == NULL) {
+        return;
+    }
+    ETEST_ASSERT(efitest_ramdisk_is_emulated(disk));
+    EFI_BLOCK_IO* block_io = efitest_ramdisk_get_block_io(disk);
+    ETEST_ASSERT(block_io->Media->ReadOnly);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->WriteBlocks, block_io, block_io->Media->MediaId, 0, BLOCK_SIZE, g_block),
+                    EFI_WRITE_PROTECTED);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->ReadBlocks, block_io, block_io->Media->MediaId, 0, BLOCK_SIZE, g_block),
+                    EFI_SUCCESS);
+    ETEST_ASSERT_MEM_FILLED(g_block, 0, BLOCK_SIZE);
+    efitest_ramdisk_destroy(disk);
+}
+
+// Uses EFI_RAM_DISK_PROTOCOL if the firmware provides it
+ETEST_DEFINE_TEST(test_ramdisk_firmware) {
+    EFITestRamDisk* disk = efitest_ramdisk_create(BLOCK_SIZE * 64, BLOCK_SIZE, 0);
+    ETEST_ASSERT_NE(disk, NULL);
+    if(disk == NULL) {
+        return;
+    }
+    EFI_BLOCK_IO* block_io = efitest_ramdisk_get_block_io(disk);
+    const UINT32 media_id = block_io->Media->MediaId;
+    memset(g_block, 0x55, BLOCK_SIZE);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->WriteBlocks, block_io, media_id, 3, BLOCK_SIZE, g_block), EFI_SUCCESS);
+    efitest_ramdisk_reset(disk);
+    ETEST_ASSERT_EQ(UEFI_CALL(block_io->ReadBlocks, block_io, block_io->Media->MediaId, 3, BLOCK_SIZE, g_block),
+                    EFI_SUCCESS);
+    ETEST_ASSERT_MEM_FILLED(g_block, 0, BLOCK_SIZE);
+    efitest_ramdisk_destroy(disk);
+}
@@ -0,0 +1,90 @@
+// Copyright 2023 Karma Krafts & associates
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efitest/efitest.h>
+#include <efitest/efitest_utils.h>
+#include "soak.h"
+
+#define ORDER_SIZE 16
+#define NS_PER_SECOND 1000000000ULL
+
+static UINTN g_order[ORDER_SIZE];
+static UINTN g_other_order[ORDER_SIZE];
+
+ETEST_DEFINE_TEST(test_soak_shuffle_is_permutation) {
+    UINT64 random_state = 0x1234;
+    soak_shuffle_indices(g_order, ORDER_SIZE, &random_state);
+    BOOLEAN seen[ORDER_SIZE] = {FALSE};
+    for(UINTN index = 0; index < ORDER_SIZE; ++index) {
+        ETEST_ASSERT_LT(g_order[index], ORDER_SIZE);
+        ETEST_ASSERT(!seen[g_order[index]]);
+        seen[g_order[index]] = TRUE;
+    }
+}
+
+ETEST_DEFINE_TEST(test_soak_shuffle_seed) {
+    UINT64 random_state = 42;
+    soak_shuffle_indices(g_order, ORDER_SIZE, &random_state);
+    random_state = 42;
+    soak_shuffle_indices(g_other_order, ORDER_SIZE, &random_state);
+    ETEST_ASSERT_MEM_EQ(g_order, g_other_order, sizeof(g_order));// The same seed reproduces the order
+
+    random_state = soak_next_seed(42);
+    soak_shuffle_indices(g_other_order, ORDER_SIZE, &random_state);
+    ETEST_ASSERT(CompareMem(g_order, g_other_order, sizeof(g_order)) != 0);
+    ETEST_ASSERT_EQ(soak_next_seed(42), soak_next_seed(42));
+    ETEST_ASSERT_NE(soak_next_seed(42), soak_next_seed(43));
+}
+
+ETEST_DEFINE_TEST(test_soak_shuffle_small) {
+    UINT64 random_state = 7;
+    soak_shuffle_indices(g_order, 0, &random_state);
+    ETEST_ASSERT_EQ(random_state, 7);
+    soak_shuffle_indices(g_order, 1, &random_state);
+    ETEST_ASSERT_EQ(g_order[0], 0);
+}
+
+ETEST_DEFINE_TEST(test_soak_parse_duration) {
+    UINT64 duration = 0;
+    ETEST_ASSERT(soak_parse_duration("90", &duration));
+    ETEST_ASSERT_EQ(duration, 90 * NS_PER_SECOND);
+    ETEST_ASSERT(soak_parse_duration("90s", &duration));
+    ETEST_ASSERT_EQ(duration, 90 * NS_PER_SECOND);
+    ETEST_ASSERT(soak_parse_duration("500ms", &duration));
+    ETEST_ASSERT_EQ(duration, 500000000ULL);
+    ETEST_ASSERT(soak_parse_duration("15m", &duration));
+    ETEST_ASSERT_EQ(duration, 15 * 60 * NS_PER_SECOND);
+    ETEST_ASSERT(soak_parse_duration("8h", &duration));
+    ETEST_ASSERT_EQ(duration, 8 * 60 * 60 * NS_PER_SECOND);
+    ETEST_ASSERT(!soak_parse_duration("h", &duration));
+    ETEST_ASSERT(!soak_parse_duration("5d", &duration));
+}
+
+ETEST_DEFINE_TEST(test_soak_stop_iterations) {
+    const SoakLimits limits = {3, 0, FALSE};
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 1, FALSE, 0) == NULL);
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 2, TRUE, 0) == NULL);// Failures only stop --until-fail runs
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 3, FALSE, 0) != NULL);
+}
+
+ETEST_DEFINE_TEST(test_soak_stop_until_fail) {
+    const SoakLimits limits = {0, 0, TRUE};
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 1000, FALSE, 0) == NULL);
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 1001, TRUE, 0) != NULL);
+}
+
+ETEST_DEFINE_TEST(test_soak_stop_duration) {
+    const SoakLimits limits = {0, 60 * NS_PER_SECOND, FALSE};
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 5, FALSE, 59 * NS_PER_SECOND) == NULL);
+    ETEST_ASSERT(soak_get_stop_reason(&limits, 6, FALSE, 60 * NS_PER_SECOND) != NULL);
+}